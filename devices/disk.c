@@ -4,9 +4,15 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include "devices/timer.h"
+#include "threads/init.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
+#ifdef FILESYS
+#include "filesys/cache.h"
+#include "filesys/dcache.h"
+#include "filesys/journal.h"
+#endif
 
 /* The code in this file is an interface to an ATA (IDE)
    controller.  It attempts to comply to [ATA-3]. */
@@ -59,6 +65,7 @@ struct disk {
 
 	long long read_cnt;         /* Number of sectors read. */
 	long long write_cnt;        /* Number of sectors written. */
+	long long write_limit;      /* Cut the power at this WRITE_CNT, or 0. */
 };
 
 /* An ATA channel (aka controller).
@@ -171,6 +178,11 @@ disk_print_stats (void) {
 						d->name, d->read_cnt, d->write_cnt);
 		}
 	}
+#ifdef FILESYS
+	cache_print_stats ();
+	dcache_print_stats ();
+	journal_print_stats ();
+#endif
 }
 
 /* Returns the disk numbered DEV_NO--either 0 or 1 for master or
@@ -234,12 +246,18 @@ disk_read (struct disk *d, disk_sector_t sec_no, void *buffer) {
 void
 disk_write (struct disk *d, disk_sector_t sec_no, const void *buffer) {
 	struct channel *c;
+	bool cut;
 
 	ASSERT (d != NULL);
 	ASSERT (buffer != NULL);
 
 	c = d->channel;
 	lock_acquire (&c->lock);
+	if (d->write_limit != 0 && d->write_cnt >= d->write_limit) {
+		/* The power is off, so the write never happens. */
+		lock_release (&c->lock);
+		return;
+	}
 	select_sector (d, sec_no);
 	issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
 	if (!wait_while_busy (d))
@@ -247,7 +265,24 @@ disk_write (struct disk *d, disk_sector_t sec_no, const void *buffer) {
 	output_sector (c, buffer);
 	sema_down (&c->completion_wait);
 	d->write_cnt++;
+	cut = d->write_cnt == d->write_limit;
 	lock_release (&c->lock);
+
+	if (cut) {
+		printf ("%s: power cut after %lld writes\n", d->name, d->write_cnt);
+		power_cut ();
+	}
+}
+
+/* Makes the machine lose power, as if it were unplugged, once
+   WRITE_CNT more sectors have been written to disk D.  Writes to
+   D after that are lost. */
+void
+disk_cut_power (struct disk *d, long long write_cnt) {
+	ASSERT (d != NULL);
+	ASSERT (write_cnt > 0);
+
+	d->write_limit = d->write_cnt + write_cnt;
 }
 
 /* Disk detection and identification. */
@@ -0,0 +1,440 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <hash.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Sector buffer cache.
+ *
+ * All file system sectors are read and written through a cache of
+ * CACHE_CNT sectors, so that a file that is read twice, or written
+ * a few bytes at a time, costs one disk access per sector rather
+ * than one per call.  Writes only mark the cached sector dirty.
+ * The "flushd" thread writes dirty sectors back every
+ * FLUSH_INTERVAL milliseconds, and so does cache_flush(), which
+ * filesys_done() calls at shutdown.  When the cache is full, the
+ * clock algorithm picks the sector to replace.
+ *
+ * cache_prefetch() queues a sector for the "readahead" thread to
+ * bring in, so that a sequential reader finds the next sectors
+ * already cached.  A prefetched sector counts as a readahead hit
+ * when it is first used, and as a miss if it is replaced unused.
+ *
+ * CACHE_LOCK protects the whole cache, but is not held during disk
+ * I/O.  Instead, an entry whose sector is being read or written is
+ * marked busy, and anyone else who wants it waits on IO_DONE.  That
+ * keeps the data of a sector stable while it is on its way to or
+ * from the disk.  Nor is it held while cache_read() and
+ * cache_write() copy data, which may fault on a user page whose
+ * handler reads a file in turn; the entry is pinned instead, which
+ * keeps it from being replaced.  Copies into a sector racing with
+ * each other are the callers' concern.
+ *
+ * A sector written with cache_write_logged() belongs to the
+ * running journal transaction, and must not reach its home on disk
+ * before the transaction commits.  Such an entry is neither
+ * replaced nor written back until cache_unlog() lets it go. */
+
+/* Number of cached sectors. */
+#define CACHE_CNT 128
+
+/* Milliseconds between write-behind passes. */
+#define FLUSH_INTERVAL 1000
+
+/* Number of sectors that can wait for readahead. */
+#define RA_QUEUE_CNT 64
+
+/* A cached sector. */
+struct cache_entry {
+	struct hash_elem elem;          /* Element in CACHE_MAP, if VALID. */
+	disk_sector_t sector;           /* Sector held, if VALID. */
+	uint8_t *data;                  /* DISK_SECTOR_SIZE bytes. */
+	bool valid;                     /* Holds SECTOR? */
+	bool dirty;                     /* Modified since written back? */
+	bool accessed;                  /* Used since the clock hand passed? */
+	bool busy;                      /* Disk I/O in progress? */
+	bool prefetched;                /* Read ahead and not used yet? */
+	bool logged;                    /* Held for the journal? */
+	int pin_cnt;                    /* Copies in progress. */
+};
+
+static struct cache_entry cache[CACHE_CNT];
+static struct hash cache_map;       /* Valid entries by sector. */
+static struct lock cache_lock;
+static struct condition io_done;    /* An entry stopped being busy. */
+static size_t clock_hand;
+
+/* Sectors queued for readahead, a ring buffer protected by
+ * CACHE_LOCK. */
+static disk_sector_t ra_queue[RA_QUEUE_CNT];
+static size_t ra_head, ra_cnt;
+static struct condition ra_queued;  /* RA_QUEUE is not empty. */
+
+/* Statistics. */
+static long long hit_cnt;           /* Lookups that found the sector. */
+static long long miss_cnt;          /* Lookups that had to read it. */
+static long long writeback_cnt;     /* Dirty sectors written back. */
+static long long ra_read_cnt;       /* Sectors read ahead. */
+static long long ra_hit_cnt;        /* ...and later used. */
+static long long ra_miss_cnt;       /* ...and replaced unused. */
+static long long ra_drop_cnt;       /* Requests dropped, queue full. */
+
+static struct cache_entry *cache_get (disk_sector_t, bool read,
+		bool prefetch);
+static bool write_sector (disk_sector_t, const void *buffer, size_t ofs,
+		size_t size, bool log);
+static struct cache_entry *lookup (disk_sector_t);
+static void unpin (struct cache_entry *, bool dirty);
+static void write_back (struct cache_entry *);
+static void flushd (void *);
+static void readahead_thread (void *);
+static uint64_t cache_hash (const struct hash_elem *, void *);
+static bool cache_less (const struct hash_elem *, const struct hash_elem *,
+		void *);
+
+/* Initializes the buffer cache and starts its write-behind
+ * thread. */
+void
+cache_init (void) {
+	uint8_t *pages;
+	size_t i;
+
+	pages = palloc_get_multiple (PAL_ASSERT,
+			CACHE_CNT * DISK_SECTOR_SIZE / PGSIZE);
+	for (i = 0; i < CACHE_CNT; i++)
+		cache[i].data = pages + i * DISK_SECTOR_SIZE;
+	hash_init (&cache_map, cache_hash, cache_less, NULL);
+	lock_init (&cache_lock);
+	cond_init (&io_done);
+	cond_init (&ra_queued);
+
+	thread_create ("flushd", PRI_DEFAULT, flushd, NULL);
+	thread_create ("readahead", PRI_DEFAULT, readahead_thread, NULL);
+}
+
+/* Copies SIZE bytes at offset OFS of SECTOR into BUFFER. */
+void
+cache_read (disk_sector_t sector, void *buffer, size_t ofs, size_t size) {
+	struct cache_entry *e;
+
+	ASSERT (ofs + size <= DISK_SECTOR_SIZE);
+
+	lock_acquire (&cache_lock);
+	e = cache_get (sector, true, false);
+	e->pin_cnt++;
+	lock_release (&cache_lock);
+
+	memcpy (buffer, e->data + ofs, size);
+	unpin (e, false);
+}
+
+/* Copies SIZE bytes from BUFFER to offset OFS of SECTOR.  The
+ * sector is written to disk later. */
+void
+cache_write (disk_sector_t sector, const void *buffer, size_t ofs,
+		size_t size) {
+	write_sector (sector, buffer, ofs, size, false);
+}
+
+/* Copies SIZE bytes from BUFFER to offset OFS of SECTOR, like
+ * cache_write(), and holds SECTOR in the cache until cache_unlog()
+ * is called for it.  Returns true if SECTOR was not held already.
+ * For the journal only. */
+bool
+cache_write_logged (disk_sector_t sector, const void *buffer, size_t ofs,
+		size_t size) {
+	return write_sector (sector, buffer, ofs, size, true);
+}
+
+/* Lets SECTOR, held by cache_write_logged(), be written back and
+ * replaced again.  It stays dirty. */
+void
+cache_unlog (disk_sector_t sector) {
+	struct cache_entry *e;
+
+	lock_acquire (&cache_lock);
+	e = lookup (sector);
+	ASSERT (e != NULL && e->logged);
+	e->logged = false;
+	cond_broadcast (&io_done, &cache_lock);
+	lock_release (&cache_lock);
+}
+
+/* Writes SECTOR back to disk now if it is cached and dirty, unless
+ * the journal holds it. */
+void
+cache_write_back (disk_sector_t sector) {
+	struct cache_entry *e;
+
+	lock_acquire (&cache_lock);
+	while ((e = lookup (sector)) != NULL && e->busy)
+		cond_wait (&io_done, &cache_lock);
+	if (e != NULL && e->dirty && !e->logged)
+		write_back (e);
+	lock_release (&cache_lock);
+}
+
+/* Queues SECTOR to be read into the cache in the background.  The
+ * request is dropped if the queue is full. */
+void
+cache_prefetch (disk_sector_t sector) {
+	lock_acquire (&cache_lock);
+	if (ra_cnt < RA_QUEUE_CNT) {
+		ra_queue[(ra_head + ra_cnt++) % RA_QUEUE_CNT] = sector;
+		cond_signal (&ra_queued, &cache_lock);
+	} else
+		ra_drop_cnt++;
+	lock_release (&cache_lock);
+}
+
+/* Writes every dirty sector back to disk. */
+void
+cache_flush (void) {
+	cache_flush_matching (NULL, NULL);
+}
+
+/* Writes back every dirty sector for which MATCH, given AUX,
+ * returns true, or every dirty sector if MATCH is null.  This
+ * looks at the cache entries rather than at the sectors MATCH
+ * accepts, so it takes as long for a large file as for a small
+ * one.  MATCH is called with CACHE_LOCK held. */
+void
+cache_flush_matching (bool (*match) (disk_sector_t, void *aux), void *aux) {
+	size_t i;
+
+	lock_acquire (&cache_lock);
+	for (i = 0; i < CACHE_CNT; i++) {
+		struct cache_entry *e = &cache[i];
+
+		while (e->busy)
+			cond_wait (&io_done, &cache_lock);
+		if (e->valid && e->dirty && !e->logged
+				&& (match == NULL || match (e->sector, aux)))
+			write_back (e);
+	}
+	lock_release (&cache_lock);
+}
+
+/* Prints buffer cache statistics. */
+void
+cache_print_stats (void) {
+	long long lookup_cnt = hit_cnt + miss_cnt;
+
+	printf ("Buffer cache: %lld hits, %lld misses (%lld%% hit rate), "
+			"%lld write-backs\n",
+			hit_cnt, miss_cnt, lookup_cnt ? hit_cnt * 100 / lookup_cnt : 0,
+			writeback_cnt);
+	printf ("Readahead: %lld sectors read, %lld hits, %lld misses, "
+			"%lld requests dropped\n",
+			ra_read_cnt, ra_hit_cnt, ra_miss_cnt, ra_drop_cnt);
+}
+
+/* Returns the entry holding SECTOR, bringing it into the cache if
+ * necessary.  If READ is false, the caller is about to overwrite
+ * the whole sector, so a sector not in the cache is not read from
+ * disk; the entry is returned busy instead, since it still holds
+ * the previous sector's data, and the caller must fill it and
+ * then mark it not busy.  PREFETCH is true for readahead, which does not count as a
+ * use of the sector.  CACHE_LOCK must be held; it is released and
+ * reacquired while waiting for disk I/O. */
+static struct cache_entry *
+cache_get (disk_sector_t sector, bool read, bool prefetch) {
+	struct cache_entry *e;
+	size_t i;
+
+	ASSERT (lock_held_by_current_thread (&cache_lock));
+
+	for (;;) {
+		e = lookup (sector);
+		if (e != NULL) {
+			if (e->busy) {
+				cond_wait (&io_done, &cache_lock);
+				continue;
+			}
+			if (prefetch)
+				return e;
+			if (e->prefetched) {
+				e->prefetched = false;
+				ra_hit_cnt++;
+			}
+			e->accessed = true;
+			hit_cnt++;
+			return e;
+		}
+
+		/* Not cached.  Find a victim with the clock algorithm.  If
+		 * every entry is busy, wait for one to finish. */
+		for (i = 0; i < 2 * CACHE_CNT; i++) {
+			e = &cache[clock_hand];
+			clock_hand = (clock_hand + 1) % CACHE_CNT;
+			if (e->busy || e->logged || e->pin_cnt > 0)
+				continue;
+			if (!e->accessed)
+				break;
+			e->accessed = false;
+		}
+		if (i == 2 * CACHE_CNT) {
+			cond_wait (&io_done, &cache_lock);
+			continue;
+		}
+
+		/* A dirty victim is written back first.  Everything may
+		 * have changed by the time that is done, so look again. */
+		if (e->valid && e->dirty) {
+			write_back (e);
+			continue;
+		}
+
+		if (e->valid)
+			hash_delete (&cache_map, &e->elem);
+		if (e->prefetched)
+			ra_miss_cnt++;
+		e->sector = sector;
+		e->valid = true;
+		e->dirty = false;
+		e->accessed = true;
+		e->prefetched = prefetch;
+		hash_insert (&cache_map, &e->elem);
+		if (prefetch)
+			ra_read_cnt++;
+		else
+			miss_cnt++;
+
+		if (read) {
+			e->busy = true;
+			lock_release (&cache_lock);
+			disk_read (filesys_disk, sector, e->data);
+			lock_acquire (&cache_lock);
+			e->busy = false;
+			cond_broadcast (&io_done, &cache_lock);
+		} else
+			e->busy = true;
+		return e;
+	}
+}
+
+/* Does the work of cache_write() and cache_write_logged(). */
+static bool
+write_sector (disk_sector_t sector, const void *buffer, size_t ofs,
+		size_t size, bool log) {
+	struct cache_entry *e;
+	bool newly_logged, claimed;
+
+	ASSERT (ofs + size <= DISK_SECTOR_SIZE);
+
+	/* Overwriting the whole sector: no need to read it first.  An
+	 * entry claimed for it comes back busy, which keeps readers
+	 * off the stale data until the copy is done. */
+	lock_acquire (&cache_lock);
+	e = cache_get (sector, size < DISK_SECTOR_SIZE, false);
+	claimed = e->busy;
+	newly_logged = log && !e->logged;
+	if (log)
+		e->logged = true;
+	if (!claimed)
+		e->pin_cnt++;
+	lock_release (&cache_lock);
+
+	/* A write-back that overlaps the copy may save a mix of old and
+	 * new data, but the entry is marked dirty again afterward. */
+	memcpy (e->data + ofs, buffer, size);
+	if (claimed) {
+		lock_acquire (&cache_lock);
+		e->busy = false;
+		e->dirty = true;
+		cond_broadcast (&io_done, &cache_lock);
+		lock_release (&cache_lock);
+	} else
+		unpin (e, true);
+	return newly_logged;
+}
+
+/* Returns the valid entry for SECTOR, or a null pointer if SECTOR
+ * is not cached.  CACHE_LOCK must be held. */
+static struct cache_entry *
+lookup (disk_sector_t sector) {
+	struct cache_entry key;
+	struct hash_elem *he;
+
+	key.sector = sector;
+	he = hash_find (&cache_map, &key.elem);
+	return he != NULL ? hash_entry (he, struct cache_entry, elem) : NULL;
+}
+
+/* Drops a pin on E, taken for a copy done without CACHE_LOCK held,
+ * and marks E dirty if DIRTY is true. */
+static void
+unpin (struct cache_entry *e, bool dirty) {
+	lock_acquire (&cache_lock);
+	ASSERT (e->pin_cnt > 0);
+	if (dirty)
+		e->dirty = true;
+	if (--e->pin_cnt == 0)
+		cond_broadcast (&io_done, &cache_lock);
+	lock_release (&cache_lock);
+}
+
+/* Writes dirty entry E back to disk.  CACHE_LOCK must be held; it
+ * is released during the write. */
+static void
+write_back (struct cache_entry *e) {
+	ASSERT (e->valid && e->dirty && !e->busy && !e->logged);
+
+	e->busy = true;
+	e->dirty = false;
+	lock_release (&cache_lock);
+	disk_write (filesys_disk, e->sector, e->data);
+	lock_acquire (&cache_lock);
+	e->busy = false;
+	writeback_cnt++;
+	cond_broadcast (&io_done, &cache_lock);
+}
+
+/* The write-behind thread. */
+static void
+flushd (void *aux UNUSED) {
+	for (;;) {
+		timer_msleep (FLUSH_INTERVAL);
+		cache_flush ();
+	}
+}
+
+/* The readahead thread. */
+static void
+readahead_thread (void *aux UNUSED) {
+	lock_acquire (&cache_lock);
+	for (;;) {
+		disk_sector_t sector;
+
+		while (ra_cnt == 0)
+			cond_wait (&ra_queued, &cache_lock);
+		sector = ra_queue[ra_head];
+		ra_head = (ra_head + 1) % RA_QUEUE_CNT;
+		ra_cnt--;
+		cache_get (sector, true, true);
+	}
+}
+
+/* Hashes a cache entry by sector. */
+static uint64_t
+cache_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct cache_entry *ce = hash_entry (e, struct cache_entry, elem);
+
+	return hash_int (ce->sector);
+}
+
+/* Orders cache entries by sector. */
+static bool
+cache_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct cache_entry *a = hash_entry (a_, struct cache_entry, elem);
+	const struct cache_entry *b = hash_entry (b_, struct cache_entry, elem);
+
+	return a->sector < b->sector;
+}
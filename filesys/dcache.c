@@ -0,0 +1,182 @@
+#include "filesys/dcache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
+
+/* Directory entry cache.
+ *
+ * Maps a name in a directory, given by the directory's inode
+ * sector, to the inode sector of the file it names, so that
+ * opening the same files again does not search the directory
+ * again.  A name found missing is cached too, as a negative entry
+ * with sector 0, which always belongs to the file system itself.
+ * dir_add() and dir_remove() keep the cache up to date.  At most
+ * DCACHE_CNT entries are kept; the least recently used one makes
+ * way for a new one. */
+
+/* Maximum number of cached entries. */
+#define DCACHE_CNT 512
+
+/* A cached directory entry. */
+struct dentry {
+	struct hash_elem hash_elem;         /* Element in DCACHE_MAP. */
+	struct list_elem lru_elem;          /* Element in DCACHE_LRU. */
+	disk_sector_t dir;                  /* Directory's inode sector. */
+	char name[NAME_MAX + 1];            /* Name within DIR. */
+	disk_sector_t sector;               /* Inode sector, 0 if none. */
+};
+
+static struct hash dcache_map;
+static struct list dcache_lru;          /* Most recently used first. */
+static struct lock dcache_lock;
+static struct kmem_cache *dentry_cache;
+
+/* Statistics. */
+static long long hit_cnt;               /* Lookups answered, */
+static long long negative_cnt;          /* ...of which negative. */
+static long long miss_cnt;              /* Lookups not answered. */
+
+static struct dentry *find (disk_sector_t dir, const char *name);
+static uint64_t dentry_hash (const struct hash_elem *, void *);
+static bool dentry_less (const struct hash_elem *, const struct hash_elem *,
+		void *);
+
+/* Initializes the directory entry cache. */
+void
+dcache_init (void) {
+	hash_init (&dcache_map, dentry_hash, dentry_less, NULL);
+	list_init (&dcache_lru);
+	lock_init (&dcache_lock);
+	dentry_cache = kmem_cache_create ("dentry", sizeof (struct dentry));
+}
+
+/* Looks up NAME in the directory whose inode is in sector DIR.  If
+ * the cache knows the answer, returns true and sets *SECTORP to
+ * the inode sector NAME refers to, or to 0 if DIR has no such
+ * name.  Returns false otherwise. */
+bool
+dcache_lookup (disk_sector_t dir, const char *name, disk_sector_t *sectorp) {
+	struct dentry *d;
+
+	if (strlen (name) > NAME_MAX)
+		return false;
+
+	lock_acquire (&dcache_lock);
+	d = find (dir, name);
+	if (d != NULL) {
+		list_remove (&d->lru_elem);
+		list_push_front (&dcache_lru, &d->lru_elem);
+		*sectorp = d->sector;
+		hit_cnt++;
+		if (d->sector == 0)
+			negative_cnt++;
+	} else
+		miss_cnt++;
+	lock_release (&dcache_lock);
+	return d != NULL;
+}
+
+/* Records that NAME in the directory whose inode is in sector DIR
+ * refers to the inode in SECTOR, or to nothing if SECTOR is 0. */
+void
+dcache_insert (disk_sector_t dir, const char *name, disk_sector_t sector) {
+	struct dentry *d;
+
+	if (strlen (name) > NAME_MAX)
+		return;
+
+	lock_acquire (&dcache_lock);
+	d = find (dir, name);
+	if (d != NULL)
+		list_remove (&d->lru_elem);
+	else {
+		if (hash_size (&dcache_map) < DCACHE_CNT)
+			d = kmem_cache_alloc (dentry_cache);
+		if (d == NULL) {
+			/* Reuse the least recently used entry. */
+			if (list_empty (&dcache_lru))
+				goto done;
+			d = list_entry (list_pop_back (&dcache_lru), struct dentry,
+					lru_elem);
+			hash_delete (&dcache_map, &d->hash_elem);
+		}
+		d->dir = dir;
+		strlcpy (d->name, name, sizeof d->name);
+		hash_insert (&dcache_map, &d->hash_elem);
+	}
+	d->sector = sector;
+	list_push_front (&dcache_lru, &d->lru_elem);
+
+done:
+	lock_release (&dcache_lock);
+}
+
+/* Drops every entry within the directory whose inode is in sector
+ * DIR, which is going away, so that they cannot be mistaken for
+ * entries of a later inode in the same sector. */
+void
+dcache_forget_dir (disk_sector_t dir) {
+	struct list_elem *e;
+
+	lock_acquire (&dcache_lock);
+	for (e = list_begin (&dcache_lru); e != list_end (&dcache_lru);) {
+		struct dentry *d = list_entry (e, struct dentry, lru_elem);
+
+		e = list_next (e);
+		if (d->dir == dir) {
+			list_remove (&d->lru_elem);
+			hash_delete (&dcache_map, &d->hash_elem);
+			kmem_cache_free (dentry_cache, d);
+		}
+	}
+	lock_release (&dcache_lock);
+}
+
+/* Prints directory entry cache statistics. */
+void
+dcache_print_stats (void) {
+	long long lookup_cnt = hit_cnt + miss_cnt;
+
+	printf ("Dentry cache: %lld hits (%lld negative), %lld misses "
+			"(%lld%% hit rate)\n",
+			hit_cnt, negative_cnt, miss_cnt,
+			lookup_cnt ? hit_cnt * 100 / lookup_cnt : 0);
+}
+
+/* Returns the entry for NAME in DIR, or a null pointer if there is
+ * none.  DCACHE_LOCK must be held. */
+static struct dentry *
+find (disk_sector_t dir, const char *name) {
+	struct dentry key;
+	struct hash_elem *e;
+
+	key.dir = dir;
+	strlcpy (key.name, name, sizeof key.name);
+	e = hash_find (&dcache_map, &key.hash_elem);
+	return e != NULL ? hash_entry (e, struct dentry, hash_elem) : NULL;
+}
+
+/* Hashes a dentry by directory and name. */
+static uint64_t
+dentry_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct dentry *d = hash_entry (e, struct dentry, hash_elem);
+
+	return hash_string (d->name) ^ hash_int (d->dir);
+}
+
+/* Orders dentries by directory, then name. */
+static bool
+dentry_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct dentry *a = hash_entry (a_, struct dentry, hash_elem);
+	const struct dentry *b = hash_entry (b_, struct dentry, hash_elem);
+
+	if (a->dir != b->dir)
+		return a->dir < b->dir;
+	return strcmp (a->name, b->name) < 0;
+}
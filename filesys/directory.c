@@ -1,10 +1,13 @@
 #include "filesys/directory.h"
+#include <hash.h>
 #include <stdio.h>
 #include <string.h>
 #include <list.h>
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
+#include "filesys/free-map.h"
 #include "filesys/inode.h"
-#include "threads/malloc.h"
+#include "threads/slab.h"
 
 /* A directory. */
 struct dir {
@@ -19,6 +22,51 @@ struct dir_entry {
 	bool in_use;                        /* In use or free? */
 };
 
+/* Number of entries read at a time when scanning a directory. */
+#define SCAN_CNT 16
+
+/* Hash index of a large directory.
+ *
+ * A directory is an array of entry slots, searched from the start.
+ * Once it has INDEX_MIN_SLOTS slots, it gets an index as well: a
+ * file of its own, whose inode sector the directory's inode
+ * records, holding this header and then BUCKET_CNT buckets.  The
+ * buckets are an open-addressing hash table on entry names, each
+ * holding the slot number of an entry plus 1, BUCKET_EMPTY or
+ * BUCKET_DELETED.  Entries never move, so readdir() order is the
+ * same with or without the index. */
+struct dir_index {
+	unsigned magic;                     /* INDEX_MAGIC. */
+	uint32_t bucket_cnt;                /* Number of buckets, a power of 2. */
+	uint32_t used_cnt;                  /* Buckets not empty, even deleted. */
+	uint32_t free_hint;                 /* No free slot below this one. */
+};
+
+#define INDEX_MAGIC 0x44494458
+#define INDEX_MIN_SLOTS 64
+#define BUCKET_EMPTY 0
+#define BUCKET_DELETED UINT32_MAX
+
+/* Cache of open directories. */
+static struct kmem_cache *dir_cache;
+
+static struct inode *index_open (const struct dir *, struct dir_index *);
+static bool index_find (const struct dir *, struct inode *index,
+		const struct dir_index *, const char *name, struct dir_entry *,
+		off_t *ofsp, uint32_t *bucketp);
+static bool index_insert (struct inode *index, struct dir_index *,
+		const char *name, uint32_t slot);
+static bool index_build (const struct dir *, struct inode *index,
+		struct dir_index *);
+static bool index_create (const struct dir *);
+static void put_header (struct inode *index, const struct dir_index *);
+
+/* Initializes the directory module. */
+void
+dir_init (void) {
+	dir_cache = kmem_cache_create ("dir", sizeof (struct dir));
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
  * given SECTOR.  Returns true if successful, false on failure. */
 bool
@@ -27,17 +75,20 @@ dir_create (disk_sector_t sector, size_t entry_cnt) {
 }
 
 /* Opens and returns the directory for the given INODE, of which
- * it takes ownership.  Returns a null pointer on failure. */
+ * it takes ownership.  Returns a null pointer on failure.
+ * Directory entries are metadata, so writes to them are
+ * journaled. */
 struct dir *
 dir_open (struct inode *inode) {
-	struct dir *dir = calloc (1, sizeof *dir);
+	struct dir *dir = kmem_cache_zalloc (dir_cache);
 	if (inode != NULL && dir != NULL) {
+		inode_log_data (inode);
 		dir->inode = inode;
 		dir->pos = 0;
 		return dir;
 	} else {
 		inode_close (inode);
-		free (dir);
+		kmem_cache_free (dir_cache, dir);
 		return NULL;
 	}
 }
@@ -61,7 +112,7 @@ void
 dir_close (struct dir *dir) {
 	if (dir != NULL) {
 		inode_close (dir->inode);
-		free (dir);
+		kmem_cache_free (dir_cache, dir);
 	}
 }
 
@@ -71,48 +122,98 @@ dir_get_inode (struct dir *dir) {
 	return dir->inode;
 }
 
-/* Searches DIR for a file with the given NAME.
+/* Searches the slots of DIR for a file with the given NAME.
  * If successful, returns true, sets *EP to the directory entry
  * if EP is non-null, and sets *OFSP to the byte offset of the
  * directory entry if OFSP is non-null.
  * otherwise, returns false and ignores EP and OFSP. */
 static bool
+scan (const struct dir *dir, const char *name,
+		struct dir_entry *ep, off_t *ofsp) {
+	struct dir_entry buf[SCAN_CNT];
+	size_t cnt, i;
+	off_t ofs;
+
+	for (ofs = 0;
+			(cnt = inode_read_at (dir->inode, buf, sizeof buf, ofs)
+			 / sizeof *buf) > 0;
+			ofs += cnt * sizeof *buf)
+		for (i = 0; i < cnt; i++)
+			if (buf[i].in_use && !strcmp (name, buf[i].name)) {
+				if (ep != NULL)
+					*ep = buf[i];
+				if (ofsp != NULL)
+					*ofsp = ofs + i * sizeof *buf;
+				return true;
+			}
+	return false;
+}
+
+/* Searches DIR for a file with the given NAME, through its index
+ * if it has one.  Returns the same as scan(). */
+static bool
 lookup (const struct dir *dir, const char *name,
 		struct dir_entry *ep, off_t *ofsp) {
-	struct dir_entry e;
-	size_t ofs;
+	struct dir_index h;
+	struct inode *index;
+	bool found;
 
 	ASSERT (dir != NULL);
 	ASSERT (name != NULL);
 
-	for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-			ofs += sizeof e)
-		if (e.in_use && !strcmp (name, e.name)) {
-			if (ep != NULL)
-				*ep = e;
-			if (ofsp != NULL)
-				*ofsp = ofs;
-			return true;
-		}
-	return false;
+	index = index_open (dir, &h);
+	if (index == NULL)
+		return scan (dir, name, ep, ofsp);
+	found = index_find (dir, index, &h, name, ep, ofsp, NULL);
+	inode_close (index);
+	return found;
+}
+
+/* Returns the byte offset of the first free slot in DIR at or
+ * after OFS, which is the end of DIR if there is none.
+ *
+ * inode_read_at() will only return a short read at end of file.
+ * Otherwise, we'd need to verify that we didn't get a short
+ * read due to something intermittent such as low memory. */
+static off_t
+find_free_slot (const struct dir *dir, off_t ofs) {
+	struct dir_entry buf[SCAN_CNT];
+	size_t cnt, i;
+
+	for (; (cnt = inode_read_at (dir->inode, buf, sizeof buf, ofs)
+				/ sizeof *buf) > 0;
+			ofs += cnt * sizeof *buf)
+		for (i = 0; i < cnt; i++)
+			if (!buf[i].in_use)
+				return ofs + i * sizeof *buf;
+	return ofs;
 }
 
 /* Searches DIR for a file with the given NAME
  * and returns true if one exists, false otherwise.
  * On success, sets *INODE to an inode for the file, otherwise to
- * a null pointer.  The caller must close *INODE. */
+ * a null pointer.  The caller must close *INODE.
+ * The answer comes from the dentry cache if it has one.  A
+ * search holds the directory lock until its answer is cached,
+ * so that it cannot cache an answer that a concurrent dir_add()
+ * or dir_remove() has already made stale. */
 bool
 dir_lookup (const struct dir *dir, const char *name,
 		struct inode **inode) {
+	disk_sector_t dir_sector, sector;
 	struct dir_entry e;
 
 	ASSERT (dir != NULL);
 	ASSERT (name != NULL);
 
-	if (lookup (dir, name, &e, NULL))
-		*inode = inode_open (e.inode_sector);
-	else
-		*inode = NULL;
+	dir_sector = inode_get_inumber (dir->inode);
+	if (!dcache_lookup (dir_sector, name, &sector)) {
+		inode_lock_dir (dir->inode);
+		sector = lookup (dir, name, &e, NULL) ? e.inode_sector : 0;
+		dcache_insert (dir_sector, name, sector);
+		inode_unlock_dir (dir->inode);
+	}
+	*inode = sector != 0 ? inode_open (sector) : NULL;
 
 	return *inode != NULL;
 }
@@ -126,6 +227,9 @@ dir_lookup (const struct dir *dir, const char *name,
 bool
 dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector) {
 	struct dir_entry e;
+	struct dir_index h;
+	struct inode *index;
+	uint32_t slot;
 	off_t ofs;
 	bool success = false;
 
@@ -137,28 +241,52 @@ dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector) {
 		return false;
 
 	/* Check that NAME is not in use. */
-	if (lookup (dir, name, NULL, NULL))
+	inode_lock_dir (dir->inode);
+	index = index_open (dir, &h);
+	if (index != NULL
+			? index_find (dir, index, &h, name, NULL, NULL, NULL)
+			: scan (dir, name, NULL, NULL))
 		goto done;
 
 	/* Set OFS to offset of free slot.
 	 * If there are no free slots, then it will be set to the
-	 * current end-of-file.
-
-	 * inode_read_at() will only return a short read at end of file.
-	 * Otherwise, we'd need to verify that we didn't get a short
-	 * read due to something intermittent such as low memory. */
-	for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-			ofs += sizeof e)
-		if (!e.in_use)
-			break;
+	 * current end-of-file. */
+	ofs = find_free_slot (dir, index != NULL ? h.free_hint * sizeof e : 0);
+	slot = ofs / sizeof e;
 
 	/* Write slot. */
 	e.in_use = true;
 	strlcpy (e.name, name, sizeof e.name);
 	e.inode_sector = inode_sector;
 	success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+	if (!success)
+		goto done;
+
+	/* Keep the index up to date, or build it once DIR is large
+	 * enough, or build a bigger one in place of the old once that
+	 * is half full.  A directory with an incomplete index would
+	 * look incomplete, so failing to index the entry fails the
+	 * add. */
+	if (index != NULL && (h.used_cnt + 1) * 2 > h.bucket_cnt) {
+		success = index_create (dir);
+		if (success)
+			inode_remove (index);
+	} else if (index != NULL) {
+		h.free_hint = slot + 1;
+		success = index_insert (index, &h, name, slot);
+		put_header (index, &h);
+	} else if (slot + 1 >= INDEX_MIN_SLOTS)
+		success = index_create (dir);
+	if (success)
+		dcache_insert (inode_get_inumber (dir->inode), name, inode_sector);
+	else {
+		e.in_use = false;
+		inode_write_at (dir->inode, &e, sizeof e, ofs);
+	}
 
 done:
+	inode_close (index);
+	inode_unlock_dir (dir->inode);
 	return success;
 }
 
@@ -168,7 +296,9 @@ done:
 bool
 dir_remove (struct dir *dir, const char *name) {
 	struct dir_entry e;
-	struct inode *inode = NULL;
+	struct dir_index h;
+	struct inode *inode = NULL, *index;
+	uint32_t bucket;
 	bool success = false;
 	off_t ofs;
 
@@ -176,7 +306,11 @@ dir_remove (struct dir *dir, const char *name) {
 	ASSERT (name != NULL);
 
 	/* Find directory entry. */
-	if (!lookup (dir, name, &e, &ofs))
+	inode_lock_dir (dir->inode);
+	index = index_open (dir, &h);
+	if (index != NULL
+			? !index_find (dir, index, &h, name, &e, &ofs, &bucket)
+			: !scan (dir, name, &e, &ofs))
 		goto done;
 
 	/* Open inode. */
@@ -189,12 +323,29 @@ dir_remove (struct dir *dir, const char *name) {
 	if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
 		goto done;
 
-	/* Remove inode. */
+	/* Erase its index bucket.  A deleted bucket, unlike an empty
+	 * one, does not end a search. */
+	if (index != NULL) {
+		uint32_t value = BUCKET_DELETED;
+
+		inode_write_at (index, &value, sizeof value,
+				sizeof h + bucket * sizeof value);
+		if (ofs / sizeof e < h.free_hint)
+			h.free_hint = ofs / sizeof e;
+		put_header (index, &h);
+	}
+
+	/* Remove inode.  It may be a directory, whose cached entries
+	 * must not outlive it. */
+	dcache_insert (inode_get_inumber (dir->inode), name, 0);
+	dcache_forget_dir (e.inode_sector);
 	inode_remove (inode);
 	success = true;
 
 done:
 	inode_close (inode);
+	inode_close (index);
+	inode_unlock_dir (dir->inode);
 	return success;
 }
 
@@ -204,13 +355,172 @@ done:
 bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1]) {
 	struct dir_entry e;
+	bool found = false;
 
+	inode_lock_dir (dir->inode);
 	while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) {
 		dir->pos += sizeof e;
 		if (e.in_use) {
 			strlcpy (name, e.name, NAME_MAX + 1);
+			found = true;
+			break;
+		}
+	}
+	inode_unlock_dir (dir->inode);
+	return found;
+}
+
+/* Opens DIR's index and reads its header into *H.  Returns the
+ * index, or a null pointer if DIR has none. */
+static struct inode *
+index_open (const struct dir *dir, struct dir_index *h) {
+	disk_sector_t sector = inode_get_index (dir->inode);
+	struct inode *index;
+
+	if (sector == 0)
+		return NULL;
+	index = inode_open (sector);
+	if (index == NULL)
+		return NULL;
+	inode_log_data (index);
+	if (inode_read_at (index, h, sizeof *h, 0) != sizeof *h
+			|| h->magic != INDEX_MAGIC)
+		PANIC ("directory %"PRDSNu": bad index", inode_get_inumber (dir->inode));
+	return index;
+}
+
+/* Writes header H of INDEX. */
+static void
+put_header (struct inode *index, const struct dir_index *h) {
+	inode_write_at (index, h, sizeof *h, 0);
+}
+
+/* Searches DIR for NAME through INDEX, whose header is H.  Returns
+ * the same as scan(), and also sets *BUCKETP to the number of the
+ * bucket that refers to the entry if BUCKETP is non-null. */
+static bool
+index_find (const struct dir *dir, struct inode *index,
+		const struct dir_index *h, const char *name, struct dir_entry *ep,
+		off_t *ofsp, uint32_t *bucketp) {
+	uint32_t mask = h->bucket_cnt - 1;
+	uint32_t bucket = hash_string (name) & mask;
+	uint32_t i;
+
+	for (i = 0; i < h->bucket_cnt; i++, bucket = (bucket + 1) & mask) {
+		struct dir_entry e;
+		uint32_t value;
+		off_t ofs;
+
+		inode_read_at (index, &value, sizeof value,
+				sizeof *h + bucket * sizeof value);
+		if (value == BUCKET_EMPTY)
+			break;
+		if (value == BUCKET_DELETED)
+			continue;
+
+		ofs = (value - 1) * sizeof e;
+		if (inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e
+				&& e.in_use && !strcmp (name, e.name)) {
+			if (ep != NULL)
+				*ep = e;
+			if (ofsp != NULL)
+				*ofsp = ofs;
+			if (bucketp != NULL)
+				*bucketp = bucket;
 			return true;
 		}
 	}
 	return false;
 }
+
+/* Adds the entry for NAME in slot SLOT to INDEX, whose header is H,
+ * in the first bucket that is empty or deleted.  The caller must
+ * write the header back.  Returns true if successful. */
+static bool
+index_insert (struct inode *index, struct dir_index *h, const char *name,
+		uint32_t slot) {
+	uint32_t mask = h->bucket_cnt - 1;
+	uint32_t bucket = hash_string (name) & mask;
+	uint32_t value;
+
+	for (;; bucket = (bucket + 1) & mask) {
+		inode_read_at (index, &value, sizeof value,
+				sizeof *h + bucket * sizeof value);
+		if (value == BUCKET_EMPTY || value == BUCKET_DELETED)
+			break;
+	}
+	if (value == BUCKET_EMPTY)
+		h->used_cnt++;
+
+	value = slot + 1;
+	return inode_write_at (index, &value, sizeof value,
+			sizeof *h + bucket * sizeof value) == sizeof value;
+}
+
+/* Fills INDEX, which must be empty, whose header is H, from the
+ * entries of DIR, with enough buckets to stay at most a quarter
+ * full as DIR is now.  The caller must write the header back.
+ * Returns true if successful. */
+static bool
+index_build (const struct dir *dir, struct inode *index,
+		struct dir_index *h) {
+	static const uint32_t empty[SCAN_CNT * 8];
+	struct dir_entry buf[SCAN_CNT];
+	size_t slot_cnt = inode_length (dir->inode) / sizeof *buf;
+	size_t cnt, i;
+	off_t ofs;
+
+	h->bucket_cnt = 256;
+	while (h->bucket_cnt < slot_cnt * 4)
+		h->bucket_cnt *= 2;
+	h->used_cnt = 0;
+
+	/* Empty every bucket. */
+	for (ofs = 0; ofs < (off_t) (h->bucket_cnt * sizeof *empty);
+			ofs += sizeof empty)
+		if (inode_write_at (index, empty, sizeof empty, sizeof *h + ofs)
+				!= sizeof empty)
+			return false;
+
+	for (ofs = 0;
+			(cnt = inode_read_at (dir->inode, buf, sizeof buf, ofs)
+			 / sizeof *buf) > 0;
+			ofs += cnt * sizeof *buf)
+		for (i = 0; i < cnt; i++)
+			if (buf[i].in_use
+					&& !index_insert (index, h, buf[i].name,
+						ofs / sizeof *buf + i))
+				return false;
+	return true;
+}
+
+/* Gives DIR a new index of all its entries, in place of any it
+ * has; the caller must remove the old one.  Returns true if
+ * successful.
+ * The index is too big to journal, so it is built in sectors of
+ * its own and written to disk before the journal operation that
+ * makes DIR point to it, which a crash cannot leave half done. */
+static bool
+index_create (const struct dir *dir) {
+	disk_sector_t sector = 0;
+	struct dir_index h;
+	struct inode *index = NULL;
+	bool success;
+
+	h.magic = INDEX_MAGIC;
+	h.free_hint = 0;
+	success = (free_map_allocate (1, &sector)
+			&& inode_create (sector, 0)
+			&& (index = inode_open (sector)) != NULL
+			&& index_build (dir, index, &h));
+	if (success) {
+		put_header (index, &h);
+		inode_flush (index);
+		inode_set_index (dir->inode, sector);
+	} else if (index != NULL)
+		inode_remove (index);
+	else if (sector != 0)
+		free_map_release (sector, 1);
+	inode_close (index);
+	return success;
+}
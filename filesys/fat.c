@@ -1,6 +1,7 @@
 #include "filesys/fat.h"
 #include "devices/disk.h"
 #include "filesys/filesys.h"
+#include "threads/arena.h"
 #include "threads/malloc.h"
 #include "threads/synch.h"
 #include <stdio.h>
@@ -38,12 +39,13 @@ fat_init (void) {
 		PANIC ("FAT init failed");
 
 	// Read boot sector from the disk
-	unsigned int *bounce = malloc (DISK_SECTOR_SIZE);
+	size_t mark = arena_begin ();
+	unsigned int *bounce = arena_alloc (DISK_SECTOR_SIZE);
 	if (bounce == NULL)
 		PANIC ("FAT init failed");
 	disk_read (filesys_disk, FAT_BOOT_SECTOR, bounce);
 	memcpy (&fat_fs->bs, bounce, sizeof (fat_fs->bs));
-	free (bounce);
+	arena_end (mark);
 
 	// Extract FAT info
 	if (fat_fs->bs.magic != FAT_MAGIC)
@@ -58,6 +60,10 @@ fat_open (void) {
 		PANIC ("FAT load failed");
 
 	// Load FAT directly from the disk
+	size_t mark = arena_begin ();
+	uint8_t *bounce = arena_alloc (DISK_SECTOR_SIZE);
+	if (bounce == NULL)
+		PANIC ("FAT load failed");
 	uint8_t *buffer = (uint8_t *) fat_fs->fat;
 	off_t bytes_read = 0;
 	off_t bytes_left = sizeof (fat_fs->fat);
@@ -69,26 +75,24 @@ fat_open (void) {
 			           buffer + bytes_read);
 			bytes_read += DISK_SECTOR_SIZE;
 		} else {
-			uint8_t *bounce = malloc (DISK_SECTOR_SIZE);
-			if (bounce == NULL)
-				PANIC ("FAT load failed");
 			disk_read (filesys_disk, fat_fs->bs.fat_start + i, bounce);
 			memcpy (buffer + bytes_read, bounce, bytes_left);
 			bytes_read += bytes_left;
-			free (bounce);
 		}
 	}
+	arena_end (mark);
 }
 
 void
 fat_close (void) {
 	// Write FAT boot sector
-	uint8_t *bounce = calloc (1, DISK_SECTOR_SIZE);
+	size_t mark = arena_begin ();
+	uint8_t *bounce = arena_alloc (DISK_SECTOR_SIZE);
 	if (bounce == NULL)
 		PANIC ("FAT close failed");
+	memset (bounce, 0, DISK_SECTOR_SIZE);
 	memcpy (bounce, &fat_fs->bs, sizeof (fat_fs->bs));
 	disk_write (filesys_disk, FAT_BOOT_SECTOR, bounce);
-	free (bounce);
 
 	// Write FAT directly to the disk
 	uint8_t *buffer = (uint8_t *) fat_fs->fat;
@@ -102,15 +106,13 @@ fat_close (void) {
 			            buffer + bytes_wrote);
 			bytes_wrote += DISK_SECTOR_SIZE;
 		} else {
-			bounce = calloc (1, DISK_SECTOR_SIZE);
-			if (bounce == NULL)
-				PANIC ("FAT close failed");
+			memset (bounce, 0, DISK_SECTOR_SIZE);
 			memcpy (bounce, buffer + bytes_wrote, bytes_left);
 			disk_write (filesys_disk, fat_fs->bs.fat_start + i, bounce);
 			bytes_wrote += bytes_left;
-			free (bounce);
 		}
 	}
+	arena_end (mark);
 }
 
 void
@@ -153,6 +155,7 @@ fat_boot_create (void) {
 void
 fat_fs_init (void) {
 	/* TODO: Your code goes here. */
+	lock_init (&fat_fs->write_lock);
 }
 
 /*----------------------------------------------------------------------------*/
@@ -1,29 +1,56 @@
 #include "filesys/file.h"
 #include <debug.h>
 #include "filesys/inode.h"
-#include "threads/malloc.h"
+#include "filesys/journal.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
 
 /* An open file. */
 struct file {
 	struct inode *inode;        /* File's inode. */
 	off_t pos;                  /* Current position. */
 	bool deny_write;            /* Has file_deny_write() been called? */
+	unsigned ref_cnt;           /* References, see file_share(). */
+
+	/* Readahead, see readahead(). */
+	off_t ra_next;              /* Where a sequential read would start. */
+	off_t ra_end;               /* End of the data already prefetched. */
+	off_t ra_window;            /* Bytes to prefetch past a read. */
 };
 
+/* Smallest and largest readahead windows, in bytes. */
+#define RA_MIN (2 * DISK_SECTOR_SIZE)
+#define RA_MAX (32 * DISK_SECTOR_SIZE)
+
+/* Cache of open files. */
+static struct kmem_cache *file_cache;
+
+/* Protects the REF_CNT of every file.  A shared file may be closed
+ * by several processes at once. */
+static struct lock ref_lock;
+
+/* Initializes the file module. */
+void
+file_init (void) {
+	file_cache = kmem_cache_create ("file", sizeof (struct file));
+	lock_init (&ref_lock);
+}
+
 /* Opens a file for the given INODE, of which it takes ownership,
  * and returns the new file.  Returns a null pointer if an
  * allocation fails or if INODE is null. */
 struct file *
 file_open (struct inode *inode) {
-	struct file *file = calloc (1, sizeof *file);
+	struct file *file = kmem_cache_zalloc (file_cache);
 	if (inode != NULL && file != NULL) {
 		file->inode = inode;
 		file->pos = 0;
 		file->deny_write = false;
+		file->ref_cnt = 1;
 		return file;
 	} else {
 		inode_close (inode);
-		free (file);
+		kmem_cache_free (file_cache, file);
 		return NULL;
 	}
 }
@@ -48,13 +75,32 @@ file_duplicate (struct file *file) {
 	return nfile;
 }
 
-/* Closes FILE. */
+/* Returns FILE itself, with one more reference to it, which the
+ * caller drops with file_close().  All holders share FILE's
+ * position, so this suits those that only use file_read_at() and
+ * file_write_at(), such as the pages of a memory mapping. */
+struct file *
+file_share (struct file *file) {
+	lock_acquire (&ref_lock);
+	file->ref_cnt++;
+	lock_release (&ref_lock);
+	return file;
+}
+
+/* Drops a reference to FILE, and closes FILE if it was the last. */
 void
 file_close (struct file *file) {
-	if (file != NULL) {
+	bool last;
+
+	if (file == NULL)
+		return;
+	lock_acquire (&ref_lock);
+	last = --file->ref_cnt == 0;
+	lock_release (&ref_lock);
+	if (last) {
 		file_allow_write (file);
 		inode_close (file->inode);
-		free (file);
+		kmem_cache_free (file_cache, file);
 	}
 }
 
@@ -64,6 +110,34 @@ file_get_inode (struct file *file) {
 	return file->inode;
 }
 
+/* Notes that BYTES_READ bytes were just read from FILE at OFS, and
+ * prefetches what comes after if FILE is being read sequentially.
+ * Each read that starts where the previous one ended doubles the
+ * readahead window, up to RA_MAX; any other read shuts readahead
+ * off until the next sequential one. */
+static void
+readahead (struct file *file, off_t ofs, off_t bytes_read) {
+	off_t end = ofs + bytes_read, start;
+
+	if (bytes_read <= 0)
+		return;
+
+	if (ofs != file->ra_next || ofs == 0) {
+		/* A seek, or the first read. */
+		file->ra_window = ofs == 0 ? RA_MIN : 0;
+		file->ra_end = end;
+	} else if (file->ra_window < RA_MAX)
+		file->ra_window = file->ra_window ? file->ra_window * 2 : RA_MIN;
+	file->ra_next = end;
+
+	/* Prefetch only what earlier calls have not asked for yet. */
+	start = file->ra_end > end ? file->ra_end : end;
+	if (file->ra_window > 0 && start < end + file->ra_window) {
+		inode_readahead (file->inode, start, end + file->ra_window - start);
+		file->ra_end = end + file->ra_window;
+	}
+}
+
 /* Reads SIZE bytes from FILE into BUFFER,
  * starting at the file's current position.
  * Returns the number of bytes actually read,
@@ -72,6 +146,7 @@ file_get_inode (struct file *file) {
 off_t
 file_read (struct file *file, void *buffer, off_t size) {
 	off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+	readahead (file, file->pos, bytes_read);
 	file->pos += bytes_read;
 	return bytes_read;
 }
@@ -83,7 +158,9 @@ file_read (struct file *file, void *buffer, off_t size) {
  * The file's current position is unaffected. */
 off_t
 file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs) {
-	return inode_read_at (file->inode, buffer, size, file_ofs);
+	off_t bytes_read = inode_read_at (file->inode, buffer, size, file_ofs);
+	readahead (file, file_ofs, bytes_read);
+	return bytes_read;
 }
 
 /* Writes SIZE bytes from BUFFER into FILE,
@@ -113,6 +190,15 @@ file_write_at (struct file *file, const void *buffer, off_t size,
 	return inode_write_at (file->inode, buffer, size, file_ofs);
 }
 
+/* Writes FILE's changed data through to disk, then commits the
+ * journal so that its length and block map get there too.  Other
+ * files' data stays in the cache. */
+void
+file_sync (struct file *file) {
+	inode_flush (file->inode);
+	journal_commit ();
+}
+
 /* Prevents write operations on FILE's underlying inode
  * until file_allow_write() is called or FILE is closed. */
 void
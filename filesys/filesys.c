@@ -2,10 +2,13 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
+#include "filesys/dcache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
+#include "filesys/journal.h"
 #include "devices/disk.h"
 
 /* The disk that contains the file system. */
@@ -21,7 +24,12 @@ filesys_init (bool format) {
 	if (filesys_disk == NULL)
 		PANIC ("hd0:1 (hdb) not present, file system initialization failed");
 
+	cache_init ();
+	dcache_init ();
 	inode_init ();
+	file_init ();
+	dir_init ();
+	journal_init (format);
 
 #ifdef EFILESYS
 	fat_init ();
@@ -51,23 +59,30 @@ filesys_done (void) {
 #else
 	free_map_close ();
 #endif
+	journal_done ();
 }
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
  * Returns true if successful, false otherwise.
  * Fails if a file named NAME already exists,
- * or if internal memory allocation fails. */
+ * or if internal memory allocation fails.
+ * A crash leaves either the whole file or none of it. */
 bool
 filesys_create (const char *name, off_t initial_size) {
 	disk_sector_t inode_sector = 0;
-	struct dir *dir = dir_open_root ();
-	bool success = (dir != NULL
+	struct dir *dir;
+	bool success;
+
+	journal_begin ();
+	dir = dir_open_root ();
+	success = (dir != NULL
 			&& free_map_allocate (1, &inode_sector)
 			&& inode_create (inode_sector, initial_size)
 			&& dir_add (dir, name, inode_sector));
 	if (!success && inode_sector != 0)
 		free_map_release (inode_sector, 1);
 	dir_close (dir);
+	journal_end ();
 
 	return success;
 }
@@ -95,13 +110,25 @@ filesys_open (const char *name) {
  * or if an internal memory allocation fails. */
 bool
 filesys_remove (const char *name) {
-	struct dir *dir = dir_open_root ();
-	bool success = dir != NULL && dir_remove (dir, name);
+	struct dir *dir;
+	bool success;
+
+	journal_begin ();
+	dir = dir_open_root ();
+	success = dir != NULL && dir_remove (dir, name);
 	dir_close (dir);
+	journal_end ();
 
 	return success;
 }
 
+/* Writes every change made so far through to the disk. */
+void
+filesys_sync (void) {
+	journal_commit ();
+	cache_flush ();
+}
+
 /* Formats the file system. */
 static void
 do_format (void) {
@@ -112,9 +139,12 @@ do_format (void) {
 	fat_create ();
 	fat_close ();
 #else
+	journal_begin ();
 	free_map_create ();
 	if (!dir_create (ROOT_DIR_SECTOR, 16))
 		PANIC ("root directory creation failed");
+	journal_end ();
+	journal_commit ();
 	free_map_close ();
 #endif
 
@@ -4,18 +4,30 @@
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "threads/synch.h"
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per disk sector. */
+static struct lock free_map_lock;    /* Protects the members above. */
+
+/* Sectors freed by the running journal transaction.  They are not
+ * used again until it commits: until then, the free map on disk
+ * still gives them to their old owner, which a write to their new
+ * one, if it is not journaled, could corrupt. */
+static struct bitmap *held;
 
 /* Initializes the free map. */
 void
 free_map_init (void) {
 	free_map = bitmap_create (disk_size (filesys_disk));
-	if (free_map == NULL)
+	held = bitmap_create (disk_size (filesys_disk));
+	if (free_map == NULL || held == NULL)
 		PANIC ("bitmap creation failed--disk is too large");
+	lock_init (&free_map_lock);
 	bitmap_mark (free_map, FREE_MAP_SECTOR);
 	bitmap_mark (free_map, ROOT_DIR_SECTOR);
+	bitmap_set_multiple (free_map, JOURNAL_SECTOR, JOURNAL_SIZE, true);
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
@@ -24,24 +36,82 @@ free_map_init (void) {
  * available. */
 bool
 free_map_allocate (size_t cnt, disk_sector_t *sectorp) {
-	disk_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-	if (sector != BITMAP_ERROR
-			&& free_map_file != NULL
-			&& !bitmap_write (free_map, free_map_file)) {
-		bitmap_set_multiple (free_map, sector, cnt, false);
-		sector = BITMAP_ERROR;
+	disk_sector_t sector = 0;
+
+	lock_acquire (&free_map_lock);
+	while ((sector = bitmap_scan (free_map, sector, cnt, false)) != BITMAP_ERROR
+			&& bitmap_contains (held, sector, cnt, true))
+		sector++;
+	if (sector != BITMAP_ERROR) {
+		bitmap_set_multiple (free_map, sector, cnt, true);
+		if (free_map_file != NULL
+				&& !bitmap_write_part (free_map, free_map_file, sector, cnt)) {
+			bitmap_set_multiple (free_map, sector, cnt, false);
+			sector = BITMAP_ERROR;
+		}
 	}
+	lock_release (&free_map_lock);
 	if (sector != BITMAP_ERROR)
 		*sectorp = sector;
 	return sector != BITMAP_ERROR;
 }
 
-/* Makes CNT sectors starting at SECTOR available for use. */
+/* Allocates as many of the CNT sectors starting at SECTOR as are
+ * free, stopping at the first one that is not.
+ * Returns the number of sectors allocated, which may be 0. */
+size_t
+free_map_extend (disk_sector_t sector, size_t cnt) {
+	size_t n = 0;
+
+	lock_acquire (&free_map_lock);
+	while (n < cnt && sector + n < bitmap_size (free_map)
+			&& !bitmap_test (free_map, sector + n)
+			&& !bitmap_test (held, sector + n))
+		n++;
+	if (n > 0) {
+		bitmap_set_multiple (free_map, sector, n, true);
+		if (free_map_file != NULL
+				&& !bitmap_write_part (free_map, free_map_file, sector, n)) {
+			bitmap_set_multiple (free_map, sector, n, false);
+			n = 0;
+		}
+	}
+	lock_release (&free_map_lock);
+	return n;
+}
+
+/* Makes CNT sectors starting at SECTOR available for use, once the
+ * running journal transaction commits. */
 void
 free_map_release (disk_sector_t sector, size_t cnt) {
+	lock_acquire (&free_map_lock);
 	ASSERT (bitmap_all (free_map, sector, cnt));
 	bitmap_set_multiple (free_map, sector, cnt, false);
-	bitmap_write (free_map, free_map_file);
+	bitmap_set_multiple (held, sector, cnt, true);
+	bitmap_write_part (free_map, free_map_file, sector, cnt);
+	lock_release (&free_map_lock);
+}
+
+/* Lets sectors freed before the journal transaction that just
+ * committed be allocated again. */
+void
+free_map_commit (void) {
+	if (held == NULL)
+		return;
+	lock_acquire (&free_map_lock);
+	bitmap_set_all (held, false);
+	lock_release (&free_map_lock);
+}
+
+/* Returns true if SECTOR is allocated. */
+bool
+free_map_in_use (disk_sector_t sector) {
+	bool in_use;
+
+	lock_acquire (&free_map_lock);
+	in_use = bitmap_test (free_map, sector);
+	lock_release (&free_map_lock);
+	return in_use;
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -50,6 +120,7 @@ free_map_open (void) {
 	free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
 	if (free_map_file == NULL)
 		PANIC ("can't open free map");
+	inode_log_data (file_get_inode (free_map_file));
 	if (!bitmap_read (free_map, free_map_file))
 		PANIC ("can't read free map");
 }
@@ -64,14 +135,24 @@ free_map_close (void) {
  * it. */
 void
 free_map_create (void) {
+	struct file *file;
+
 	/* Create inode. */
 	if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
 		PANIC ("free map creation failed");
 
-	/* Write bitmap to file. */
-	free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
-	if (free_map_file == NULL)
+	/* Write bitmap to file.  The file starts out as a hole, so the
+	 * first write allocates its sectors, changing the bitmap as it
+	 * goes; FREE_MAP_FILE stays null until then so that those
+	 * allocations do not write the file in turn.  The second write
+	 * saves the final bitmap. */
+	file = file_open (inode_open (FREE_MAP_SECTOR));
+	if (file == NULL)
 		PANIC ("can't open free map");
+	inode_log_data (file_get_inode (file));
+	if (!bitmap_write (free_map, file))
+		PANIC ("can't write free map");
+	free_map_file = file;
 	if (!bitmap_write (free_map, free_map_file))
 		PANIC ("can't write free map");
 }
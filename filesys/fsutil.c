@@ -2,10 +2,14 @@
 #include <debug.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <bitmap.h>
 #include <string.h>
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "filesys/inode.h"
+#include "filesys/journal.h"
 #include "devices/disk.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
@@ -187,3 +191,54 @@ fsutil_get (char **argv) {
 	file_close (src);
 	free (buffer);
 }
+
+/* Checks the free map against the sectors that the files in the
+ * root directory actually use, and prints how many sectors are
+ * allocated but unused, used but free, and used twice. */
+void
+fsutil_fsck (char **argv UNUSED) {
+	struct bitmap *used;
+	struct inode *inode;
+	struct dir *dir;
+	char name[NAME_MAX + 1];
+	size_t file_cnt = 0, leak_cnt = 0, lost_cnt = 0, dup_cnt = 0;
+	disk_sector_t sector;
+
+	printf ("Checking the file system...\n");
+	used = bitmap_create (disk_size (filesys_disk));
+	if (used == NULL)
+		PANIC ("couldn't allocate bitmap");
+	bitmap_set_multiple (used, JOURNAL_SECTOR, JOURNAL_SIZE, true);
+
+	inode = inode_open (FREE_MAP_SECTOR);
+	if (inode == NULL)
+		PANIC ("free map open failed");
+	dup_cnt += inode_mark_sectors (inode, used);
+	inode_close (inode);
+
+	dir = dir_open_root ();
+	if (dir == NULL)
+		PANIC ("root dir open failed");
+	dup_cnt += inode_mark_sectors (dir_get_inode (dir), used);
+	while (dir_readdir (dir, name)) {
+		if (!dir_lookup (dir, name, &inode))
+			PANIC ("%s: lookup failed", name);
+		dup_cnt += inode_mark_sectors (inode, used);
+		inode_close (inode);
+		file_cnt++;
+	}
+	dir_close (dir);
+
+	for (sector = 0; sector < bitmap_size (used); sector++) {
+		bool in_use = free_map_in_use (sector);
+
+		if (in_use && !bitmap_test (used, sector))
+			leak_cnt++;
+		else if (!in_use && bitmap_test (used, sector))
+			lost_cnt++;
+	}
+	bitmap_destroy (used);
+
+	printf ("%zu files: %zu sectors leaked, %zu free but in use, "
+			"%zu in use twice\n", file_cnt, leak_cnt, lost_cnt, dup_cnt);
+}
@@ -1,22 +1,58 @@
 #include "filesys/inode.h"
-#include <list.h>
+#include <bitmap.h>
+#include <hash.h>
 #include <debug.h>
 #include <round.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* A run of consecutive data sectors. */
+struct extent {
+	disk_sector_t start;                /* First sector. */
+	uint32_t cnt;                       /* Number of sectors. */
+};
+
+/* Number of extents kept in the inode itself, in one indirect
+ * block, and in all the indirect blocks a doubly indirect block
+ * points to. */
+#define DIRECT_CNT 60
+#define INDIRECT_CNT (DISK_SECTOR_SIZE / sizeof (struct extent))
+#define PTRS_PER_SECTOR (DISK_SECTOR_SIZE / sizeof (disk_sector_t))
+#define DOUBLY_CNT (PTRS_PER_SECTOR * INDIRECT_CNT)
+
+/* The start of an extent that is a hole: file sectors with no disk
+ * sectors behind them, which read as zeros until written.  Sector
+ * 0 always belongs to the file system itself. */
+#define HOLE 0
+
 /* On-disk inode.
- * Must be exactly DISK_SECTOR_SIZE bytes long. */
+ * Must be exactly DISK_SECTOR_SIZE bytes long.
+ *
+ * The data is a list of extents in file order.  The first
+ * DIRECT_CNT are kept here, the next INDIRECT_CNT in sector
+ * INDIRECT, and the rest in the indirect blocks whose sectors
+ * DOUBLY_INDIRECT lists.  A sector number of 0 means no block.
+ * The extents may cover more sectors than LENGTH needs if a write
+ * ran out of space part way through, and some of them may be
+ * holes. */
 struct inode_disk {
-	disk_sector_t start;                /* First data sector. */
 	off_t length;                       /* File size in bytes. */
 	unsigned magic;                     /* Magic number. */
-	uint32_t unused[125];               /* Not used. */
+	uint32_t extent_cnt;                /* Number of extents. */
+	disk_sector_t indirect;             /* Indirect block. */
+	disk_sector_t doubly_indirect;      /* Doubly indirect block. */
+	disk_sector_t index;                /* Directory's hash index, or 0. */
+	uint32_t unused[2];                 /* Not used. */
+	struct extent direct[DIRECT_CNT];   /* First extents. */
 };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -26,48 +62,139 @@ bytes_to_sectors (off_t size) {
 	return DIV_ROUND_UP (size, DISK_SECTOR_SIZE);
 }
 
+/* An extent and the first sector of the file that it holds. */
+struct mapped_extent {
+	uint32_t ofs;                       /* File sector of E's first sector. */
+	struct extent e;
+};
+
 /* In-memory inode. */
 struct inode {
-	struct list_elem elem;              /* Element in inode list. */
+	struct hash_elem elem;              /* Element in open_inodes. */
 	disk_sector_t sector;               /* Sector number of disk location. */
 	int open_cnt;                       /* Number of openers. */
 	bool removed;                       /* True if deleted, false otherwise. */
+	bool log_data;                      /* Journal writes to the data? */
+	bool failed;                        /* Could not be read in? */
 	int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
 	struct inode_disk data;             /* Inode content. */
+	struct mapped_extent *extents;      /* All DATA.EXTENT_CNT extents. */
+	size_t extent_cap;                  /* Capacity of EXTENTS. */
+
+	/* Held for reading to read the data, and for writing to write
+	 * it or to change the members above. */
+	struct rwlock rw;
+	struct lock dir_lock;               /* Directory entries, see
+	                                     * inode_lock_dir(). */
 };
 
+static char zeros[DISK_SECTOR_SIZE];
+
+static bool load_extents (struct inode *);
+static void put_failed (struct inode *);
+static bool inode_grow (struct inode *, off_t length);
+static disk_sector_t fill_hole (struct inode *, uint32_t idx);
+static void release_data (struct inode *);
+static void write_data (struct inode *, disk_sector_t, const void *,
+		size_t ofs, size_t size);
+static size_t mark (struct bitmap *, disk_sector_t, size_t cnt);
+
+/* Returns the number of file sectors INODE's extents cover,
+ * including holes. */
+static size_t
+mapped_sectors (const struct inode *inode) {
+	const struct mapped_extent *last;
+
+	if (inode->data.extent_cnt == 0)
+		return 0;
+	last = &inode->extents[inode->data.extent_cnt - 1];
+	return last->ofs + last->e.cnt;
+}
+
+/* Returns the index of the extent of INODE that holds file sector
+ * IDX, which INODE's extents must cover.  Binary search on the
+ * cached extents keeps this O(log n) in the number of extents. */
+static size_t
+find_extent (const struct inode *inode, uint32_t idx) {
+	size_t lo = 0, hi = inode->data.extent_cnt;
+
+	ASSERT (idx < mapped_sectors (inode));
+
+	/* Find the last extent that starts at or before IDX. */
+	while (hi - lo > 1) {
+		size_t mid = (lo + hi) / 2;
+
+		if (inode->extents[mid].ofs <= idx)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* Returns the disk sector that holds byte offset POS within
+ * INODE's extents, which must cover it, or HOLE if there is
+ * none. */
+static disk_sector_t
+lookup_sector (const struct inode *inode, off_t pos) {
+	uint32_t idx = pos / DISK_SECTOR_SIZE;
+	const struct mapped_extent *m = &inode->extents[find_extent (inode, idx)];
+
+	return m->e.start == HOLE ? HOLE : m->e.start + (idx - m->ofs);
+}
+
 /* Returns the disk sector that contains byte offset POS within
- * INODE.
+ * INODE, or HOLE if that part of INODE has never been written.
  * Returns -1 if INODE does not contain data for a byte at offset
  * POS. */
 static disk_sector_t
 byte_to_sector (const struct inode *inode, off_t pos) {
 	ASSERT (inode != NULL);
 	if (pos < inode->data.length)
-		return inode->data.start + pos / DISK_SECTOR_SIZE;
+		return lookup_sector (inode, pos);
 	else
 		return -1;
 }
 
-/* List of open inodes, so that opening a single inode twice
- * returns the same `struct inode'. */
-static struct list open_inodes;
+/* Open inodes by sector, so that opening a single inode twice
+ * returns the same `struct inode'.  OPEN_INODES_LOCK protects the
+ * table and the open_cnt of every inode in it.
+ *
+ * An inode goes into the table before it is read from disk, with
+ * its RW lock held for writing until it has been.  Another opener
+ * of the same sector waits on that lock, so a miss delays only
+ * the openers of the inode being read in. */
+static struct hash open_inodes;
+static struct lock open_inodes_lock;
+
+static uint64_t inode_hash (const struct hash_elem *, void *);
+static bool inode_less (const struct hash_elem *, const struct hash_elem *,
+		void *);
+
+/* Cache of in-memory inodes. */
+static struct kmem_cache *inode_cache;
 
 /* Initializes the inode module. */
 void
 inode_init (void) {
-	list_init (&open_inodes);
+	hash_init (&open_inodes, inode_hash, inode_less, NULL);
+	lock_init (&open_inodes_lock);
+	inode_cache = kmem_cache_create ("inode", sizeof (struct inode));
 }
 
 /* Initializes an inode with LENGTH bytes of data and
  * writes the new inode to sector SECTOR on the file system
  * disk.
+ * The data starts out as a hole, so no data sectors are written
+ * or even allocated until they are first written.
+ * This is one journal operation.
  * Returns true if successful.
  * Returns false if memory or disk allocation fails. */
 bool
 inode_create (disk_sector_t sector, off_t length) {
 	struct inode_disk *disk_inode = NULL;
-	bool success = false;
+	struct inode *inode;
+	bool success;
 
 	ASSERT (length >= 0);
 
@@ -76,23 +203,30 @@ inode_create (disk_sector_t sector, off_t length) {
 	ASSERT (sizeof *disk_inode == DISK_SECTOR_SIZE);
 
 	disk_inode = calloc (1, sizeof *disk_inode);
-	if (disk_inode != NULL) {
-		size_t sectors = bytes_to_sectors (length);
-		disk_inode->length = length;
-		disk_inode->magic = INODE_MAGIC;
-		if (free_map_allocate (sectors, &disk_inode->start)) {
-			disk_write (filesys_disk, sector, disk_inode);
-			if (sectors > 0) {
-				static char zeros[DISK_SECTOR_SIZE];
-				size_t i;
-
-				for (i = 0; i < sectors; i++) 
-					disk_write (filesys_disk, disk_inode->start + i, zeros); 
-			}
-			success = true; 
-		} 
-		free (disk_inode);
+	if (disk_inode == NULL)
+		return false;
+	disk_inode->magic = INODE_MAGIC;
+	journal_begin ();
+	journal_write (sector, disk_inode, 0, DISK_SECTOR_SIZE);
+	free (disk_inode);
+
+	/* Allocate the data the same way a write past the end of the
+	 * file would. */
+	inode = inode_open (sector);
+	if (inode == NULL) {
+		journal_end ();
+		return false;
 	}
+	rwlock_acquire_write (&inode->rw);
+	success = inode_grow (inode, length);
+	if (success) {
+		inode->data.length = length;
+		journal_write (sector, &inode->data, 0, DISK_SECTOR_SIZE);
+	} else
+		release_data (inode);
+	rwlock_release_write (&inode->rw);
+	inode_close (inode);
+	journal_end ();
 	return success;
 }
 
@@ -101,39 +235,89 @@ inode_create (disk_sector_t sector, off_t length) {
  * Returns a null pointer if memory allocation fails. */
 struct inode *
 inode_open (disk_sector_t sector) {
-	struct list_elem *e;
-	struct inode *inode;
+	struct inode key, *inode;
+	struct hash_elem *e;
+	bool failed;
 
 	/* Check whether this inode is already open. */
-	for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-			e = list_next (e)) {
-		inode = list_entry (e, struct inode, elem);
-		if (inode->sector == sector) {
-			inode_reopen (inode);
-			return inode; 
+	lock_acquire (&open_inodes_lock);
+	key.sector = sector;
+	e = hash_find (&open_inodes, &key.elem);
+	if (e != NULL) {
+		inode = hash_entry (e, struct inode, elem);
+		inode->open_cnt++;
+		lock_release (&open_inodes_lock);
+
+		/* Wait for it to be read in, if it is still being read. */
+		rwlock_acquire_read (&inode->rw);
+		failed = inode->failed;
+		rwlock_release_read (&inode->rw);
+		if (failed) {
+			put_failed (inode);
+			return NULL;
 		}
+		return inode;
 	}
 
 	/* Allocate memory. */
-	inode = malloc (sizeof *inode);
-	if (inode == NULL)
+	inode = kmem_cache_alloc (inode_cache);
+	if (inode == NULL) {
+		lock_release (&open_inodes_lock);
 		return NULL;
+	}
 
-	/* Initialize. */
-	list_push_front (&open_inodes, &inode->elem);
+	/* Initialize, and claim the sector in the table. */
 	inode->sector = sector;
 	inode->open_cnt = 1;
 	inode->deny_write_cnt = 0;
 	inode->removed = false;
-	disk_read (filesys_disk, inode->sector, &inode->data);
+	inode->log_data = false;
+	inode->failed = false;
+	rwlock_init (&inode->rw);
+	lock_init (&inode->dir_lock);
+	rwlock_acquire_write (&inode->rw);
+	hash_insert (&open_inodes, &inode->elem);
+	lock_release (&open_inodes_lock);
+
+	/* Read it in. */
+	cache_read (inode->sector, &inode->data, 0, DISK_SECTOR_SIZE);
+	if (!load_extents (inode)) {
+		inode->failed = true;
+		lock_acquire (&open_inodes_lock);
+		hash_delete (&open_inodes, &inode->elem);
+		lock_release (&open_inodes_lock);
+		rwlock_release_write (&inode->rw);
+		put_failed (inode);
+		return NULL;
+	}
+	rwlock_release_write (&inode->rw);
 	return inode;
 }
 
+/* Drops an opener's reference to INODE, which could not be read
+ * in and is no longer in the table, and frees it if that was the
+ * last one. */
+static void
+put_failed (struct inode *inode) {
+	bool last;
+
+	lock_acquire (&open_inodes_lock);
+	last = --inode->open_cnt == 0;
+	lock_release (&open_inodes_lock);
+	if (last) {
+		free (inode->extents);
+		kmem_cache_free (inode_cache, inode);
+	}
+}
+
 /* Reopens and returns INODE. */
 struct inode *
 inode_reopen (struct inode *inode) {
-	if (inode != NULL)
+	if (inode != NULL) {
+		lock_acquire (&open_inodes_lock);
 		inode->open_cnt++;
+		lock_release (&open_inodes_lock);
+	}
 	return inode;
 }
 
@@ -153,19 +337,34 @@ inode_close (struct inode *inode) {
 		return;
 
 	/* Release resources if this was the last opener. */
-	if (--inode->open_cnt == 0) {
-		/* Remove from inode list and release lock. */
-		list_remove (&inode->elem);
-
-		/* Deallocate blocks if removed. */
-		if (inode->removed) {
-			free_map_release (inode->sector, 1);
-			free_map_release (inode->data.start,
-					bytes_to_sectors (inode->data.length)); 
+	lock_acquire (&open_inodes_lock);
+	if (--inode->open_cnt > 0) {
+		lock_release (&open_inodes_lock);
+		return;
+	}
+	hash_delete (&open_inodes, &inode->elem);
+	lock_release (&open_inodes_lock);
+
+	/* Deallocate blocks if removed. */
+	if (inode->removed) {
+		journal_begin ();
+		free_map_release (inode->sector, 1);
+		release_data (inode);
+
+		/* A directory's index goes with it. */
+		if (inode->data.index != 0) {
+			struct inode *index = inode_open (inode->data.index);
+
+			if (index != NULL) {
+				inode_remove (index);
+				inode_close (index);
+			}
 		}
-
-		free (inode); 
+		journal_end ();
 	}
+
+	free (inode->extents);
+	kmem_cache_free (inode_cache, inode);
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -183,8 +382,8 @@ off_t
 inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
 	uint8_t *buffer = buffer_;
 	off_t bytes_read = 0;
-	uint8_t *bounce = NULL;
 
+	rwlock_acquire_read (&inode->rw);
 	while (size > 0) {
 		/* Disk sector to read, starting byte offset within sector. */
 		disk_sector_t sector_idx = byte_to_sector (inode, offset);
@@ -200,53 +399,83 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
 		if (chunk_size <= 0)
 			break;
 
-		if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) {
-			/* Read full sector directly into caller's buffer. */
-			disk_read (filesys_disk, sector_idx, buffer + bytes_read); 
-		} else {
-			/* Read sector into bounce buffer, then partially copy
-			 * into caller's buffer. */
-			if (bounce == NULL) {
-				bounce = malloc (DISK_SECTOR_SIZE);
-				if (bounce == NULL)
-					break;
-			}
-			disk_read (filesys_disk, sector_idx, bounce);
-			memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-		}
+		if (sector_idx == HOLE)
+			memset (buffer + bytes_read, 0, chunk_size);
+		else
+			cache_read (sector_idx, buffer + bytes_read, sector_ofs,
+					chunk_size);
 
 		/* Advance. */
 		size -= chunk_size;
 		offset += chunk_size;
 		bytes_read += chunk_size;
 	}
-	free (bounce);
+	rwlock_release_read (&inode->rw);
 
 	return bytes_read;
 }
 
+/* Asks for the sectors holding the SIZE bytes of INODE starting at
+ * OFFSET to be read into the buffer cache in the background. */
+void
+inode_readahead (struct inode *inode, off_t offset, off_t size) {
+	off_t end = offset + size;
+
+	rwlock_acquire_read (&inode->rw);
+	if (end > inode_length (inode))
+		end = inode_length (inode);
+	for (offset = ROUND_DOWN (offset, DISK_SECTOR_SIZE); offset < end;
+			offset += DISK_SECTOR_SIZE) {
+		disk_sector_t sector = byte_to_sector (inode, offset);
+
+		if (sector != HOLE)
+			cache_prefetch (sector);
+	}
+	rwlock_release_read (&inode->rw);
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
  * Returns the number of bytes actually written, which may be
- * less than SIZE if end of file is reached or an error occurs.
- * (Normally a write at end of file would extend the inode, but
- * growth is not yet implemented.) */
+ * less than SIZE if the disk fills up or an error occurs.
+ * Sectors in a hole get a disk sector when first written.
+ * A write past end of file extends the inode; the new length
+ * takes effect once the data is in place, so readers never see
+ * the zeroed sectors in between.
+ * Each change to INODE's extents and length is a journal
+ * operation of its own, unless the caller has begun one, but the
+ * data is journaled only if inode_log_data() was called.  The
+ * copies from BUFFER are made outside any operation of ours, so
+ * that a page fault on BUFFER never delays a commit. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 		off_t offset) {
 	const uint8_t *buffer = buffer_;
 	off_t bytes_written = 0;
-	uint8_t *bounce = NULL;
+	off_t limit;
 
-	if (inode->deny_write_cnt)
+	rwlock_acquire_write (&inode->rw);
+	if (inode->deny_write_cnt) {
+		rwlock_release_write (&inode->rw);
 		return 0;
+	}
+
+	limit = inode_length (inode);
+	if (size > 0 && offset + size > limit) {
+		journal_begin ();
+		inode_grow (inode, offset + size);
+		journal_end ();
+		limit = mapped_sectors (inode) * DISK_SECTOR_SIZE;
+		if (limit > offset + size)
+			limit = offset + size;
+	}
 
 	while (size > 0) {
 		/* Sector to write, starting byte offset within sector. */
-		disk_sector_t sector_idx = byte_to_sector (inode, offset);
+		disk_sector_t sector_idx;
 		int sector_ofs = offset % DISK_SECTOR_SIZE;
 
 		/* Bytes left in inode, bytes left in sector, lesser of the two. */
-		off_t inode_left = inode_length (inode) - offset;
+		off_t inode_left = limit - offset;
 		int sector_left = DISK_SECTOR_SIZE - sector_ofs;
 		int min_left = inode_left < sector_left ? inode_left : sector_left;
 
@@ -254,36 +483,35 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 		int chunk_size = size < min_left ? size : min_left;
 		if (chunk_size <= 0)
 			break;
-
-		if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) {
-			/* Write full sector directly to disk. */
-			disk_write (filesys_disk, sector_idx, buffer + bytes_written); 
-		} else {
-			/* We need a bounce buffer. */
-			if (bounce == NULL) {
-				bounce = malloc (DISK_SECTOR_SIZE);
-				if (bounce == NULL)
-					break;
-			}
-
-			/* If the sector contains data before or after the chunk
-			   we're writing, then we need to read in the sector
-			   first.  Otherwise we start with a sector of all zeros. */
-			if (sector_ofs > 0 || chunk_size < sector_left) 
-				disk_read (filesys_disk, sector_idx, bounce);
-			else
-				memset (bounce, 0, DISK_SECTOR_SIZE);
-			memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-			disk_write (filesys_disk, sector_idx, bounce); 
+		sector_idx = lookup_sector (inode, offset);
+		if (sector_idx == HOLE) {
+			journal_begin ();
+			sector_idx = fill_hole (inode, offset / DISK_SECTOR_SIZE);
+			if (sector_idx != HOLE && chunk_size < DISK_SECTOR_SIZE)
+				write_data (inode, sector_idx, zeros, 0, DISK_SECTOR_SIZE);
+			journal_end ();
+			if (sector_idx == HOLE)
+				break;
 		}
 
+		/* The cache reads the sector in first unless the chunk
+		 * covers all of it. */
+		write_data (inode, sector_idx, buffer + bytes_written, sector_ofs,
+				chunk_size);
+
 		/* Advance. */
 		size -= chunk_size;
 		offset += chunk_size;
 		bytes_written += chunk_size;
 	}
-	free (bounce);
 
+	if (bytes_written > 0 && offset > inode->data.length) {
+		journal_begin ();
+		inode->data.length = offset;
+		journal_write (inode->sector, &inode->data, 0, DISK_SECTOR_SIZE);
+		journal_end ();
+	}
+	rwlock_release_write (&inode->rw);
 	return bytes_written;
 }
 
@@ -292,8 +520,10 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 	void
 inode_deny_write (struct inode *inode) 
 {
+	rwlock_acquire_write (&inode->rw);
 	inode->deny_write_cnt++;
 	ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+	rwlock_release_write (&inode->rw);
 }
 
 /* Re-enables writes to INODE.
@@ -301,9 +531,120 @@ inode_deny_write (struct inode *inode)
  * inode_deny_write() on the inode, before closing the inode. */
 void
 inode_allow_write (struct inode *inode) {
+	rwlock_acquire_write (&inode->rw);
 	ASSERT (inode->deny_write_cnt > 0);
 	ASSERT (inode->deny_write_cnt <= inode->open_cnt);
 	inode->deny_write_cnt--;
+	rwlock_release_write (&inode->rw);
+}
+
+/* Returns the sector of the inode of INODE's directory index, or
+ * 0 if it has none.  See directory.c. */
+disk_sector_t
+inode_get_index (const struct inode *inode) {
+	return inode->data.index;
+}
+
+/* Records SECTOR as the inode of INODE's directory index. */
+void
+inode_set_index (struct inode *inode, disk_sector_t sector) {
+	journal_begin ();
+	rwlock_acquire_write (&inode->rw);
+	inode->data.index = sector;
+	journal_write (inode->sector, &inode->data, 0, DISK_SECTOR_SIZE);
+	rwlock_release_write (&inode->rw);
+	journal_end ();
+}
+
+/* Makes writes to INODE's data go through the journal, as they
+ * must for a directory or the free map, whose data is metadata.
+ * Such writes must be made within a journal operation. */
+void
+inode_log_data (struct inode *inode) {
+	rwlock_acquire_write (&inode->rw);
+	inode->log_data = true;
+	rwlock_release_write (&inode->rw);
+}
+
+/* Returns true if SECTOR holds data of INODE_. */
+static bool
+holds_data (disk_sector_t sector, void *inode_) {
+	struct inode *inode = inode_;
+	size_t i;
+
+	for (i = 0; i < inode->data.extent_cnt; i++) {
+		const struct extent *e = &inode->extents[i].e;
+
+		if (e->start != HOLE && sector - e->start < e->cnt)
+			return true;
+	}
+	return false;
+}
+
+/* Writes INODE's cached data sectors to disk now.  Only the dirty
+ * sectors in the cache are looked at, not every sector of the
+ * file. */
+void
+inode_flush (struct inode *inode) {
+	rwlock_acquire_read (&inode->rw);
+	cache_flush_matching (holds_data, inode);
+	rwlock_release_read (&inode->rw);
+}
+
+/* Marks the sectors that INODE uses in USED: its own, its index
+ * blocks and data, and those of a directory's index.  Returns how
+ * many of them were marked already. */
+size_t
+inode_mark_sectors (struct inode *inode, struct bitmap *used) {
+	disk_sector_t index;
+	size_t dup_cnt, i;
+
+	rwlock_acquire_read (&inode->rw);
+	dup_cnt = mark (used, inode->sector, 1);
+	for (i = 0; i < inode->data.extent_cnt; i++)
+		if (inode->extents[i].e.start != HOLE)
+			dup_cnt += mark (used, inode->extents[i].e.start,
+					inode->extents[i].e.cnt);
+	if (inode->data.indirect != 0)
+		dup_cnt += mark (used, inode->data.indirect, 1);
+	if (inode->data.doubly_indirect != 0) {
+		dup_cnt += mark (used, inode->data.doubly_indirect, 1);
+		for (i = 0; i < PTRS_PER_SECTOR; i++) {
+			disk_sector_t block;
+
+			cache_read (inode->data.doubly_indirect, &block,
+					i * sizeof block, sizeof block);
+			if (block != 0)
+				dup_cnt += mark (used, block, 1);
+		}
+	}
+	index = inode->data.index;
+	rwlock_release_read (&inode->rw);
+
+	if (index != 0) {
+		struct inode *index_inode = inode_open (index);
+
+		if (index_inode != NULL) {
+			dup_cnt += inode_mark_sectors (index_inode, used);
+			inode_close (index_inode);
+		}
+	}
+	return dup_cnt;
+}
+
+/* Acquires the lock that serializes searches and changes of the
+ * entries of INODE, a directory.  It is separate from the lock on
+ * INODE's data, which directory operations take and drop many
+ * times over. */
+void
+inode_lock_dir (struct inode *inode) {
+	lock_acquire (&inode->dir_lock);
+}
+
+/* Releases the lock acquired by inode_lock_dir(). */
+void
+inode_unlock_dir (struct inode *inode) {
+	lock_release (&inode->dir_lock);
 }
 
 /* Returns the length, in bytes, of INODE's data. */
@@ -311,3 +652,310 @@ off_t
 inode_length (const struct inode *inode) {
 	return inode->data.length;
 }
+
+/* Makes sure *BLOCK names an index block, allocating a zeroed one
+ * if it is 0 and CREATE is true.  Returns true if *BLOCK is nonzero
+ * afterward. */
+static bool
+get_block (disk_sector_t *block, bool create) {
+	if (*block == 0 && create && free_map_allocate (1, block))
+		journal_write (*block, zeros, 0, DISK_SECTOR_SIZE);
+	return *block != 0;
+}
+
+/* Finds where extent I of INODE, which must not be a direct one,
+ * is stored: at byte *OFS of sector *SECTOR.  If CREATE is true,
+ * allocates the index blocks on the way as needed.  Returns false
+ * if I is out of range or a block is missing and cannot be
+ * allocated. */
+static bool
+locate_extent (struct inode *inode, size_t i, bool create,
+		disk_sector_t *sector, off_t *ofs) {
+	disk_sector_t block;
+	off_t block_ofs;
+
+	ASSERT (i >= DIRECT_CNT);
+
+	i -= DIRECT_CNT;
+	if (i < INDIRECT_CNT) {
+		if (!get_block (&inode->data.indirect, create))
+			return false;
+		*sector = inode->data.indirect;
+		*ofs = i * sizeof (struct extent);
+		return true;
+	}
+
+	i -= INDIRECT_CNT;
+	if (i >= DOUBLY_CNT || !get_block (&inode->data.doubly_indirect, create))
+		return false;
+	block_ofs = i / INDIRECT_CNT * sizeof (disk_sector_t);
+	cache_read (inode->data.doubly_indirect, &block, block_ofs, sizeof block);
+	if (block == 0) {
+		if (!get_block (&block, create))
+			return false;
+		journal_write (inode->data.doubly_indirect, &block, block_ofs,
+				sizeof block);
+	}
+	*sector = block;
+	*ofs = i % INDIRECT_CNT * sizeof (struct extent);
+	return true;
+}
+
+/* Writes extent I of INODE to where it belongs on disk, except
+ * that direct extents only go into INODE->data, for the caller to
+ * write back.  Returns false if an index block cannot be
+ * allocated. */
+static bool
+store_extent (struct inode *inode, size_t i) {
+	const struct extent *e = &inode->extents[i].e;
+	disk_sector_t sector;
+	off_t ofs;
+
+	if (i < DIRECT_CNT) {
+		inode->data.direct[i] = *e;
+		return true;
+	}
+	if (!locate_extent (inode, i, true, &sector, &ofs))
+		return false;
+	journal_write (sector, e, ofs, sizeof *e);
+	return true;
+}
+
+/* Reads all of INODE's extents into INODE->extents.  Returns false
+ * if memory allocation fails. */
+static bool
+load_extents (struct inode *inode) {
+	size_t cnt = inode->data.extent_cnt;
+	uint32_t ofs = 0;
+	size_t i;
+
+	inode->extent_cap = cnt > 8 ? cnt : 8;
+	inode->extents = malloc (inode->extent_cap * sizeof *inode->extents);
+	if (inode->extents == NULL)
+		return false;
+
+	for (i = 0; i < cnt; i++) {
+		struct mapped_extent *m = &inode->extents[i];
+
+		if (i < DIRECT_CNT)
+			m->e = inode->data.direct[i];
+		else {
+			disk_sector_t sector;
+			off_t sector_ofs;
+
+			if (!locate_extent (inode, i, false, &sector, &sector_ofs))
+				PANIC ("inode %"PRDSNu": extent %zu missing",
+						inode->sector, i);
+			cache_read (sector, &m->e, sector_ofs, sizeof m->e);
+		}
+		m->ofs = ofs;
+		ofs += m->e.cnt;
+	}
+	return true;
+}
+
+/* Makes room for INODE to hold CNT extents, in memory and on disk.
+ * Returns false if memory or an index block cannot be allocated or
+ * CNT is more extents than an inode can hold. */
+static bool
+reserve_extents (struct inode *inode, size_t cnt) {
+	size_t i;
+
+	if (cnt > inode->extent_cap) {
+		size_t cap = inode->extent_cap * 2 > cnt ? inode->extent_cap * 2 : cnt;
+		struct mapped_extent *extents;
+
+		extents = realloc (inode->extents, cap * sizeof *extents);
+		if (extents == NULL)
+			return false;
+		inode->extents = extents;
+		inode->extent_cap = cap;
+	}
+
+	for (i = inode->data.extent_cnt; i < cnt; i++) {
+		disk_sector_t sector;
+		off_t ofs;
+
+		if (i >= DIRECT_CNT && !locate_extent (inode, i, true, &sector, &ofs))
+			return false;
+	}
+	return true;
+}
+
+/* Replaces extent K of INODE by the N extents in PIECES, which
+ * must cover the same file sectors, and stores every extent from K
+ * on, since they all may have moved.  Returns false, leaving INODE
+ * unchanged, if room cannot be made for the new extents. */
+static bool
+splice_extents (struct inode *inode, size_t k,
+		const struct mapped_extent *pieces, size_t n) {
+	size_t cnt = inode->data.extent_cnt + n - 1;
+	size_t i;
+
+	if (!reserve_extents (inode, cnt))
+		return false;
+	memmove (&inode->extents[k + n], &inode->extents[k + 1],
+			(inode->data.extent_cnt - k - 1) * sizeof *inode->extents);
+	memcpy (&inode->extents[k], pieces, n * sizeof *pieces);
+	inode->data.extent_cnt = cnt;
+	for (i = k; i < cnt; i++)
+		store_extent (inode, i);
+	return true;
+}
+
+/* Adds an extent of CNT sectors starting at START to the end of
+ * INODE's data.  Returns false if room cannot be made for it. */
+static bool
+append_extent (struct inode *inode, disk_sector_t start, uint32_t cnt) {
+	size_t i = inode->data.extent_cnt;
+	struct mapped_extent *m;
+
+	if (!reserve_extents (inode, i + 1))
+		return false;
+	m = &inode->extents[i];
+	m->ofs = mapped_sectors (inode);
+	m->e.start = start;
+	m->e.cnt = cnt;
+	store_extent (inode, i);
+	inode->data.extent_cnt++;
+	return true;
+}
+
+/* Extends INODE's extents to cover LENGTH bytes with a hole.  That
+ * costs a write of the inode at most, however much it grows.
+ * Returns true if successful, false if room cannot be made for
+ * another extent. */
+static bool
+inode_grow (struct inode *inode, off_t length) {
+	size_t want = bytes_to_sectors (length);
+	size_t have = mapped_sectors (inode);
+	struct mapped_extent *last;
+
+	if (have >= want)
+		return true;
+
+	last = (inode->data.extent_cnt > 0
+			? &inode->extents[inode->data.extent_cnt - 1] : NULL);
+	if (last != NULL && last->e.start == HOLE) {
+		last->e.cnt += want - have;
+		store_extent (inode, inode->data.extent_cnt - 1);
+	} else if (!append_extent (inode, HOLE, want - have))
+		return false;
+	journal_write (inode->sector, &inode->data, 0, DISK_SECTOR_SIZE);
+	return true;
+}
+
+/* Gives file sector IDX of INODE, which must be in a hole, a disk
+ * sector of its own, and returns it.  The caller must initialize
+ * the sector.  A hole filled from the front, as a sequential
+ * writer does, extends the data extent before it when the next
+ * disk sector is free, so the file stays in few extents.  Returns
+ * HOLE if the disk is full or the extents cannot be split. */
+static disk_sector_t
+fill_hole (struct inode *inode, uint32_t idx) {
+	size_t k = find_extent (inode, idx);
+	struct mapped_extent hole = inode->extents[k];
+	struct mapped_extent *prev = k > 0 ? &inode->extents[k - 1] : NULL;
+	struct mapped_extent pieces[3];
+	disk_sector_t sector;
+	size_t n = 0;
+
+	ASSERT (hole.e.start == HOLE);
+
+	if (idx == hole.ofs && prev != NULL && prev->e.start != HOLE
+			&& free_map_extend (prev->e.start + prev->e.cnt, 1) == 1) {
+		sector = prev->e.start + prev->e.cnt++;
+		store_extent (inode, k - 1);
+		if (hole.e.cnt == 1)
+			splice_extents (inode, k, NULL, 0);
+		else {
+			inode->extents[k].ofs++;
+			inode->extents[k].e.cnt--;
+			store_extent (inode, k);
+		}
+	} else {
+		if (!free_map_allocate (1, &sector))
+			return HOLE;
+
+		/* Split the hole around IDX. */
+		if (idx > hole.ofs)
+			pieces[n++] = (struct mapped_extent) {
+				.ofs = hole.ofs, .e = { HOLE, idx - hole.ofs } };
+		pieces[n++] = (struct mapped_extent) {
+			.ofs = idx, .e = { sector, 1 } };
+		if (idx + 1 < hole.ofs + hole.e.cnt)
+			pieces[n++] = (struct mapped_extent) {
+				.ofs = idx + 1, .e = { HOLE, hole.ofs + hole.e.cnt - idx - 1 } };
+		if (!splice_extents (inode, k, pieces, n)) {
+			free_map_release (sector, 1);
+			return HOLE;
+		}
+	}
+
+	journal_write (inode->sector, &inode->data, 0, DISK_SECTOR_SIZE);
+	return sector;
+}
+
+/* Frees INODE's data sectors and index blocks. */
+static void
+release_data (struct inode *inode) {
+	size_t i;
+
+	for (i = 0; i < inode->data.extent_cnt; i++)
+		if (inode->extents[i].e.start != HOLE)
+			free_map_release (inode->extents[i].e.start,
+					inode->extents[i].e.cnt);
+
+	if (inode->data.doubly_indirect != 0) {
+		for (i = 0; i < PTRS_PER_SECTOR; i++) {
+			disk_sector_t block;
+
+			cache_read (inode->data.doubly_indirect, &block,
+					i * sizeof block, sizeof block);
+			if (block != 0)
+				free_map_release (block, 1);
+		}
+		free_map_release (inode->data.doubly_indirect, 1);
+	}
+	if (inode->data.indirect != 0)
+		free_map_release (inode->data.indirect, 1);
+}
+
+/* Writes SIZE bytes from BUFFER to offset OFS of SECTOR, which
+ * holds INODE's data, through the journal if INODE->log_data. */
+static void
+write_data (struct inode *inode, disk_sector_t sector, const void *buffer,
+		size_t ofs, size_t size) {
+	if (inode->log_data)
+		journal_write (sector, buffer, ofs, size);
+	else
+		cache_write (sector, buffer, ofs, size);
+}
+
+/* Marks the CNT sectors starting at START in USED, and returns how
+ * many of them were marked already. */
+static size_t
+mark (struct bitmap *used, disk_sector_t start, size_t cnt) {
+	size_t dup_cnt = bitmap_count (used, start, cnt, true);
+
+	bitmap_set_multiple (used, start, cnt, true);
+	return dup_cnt;
+}
+
+/* Hashes an open inode by sector. */
+static uint64_t
+inode_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct inode *inode = hash_entry (e, struct inode, elem);
+
+	return hash_int (inode->sector);
+}
+
+/* Orders open inodes by sector. */
+static bool
+inode_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct inode *a = hash_entry (a_, struct inode, elem);
+	const struct inode *b = hash_entry (b_, struct inode, elem);
+
+	return a->sector < b->sector;
+}
@@ -0,0 +1,299 @@
+#include "filesys/journal.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/cache.h"
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Metadata journal.
+ *
+ * Every change to inodes, index blocks, directories and the free
+ * map is made by an operation, bracketed by journal_begin() and
+ * journal_end(), that writes the sectors it changes with
+ * journal_write().  Operations nest, so a whole filesys_create()
+ * is one operation however many smaller ones it is made of.
+ * Operations that run at the same time, or one after another
+ * between commits, join the same transaction, and a transaction
+ * reaches disk as a unit or not at all.
+ *
+ * Until its transaction commits, a logged sector is held in the
+ * buffer cache.  The commit copies every logged sector, in one
+ * sequential run, into whichever of the two logs the header in
+ * JOURNAL_SECTOR does not name, and then rewrites the header to
+ * name that log and the home sector of each entry in it.  The
+ * header write is the commit point.  After it, the cache may write
+ * the sectors home whenever it likes, since a crash before they
+ * get there is repaired at the next boot by journal_init(), which
+ * copies the transaction that the header names home again.  The
+ * sectors of the previous transaction must be home before the
+ * header stops naming it, so a commit writes back whatever of them
+ * the cache has not.
+ *
+ * A transaction commits every COMMIT_INTERVAL milliseconds, when
+ * it has no room for another operation, and on journal_commit().
+ * A crash can lose the operations since the last commit, but
+ * never leaves part of one on disk.  File data is not journaled:
+ * after a crash, a file has the length and sectors of its last
+ * committed operation, but those sectors may hold older data. */
+
+/* Identifies the journal header. */
+#define JOURNAL_MAGIC 0x4a524e4c
+
+/* Most sectors a single operation logs.  An operation joins the
+ * running transaction only if that many are left for it. */
+#define OP_MAX 24
+
+/* Milliseconds between commits. */
+#define COMMIT_INTERVAL 1000
+
+/* On-disk journal header, in JOURNAL_SECTOR.
+ * Must be exactly DISK_SECTOR_SIZE bytes long. */
+struct journal_header {
+	unsigned magic;                     /* JOURNAL_MAGIC. */
+	uint32_t seq;                       /* Last committed transaction. */
+	uint32_t cnt;                       /* Sectors it logged. */
+	disk_sector_t home[JOURNAL_TXN_MAX];/* Where each one belongs. */
+	uint8_t unused[DISK_SECTOR_SIZE - 3 * sizeof (uint32_t)
+		- JOURNAL_TXN_MAX * sizeof (disk_sector_t)];
+};
+
+static struct journal_header header;
+static uint8_t log_buf[DISK_SECTOR_SIZE];
+
+static struct lock journal_lock;
+static struct condition journal_changed;  /* Operation ended or commit
+                                           * done. */
+static int op_cnt;                  /* Operations in progress. */
+static bool committing;             /* Commit in progress? */
+
+/* Sectors logged by the running transaction, and by the last
+ * committed one. */
+static disk_sector_t logged[JOURNAL_TXN_MAX];
+static size_t logged_cnt;
+static disk_sector_t committed[JOURNAL_TXN_MAX];
+static size_t committed_cnt;
+
+/* Statistics. */
+static long long op_total;          /* Operations begun. */
+static long long commit_cnt;        /* Transactions committed. */
+static long long logged_total;      /* Sectors written to the logs. */
+static long long replay_cnt;        /* Sectors replayed at boot. */
+
+static void commit (void);
+static void replay (void);
+static void commitd (void *);
+
+/* Returns the sector that holds entry I of the log of transaction
+ * SEQ. */
+static disk_sector_t
+log_sector (uint32_t seq, size_t i) {
+	return JOURNAL_SECTOR + 1 + (seq % 2) * JOURNAL_TXN_MAX + i;
+}
+
+/* Initializes the journal and starts its commit thread.  If
+ * FORMAT is true, writes an empty journal, otherwise replays the
+ * last committed transaction.  Must be called before anything
+ * else reads the file system. */
+void
+journal_init (bool format) {
+	ASSERT (sizeof header == DISK_SECTOR_SIZE);
+
+	lock_init (&journal_lock);
+	cond_init (&journal_changed);
+
+	if (format) {
+		header.magic = JOURNAL_MAGIC;
+		header.seq = 0;
+		header.cnt = 0;
+		disk_write (filesys_disk, JOURNAL_SECTOR, &header);
+	} else
+		replay ();
+
+	thread_create ("commitd", PRI_DEFAULT, commitd, NULL);
+}
+
+/* Commits the running transaction, writes every cached sector
+ * home, and empties the journal, so that the next boot has nothing
+ * to replay.  No operation may begin afterward. */
+void
+journal_done (void) {
+	lock_acquire (&journal_lock);
+	commit ();
+	committing = true;
+	lock_release (&journal_lock);
+
+	cache_flush ();
+	header.cnt = 0;
+	disk_write (filesys_disk, JOURNAL_SECTOR, &header);
+}
+
+/* Begins an operation, or a nested part of the one the current
+ * thread has begun.  The outermost call waits for a commit in
+ * progress, or for the running transaction to commit if it has no
+ * room for another operation, so the caller must not hold any lock
+ * that an operation in progress might want. */
+void
+journal_begin (void) {
+	struct thread *t = thread_current ();
+
+	if (t->journal_depth++ > 0)
+		return;
+
+	lock_acquire (&journal_lock);
+	for (;;) {
+		if (committing)
+			cond_wait (&journal_changed, &journal_lock);
+		else if (logged_cnt + (op_cnt + 1) * OP_MAX > JOURNAL_TXN_MAX)
+			commit ();
+		else
+			break;
+	}
+	op_cnt++;
+	op_total++;
+	lock_release (&journal_lock);
+}
+
+/* Ends the operation, or the nested part of it, begun by the
+ * matching journal_begin().  The operation commits with the rest
+ * of its transaction later. */
+void
+journal_end (void) {
+	struct thread *t = thread_current ();
+
+	ASSERT (t->journal_depth > 0);
+	if (--t->journal_depth > 0)
+		return;
+
+	lock_acquire (&journal_lock);
+	if (--op_cnt == 0)
+		cond_broadcast (&journal_changed, &journal_lock);
+	lock_release (&journal_lock);
+}
+
+/* Copies SIZE bytes from BUFFER to offset OFS of SECTOR, as part of
+ * the current thread's operation. */
+void
+journal_write (disk_sector_t sector, const void *buffer, size_t ofs,
+		size_t size) {
+	ASSERT (thread_current ()->journal_depth > 0);
+
+	if (cache_write_logged (sector, buffer, ofs, size)) {
+		lock_acquire (&journal_lock);
+		if (logged_cnt >= JOURNAL_TXN_MAX)
+			PANIC ("journal: transaction too large");
+		logged[logged_cnt++] = sector;
+		lock_release (&journal_lock);
+	}
+}
+
+/* Commits the running transaction and waits until it is on disk.
+ * Every operation that ended before the call is then durable.  The
+ * current thread must not be in an operation. */
+void
+journal_commit (void) {
+	ASSERT (thread_current ()->journal_depth == 0);
+
+	lock_acquire (&journal_lock);
+	commit ();
+	lock_release (&journal_lock);
+}
+
+/* Prints journal statistics. */
+void
+journal_print_stats (void) {
+	int64_t ticks = timer_ticks ();
+
+	printf ("Journal: %lld operations (%lld/s), %lld transactions, "
+			"%lld sectors logged, %lld sectors replayed\n",
+			op_total, ticks > 0 ? op_total * TIMER_FREQ / ticks : 0,
+			commit_cnt, logged_total, replay_cnt);
+}
+
+/* Waits for the operations in the running transaction to end, and
+ * commits it.  New operations wait until it is done.  JOURNAL_LOCK
+ * must be held; it is released during disk I/O. */
+static void
+commit (void) {
+	size_t i;
+
+	ASSERT (lock_held_by_current_thread (&journal_lock));
+
+	while (committing)
+		cond_wait (&journal_changed, &journal_lock);
+	committing = true;
+	while (op_cnt > 0)
+		cond_wait (&journal_changed, &journal_lock);
+	if (logged_cnt == 0)
+		goto done;
+	lock_release (&journal_lock);
+
+	/* The header is about to stop naming the last transaction, so
+	 * its sectors must be home first.  The cache skips those that
+	 * this transaction logged again. */
+	for (i = 0; i < committed_cnt; i++)
+		cache_write_back (committed[i]);
+
+	/* Write the log, then the header that commits it. */
+	for (i = 0; i < logged_cnt; i++) {
+		cache_read (logged[i], log_buf, 0, DISK_SECTOR_SIZE);
+		disk_write (filesys_disk, log_sector (header.seq + 1, i), log_buf);
+		header.home[i] = logged[i];
+	}
+	header.seq++;
+	header.cnt = logged_cnt;
+	disk_write (filesys_disk, JOURNAL_SECTOR, &header);
+
+	/* Now the sectors may go home, and sectors that the transaction
+	 * freed may be used again. */
+	for (i = 0; i < logged_cnt; i++)
+		cache_unlog (logged[i]);
+	free_map_commit ();
+
+	lock_acquire (&journal_lock);
+	memcpy (committed, logged, logged_cnt * sizeof *logged);
+	committed_cnt = logged_cnt;
+	logged_total += logged_cnt;
+	logged_cnt = 0;
+	commit_cnt++;
+
+done:
+	committing = false;
+	cond_broadcast (&journal_changed, &journal_lock);
+}
+
+/* Copies the transaction that the header names home, in case a
+ * crash kept any of it from getting there, and empties the
+ * journal. */
+static void
+replay (void) {
+	uint32_t i;
+
+	disk_read (filesys_disk, JOURNAL_SECTOR, &header);
+	if (header.magic != JOURNAL_MAGIC || header.cnt > JOURNAL_TXN_MAX)
+		PANIC ("journal: bad header (file system needs formatting)");
+	if (header.cnt == 0)
+		return;
+
+	for (i = 0; i < header.cnt; i++) {
+		disk_read (filesys_disk, log_sector (header.seq, i), log_buf);
+		disk_write (filesys_disk, header.home[i], log_buf);
+	}
+	printf ("journal: replayed transaction %"PRIu32", %"PRIu32" sectors\n",
+			header.seq, header.cnt);
+	replay_cnt = header.cnt;
+	header.cnt = 0;
+	disk_write (filesys_disk, JOURNAL_SECTOR, &header);
+}
+
+/* The commit thread. */
+static void
+commitd (void *aux UNUSED) {
+	for (;;) {
+		timer_msleep (COMMIT_INTERVAL);
+		journal_commit ();
+	}
+}
@@ -22,6 +22,7 @@ struct disk *disk_get (int chan_no, int dev_no);
 disk_sector_t disk_size (struct disk *);
 void disk_read (struct disk *, disk_sector_t, void *);
 void disk_write (struct disk *, disk_sector_t, const void *);
+void disk_cut_power (struct disk *, long long write_cnt);
 
 void 	register_disk_inspect_intr ();
 #endif /* devices/disk.h */
@@ -0,0 +1,21 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/disk.h"
+
+void cache_init (void);
+void cache_read (disk_sector_t, void *buffer, size_t ofs, size_t size);
+void cache_write (disk_sector_t, const void *buffer, size_t ofs, size_t size);
+bool cache_write_logged (disk_sector_t, const void *buffer, size_t ofs,
+		size_t size);
+void cache_unlog (disk_sector_t);
+void cache_write_back (disk_sector_t);
+void cache_prefetch (disk_sector_t);
+void cache_flush (void);
+void cache_flush_matching (bool (*match) (disk_sector_t, void *aux),
+		void *aux);
+void cache_print_stats (void);
+
+#endif /* filesys/cache.h */
@@ -6,9 +6,11 @@
 struct inode;
 
 /* Opening and closing files. */
+void file_init (void);
 struct file *file_open (struct inode *);
 struct file *file_reopen (struct file *);
 struct file *file_duplicate (struct file *file);
+struct file *file_share (struct file *);
 void file_close (struct file *);
 struct inode *file_get_inode (struct file *);
 
@@ -17,6 +19,7 @@ off_t file_read (struct file *, void *, off_t);
 off_t file_read_at (struct file *, void *, off_t size, off_t start);
 off_t file_write (struct file *, const void *, off_t);
 off_t file_write_at (struct file *, const void *, off_t size, off_t start);
+void file_sync (struct file *);
 
 /* Preventing writes. */
 void file_deny_write (struct file *);
@@ -2,6 +2,7 @@
 #define FILESYS_INODE_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include "filesys/off_t.h"
 #include "devices/disk.h"
 
@@ -15,9 +16,17 @@ disk_sector_t inode_get_inumber (const struct inode *);
 void inode_close (struct inode *);
 void inode_remove (struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
+void inode_readahead (struct inode *, off_t offset, off_t size);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
+disk_sector_t inode_get_index (const struct inode *);
+void inode_set_index (struct inode *, disk_sector_t);
+void inode_log_data (struct inode *);
+void inode_flush (struct inode *);
+size_t inode_mark_sectors (struct inode *, struct bitmap *);
+void inode_lock_dir (struct inode *);
+void inode_unlock_dir (struct inode *);
 
 #endif /* filesys/inode.h */
@@ -0,0 +1,22 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/disk.h"
+
+/* Most sectors one transaction can log.  The journal takes a header
+ * sector and two logs of this size, starting at JOURNAL_SECTOR. */
+#define JOURNAL_TXN_MAX 96
+#define JOURNAL_SIZE (1 + 2 * JOURNAL_TXN_MAX)
+
+void journal_init (bool format);
+void journal_done (void);
+void journal_begin (void);
+void journal_end (void);
+void journal_write (disk_sector_t, const void *buffer, size_t ofs,
+		size_t size);
+void journal_commit (void);
+void journal_print_stats (void);
+
+#endif /* filesys/journal.h */
@@ -112,6 +112,37 @@ static __inline uint64_t rrsp(void) {
 	__asm __volatile("movq %%rsp,%0" : "=r" (val));
 	return val;
 }
+__attribute__((always_inline))
+static __inline uint64_t rcr4(void) {
+	uint64_t val;
+	__asm __volatile("movq %%cr4,%0" : "=r" (val));
+	return val;
+}
+
+__attribute__((always_inline))
+static __inline void lcr4(uint64_t val) {
+	__asm __volatile("movq %0, %%cr4" : : "r" (val));
+}
+
+/* Executes CPUID for LEAF (subleaf 0) and returns ECX, which holds
+   most of the feature flags of leaf 1. */
+__attribute__((always_inline))
+static __inline uint32_t cpuid_ecx(uint32_t leaf) {
+	uint32_t eax, ebx, ecx, edx;
+	__asm __volatile("cpuid"
+			: "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+			: "a" (leaf), "c" (0));
+	return ecx;
+}
+
+/* Returns the time-stamp counter. */
+__attribute__((always_inline))
+static __inline uint64_t rdtsc(void) {
+	uint32_t lo, hi;
+	__asm __volatile("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((uint64_t) hi << 32) | lo;
+}
+
 __attribute__((always_inline))
 static __inline uint64_t rcr2(void) {
 	uint64_t val;
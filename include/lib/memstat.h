@@ -0,0 +1,23 @@
+#ifndef __LIB_MEMSTAT_H
+#define __LIB_MEMSTAT_H
+
+#include <stddef.h>
+
+/* Kernel memory usage, as reported by the memstat system call. */
+struct memstat {
+	size_t kernel_pages;        /* Kernel pool pages in use. */
+	size_t kernel_peak;         /* Most kernel pool pages ever in use. */
+	size_t user_pages;          /* User pool pages in use. */
+	size_t user_peak;           /* Most user pool pages ever in use. */
+	size_t malloc_bytes;        /* Bytes in kernel malloc() blocks. */
+	size_t malloc_peak;         /* Most bytes ever in malloc() blocks. */
+
+	/* The calling process.  Zero without virtual memory. */
+	size_t rss;                 /* Resident pages. */
+	size_t peak_rss;            /* Most resident pages so far. */
+	size_t wss;                 /* Working set size in pages. */
+	long long faults;           /* Pages brought in by faults. */
+	long long evictions;        /* Pages evicted. */
+};
+
+#endif /* lib/memstat.h */
@@ -36,6 +36,15 @@ enum {
 
 	SYS_MOUNT,
 	SYS_UMOUNT,
+
+	/* Debugging. */
+	SYS_MEMSTAT,                /* Report kernel memory usage. */
+	SYS_MEMDUMP,                /* Print kernel memory usage. */
+
+	/* Positioned I/O and durability. */
+	SYS_PREAD,                  /* Read from a file at an offset. */
+	SYS_PWRITE,                 /* Write to a file at an offset. */
+	SYS_FSYNC,                  /* Write a file's changes to disk. */
 };
 
 #endif /* lib/syscall-nr.h */
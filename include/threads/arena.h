@@ -0,0 +1,13 @@
+#ifndef THREADS_ARENA_H
+#define THREADS_ARENA_H
+
+#include <stddef.h>
+
+size_t arena_begin (void);
+void *arena_alloc (size_t) __attribute__ ((malloc));
+void arena_end (size_t mark);
+void arena_reset (void);
+void arena_destroy (void);
+void arena_print_stats (void);
+
+#endif /* threads/arena.h */
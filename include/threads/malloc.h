@@ -9,5 +9,8 @@ void *malloc (size_t) __attribute__ ((malloc));
 void *calloc (size_t, size_t) __attribute__ ((malloc));
 void *realloc (void *, size_t);
 void free (void *);
+void malloc_usage (size_t *used, size_t *peak);
+void malloc_print_stats (void);
+void malloc_dump (void);
 
 #endif /* threads/malloc.h */
@@ -1,6 +1,7 @@
 #ifndef THREADS_PALLOC_H
 #define THREADS_PALLOC_H
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stddef.h>
 
@@ -14,10 +15,19 @@ enum palloc_flags {
 /* Maximum number of pages to put in user pool. */
 extern size_t user_page_limit;
 
+/* Record the caller of each page and malloc() block? */
+extern bool track_alloc_sites;
+
 uint64_t palloc_init (void);
 void *palloc_get_page (enum palloc_flags);
 void *palloc_get_multiple (enum palloc_flags, size_t page_cnt);
+void *palloc_get_huge_page (enum palloc_flags);
 void palloc_free_page (void *);
 void palloc_free_multiple (void *, size_t page_cnt);
+bool palloc_prezero (void);
+void palloc_usage (enum palloc_flags, size_t *used, size_t *peak);
+void palloc_for_each_site (void (*site_func) (void *site, void *aux),
+		void *aux);
+void palloc_print_stats (void);
 
 #endif /* threads/palloc.h */
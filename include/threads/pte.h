@@ -41,5 +41,7 @@
 #define PTE_U 0x4                        /* 1=user/kernel, 0=kernel only. */
 #define PTE_A 0x20                       /* 1=accessed, 0=not acccessed. */
 #define PTE_D 0x40                       /* 1=dirty, 0=not dirty (PTEs only). */
+#define PTE_PS 0x80                      /* 1=2 MB page, 0=page table (PDEs only). */
+#define PTE_SHARED 0x200                 /* 1=frame shared by address spaces (AVL). */
 
 #endif /* threads/pte.h */
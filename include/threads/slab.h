@@ -0,0 +1,17 @@
+#ifndef THREADS_SLAB_H
+#define THREADS_SLAB_H
+
+#include <stddef.h>
+
+struct kmem_cache;
+
+struct kmem_cache *kmem_cache_create (const char *name, size_t size);
+void *kmem_cache_alloc (struct kmem_cache *) __attribute__ ((malloc));
+void *kmem_cache_zalloc (struct kmem_cache *) __attribute__ ((malloc));
+void kmem_cache_free (struct kmem_cache *, void *);
+struct kmem_cache *kmem_cache_of (const void *);
+size_t kmem_cache_size (const struct kmem_cache *);
+size_t kmem_cache_reap (void);
+void kmem_print_stats (void);
+
+#endif /* threads/slab.h */
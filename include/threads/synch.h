@@ -22,8 +22,6 @@ struct lock {
 	struct semaphore semaphore; /* Binary semaphore controlling access. */
 };
 
-static struct lock filesys_lock; /* 파일에 대한 동시 접근 제어용 */
-
 void lock_init (struct lock *);
 void lock_acquire (struct lock *);
 bool lock_try_acquire (struct lock *);
@@ -43,6 +41,20 @@ void cond_wait (struct condition *, struct lock *);
 void cond_signal (struct condition *, struct lock *);
 void cond_broadcast (struct condition *, struct lock *);
 
+/* Readers-writer lock. */
+struct rwlock {
+	struct lock lock;           /* Protects the members below. */
+	struct condition changed;   /* Readers or the writer left. */
+	int reader_cnt;             /* Number of threads reading. */
+	struct thread *writer;      /* Thread writing, if any. */
+};
+
+void rwlock_init (struct rwlock *);
+void rwlock_acquire_read (struct rwlock *);
+void rwlock_release_read (struct rwlock *);
+void rwlock_acquire_write (struct rwlock *);
+void rwlock_release_write (struct rwlock *);
+
 /* Optimization barrier.
  *
  * The compiler will not reorder operations across an
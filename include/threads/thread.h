@@ -98,6 +98,8 @@ struct thread {
 	
 	int64_t wake_up_tick;				/* wake_up_tick 변수 추가하기 */
 
+	struct list_elem allelem;           /* List element for all threads list. */
+
 	/* Shared between thread.c and synch.c. */
 	struct list_elem elem;              /* List element. */
 
@@ -107,6 +109,10 @@ struct thread {
 	struct list donations;			/* 기부해준 스레드들을 담는 리스트 */
 	struct list_elem donation_elem;	/* thread 구조체 변환용 */
 
+	/* Owned by arena.c. */
+	uint8_t *arena;                     /* Scratch region, or NULL. */
+	size_t arena_used;                  /* Bytes of ARENA in use. */
+
 #ifdef USERPROG
 	/* Owned by userprog/process.c. */
 	uint64_t *pml4;                     /* Page map level 4 */
@@ -124,10 +130,24 @@ struct thread {
 	struct semaphore sema_exit;
 	int exit_status;
 	int is_exit;
+	bool killed;                        /* Exit at next return to user. */
+#endif
+#ifdef FILESYS
+	/* Owned by filesys/journal.c. */
+	int journal_depth;                  /* Nesting of journal_begin(). */
 #endif
 #ifdef VM
 	/* Table for whole virtual memory owned by thread. */
 	struct supplemental_page_table spt;
+
+	/* Owned by vm.c. */
+	size_t rss;                         /* Pages mapped to frames. */
+	size_t peak_rss;                    /* Largest RSS so far. */
+	size_t ws_cnt;                      /* Pages seen accessed in pass... */
+	unsigned ws_pass;                   /* ...number WS_PASS. */
+	long long fault_cnt;                /* Pages brought in by faults. */
+	long long evict_cnt;                /* Pages evicted. */
+	uintptr_t user_rsp;                 /* User RSP at system call entry. */
 #endif
 
 	/* Owned by thread.c. */
@@ -159,6 +179,10 @@ const char *thread_name (void);
 void thread_exit (void) NO_RETURN;
 void thread_yield (void);
 
+/* Performs some operation on thread t, given auxiliary data AUX. */
+typedef void thread_action_func (struct thread *t, void *aux);
+void thread_foreach (thread_action_func *, void *);
+
 void thread_sleep (int64_t until_ticks); /* 재우기 */
 void thread_awake (int64_t ticks); /* 깨우기 */
 void update_min_awake_tick (void); /* 제일 빨리 일어날 수 있는 스레드 */
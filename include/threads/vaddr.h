@@ -31,6 +31,16 @@
 /* Round down to nearest page boundary. */
 #define pg_round_down(va) (void *) ((uint64_t) (va) & ~PGMASK)
 
+/* Huge page offset (bits 0:21).  A huge page is mapped by a single
+ * page directory entry. */
+#define HPGBITS 21                         /* Number of offset bits. */
+#define HPGSIZE (1 << HPGBITS)             /* Bytes in a huge page. */
+#define HPGMASK BITMASK(PGSHIFT, HPGBITS)  /* Huge page offset bits (0:21). */
+#define HPG_PAGE_CNT (HPGSIZE / PGSIZE)    /* Pages in a huge page. */
+
+/* Offset within a huge page. */
+#define hpg_ofs(va) ((uint64_t) (va) & HPGMASK)
+
 /* Kernel virtual address start */
 #define KERN_BASE LOADER_KERN_BASE
 
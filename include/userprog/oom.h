@@ -0,0 +1,9 @@
+#ifndef USERPROG_OOM_H
+#define USERPROG_OOM_H
+
+#include "threads/palloc.h"
+
+void *oom_get_page (enum palloc_flags);
+void oom_print_stats (void);
+
+#endif /* userprog/oom.h */
@@ -3,6 +3,9 @@
 
 #include "threads/thread.h"
 
+/* -hugepages: Back large writable segments with huge pages? */
+extern bool user_huge_pages;
+
 tid_t process_create_initd (const char *file_name);
 tid_t process_fork (const char *name, struct intr_frame *if_ UNUSED);
 int process_exec (void *f_name);
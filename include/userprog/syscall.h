@@ -4,7 +4,8 @@
 #include "threads/thread.h"
 #include "include/lib/user/syscall.h"
 
-bool is_valid_address(void *addr);
+bool is_valid_address(const void *addr);
+bool is_writable_address(void *addr);
 
 void syscall_init (void);
 
@@ -0,0 +1,18 @@
+#ifndef USERPROG_TEXT_CACHE_H
+#define USERPROG_TEXT_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "filesys/off_t.h"
+
+struct file;
+
+void text_cache_init (void);
+bool text_cache_install (uint64_t *pml4, void *upage, struct file *file,
+		off_t ofs, size_t read_bytes);
+bool text_cache_share (uint64_t *pml4, void *upage, void *kpage);
+void text_cache_release (uint64_t *pml4);
+void text_cache_print_stats (void);
+
+#endif /* userprog/text-cache.h */
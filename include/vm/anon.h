@@ -1,13 +1,32 @@
 #ifndef VM_ANON_H
 #define VM_ANON_H
+#include <stddef.h>
+#include <stdint.h>
 #include "vm/vm.h"
 struct page;
 enum vm_type;
 
+/* Where an anonymous page's contents are kept while it is not in
+ * a frame. */
+enum anon_store {
+	ANON_NONE,                  /* Nowhere: the page is resident. */
+	ANON_FILLED,                /* Every word equals FILL. */
+	ANON_COMPRESSED,            /* SIZE bytes at chunk SLOT of the zpool. */
+	ANON_SWAPPED,               /* Swap slot SLOT of the swap disk. */
+};
+
 struct anon_page {
+	enum anon_store store;      /* Where the contents are. */
+	size_t slot;                /* Zpool chunk or swap slot. */
+	size_t size;                /* Compressed size in bytes. */
+	uint64_t fill;              /* Word value of a same-filled page. */
 };
 
+/* -nozswap: Swap straight to disk, without compressing in RAM? */
+extern bool swap_compress;
+
 void vm_anon_init (void);
 bool anon_initializer (struct page *page, enum vm_type type, void *kva);
+void anon_print_stats (void);
 
 #endif
@@ -1,17 +1,34 @@
 #ifndef VM_FILE_H
 #define VM_FILE_H
+#include "devices/disk.h"
 #include "filesys/file.h"
 #include "vm/vm.h"
 
 struct page;
+struct frame;
 enum vm_type;
 
+/* A page backed by a file.  This is also the AUX of every lazily
+ * loaded page until its first fault. */
 struct file_page {
+	struct file *file;      /* Backing file, see file_share(). */
+	disk_sector_t inumber;  /* FILE's inode number. */
+	off_t ofs;              /* Offset of the page in FILE. */
+	size_t read_bytes;      /* Bytes backed by FILE, the rest is zero. */
+	bool text;              /* Executable segment, not a mapping? */
+	size_t map_cnt;         /* Pages in the mapping this page starts,
+	                           0 if it does not start a mapping. */
 };
 
 void vm_file_init (void);
 bool file_backed_initializer (struct page *page, enum vm_type type, void *kva);
+bool file_backed_load (struct page *page, void *aux);
+struct file_page *file_page_copy (const struct file_page *);
+struct frame *file_backed_lookup (struct page *page);
+struct frame *file_backed_publish (struct frame *frame);
+void file_backed_forget (struct frame *frame);
 void *do_mmap(void *addr, size_t length, int writable,
 		struct file *file, off_t offset);
 void do_munmap (void *va);
+void file_print_stats (void);
 #endif
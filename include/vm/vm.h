@@ -1,6 +1,8 @@
 #ifndef VM_VM_H
 #define VM_VM_H
 #include <stdbool.h>
+#include <hash.h>
+#include <list.h>
 #include "threads/palloc.h"
 
 enum vm_type {
@@ -46,6 +48,10 @@ struct page {
 	struct frame *frame;   /* Back reference for frame */
 
 	/* Your implementation */
+	struct hash_elem spt_elem;      /* Element in the owner's spt. */
+	struct list_elem frame_elem;    /* Element in frame->pages. */
+	struct thread *owner;           /* Process whose address space maps VA. */
+	bool writable;                  /* May the owner write to the page? */
 
 	/* Per-type data are binded into the union.
 	 * Each function automatically detects the current union */
@@ -63,6 +69,19 @@ struct page {
 struct frame {
 	void *kva;
 	struct page *page;
+
+	struct list_elem elem;          /* Element in the frame table. */
+	struct list pages;              /* Pages mapping this frame; PAGE is one. */
+	struct hash_elem file_elem;     /* Element in the file frame cache. */
+	unsigned pin_cnt;               /* Never chosen for eviction if nonzero. */
+	bool accessed;                  /* Accessed bit taken by the sampler. */
+	bool io;                        /* Being written back, see vm.c. */
+
+	/* Same-page merging, see vm.c. */
+	bool merged;                    /* Shared read-only by identical pages? */
+	bool merge_listed;              /* In the merge table? */
+	uint64_t merge_hash;            /* Content hash when last scanned. */
+	struct hash_elem merge_elem;    /* Element in the merge table. */
 };
 
 /* The function table for page operations.
@@ -85,6 +104,7 @@ struct page_operations {
  * We don't want to force you to obey any specific design for this struct.
  * All designs up to you for this. */
 struct supplemental_page_table {
+	struct hash pages;              /* struct page, keyed by va. */
 };
 
 #include "threads/thread.h"
@@ -97,7 +117,24 @@ struct page *spt_find_page (struct supplemental_page_table *spt,
 bool spt_insert_page (struct supplemental_page_table *spt, struct page *page);
 void spt_remove_page (struct supplemental_page_table *spt, struct page *page);
 
+/* Same-page merging tunables. */
+extern size_t merge_batch;
+extern unsigned merge_interval;
+
+/* Maximum stack size in bytes, including the guard page. */
+extern size_t stack_max;
+bool is_stack_access (void *addr, uintptr_t rsp);
+
+/* Resident memory limits and working-set sampling. */
+extern size_t rss_limit;
+extern unsigned ws_interval;
+extern bool rss_report;
+
 void vm_init (void);
+void vm_print_stats (void);
+void vm_process_usage (struct thread *, size_t *rss, size_t *peak_rss,
+		size_t *wss);
+void vm_print_process (struct thread *);
 bool vm_try_handle_fault (struct intr_frame *f, void *addr, bool user,
 		bool write, bool not_present);
 
@@ -107,6 +144,11 @@ bool vm_alloc_page_with_initializer (enum vm_type type, void *upage,
 		bool writable, vm_initializer *init, void *aux);
 void vm_dealloc_page (struct page *page);
 bool vm_claim_page (void *va);
+void vm_unmap_page (struct page *page);
+bool vm_reclaim (void);
+bool vm_frame_clear_dirty (struct frame *frame);
+void vm_frame_io_begin (struct frame *frame);
+void vm_frame_io_end (struct frame *frame);
 enum vm_type page_get_type (struct page *page);
 
 #endif  /* VM_VM_H */
@@ -26,6 +26,7 @@ typedef unsigned long elem_type;
    simulates an array of bits. */
 struct bitmap {
 	size_t bit_cnt;     /* Number of bits. */
+	size_t clear_hint;  /* No bit before this index is false. */
 	elem_type *bits;    /* Elements that represent bits. */
 };
 
@@ -63,6 +64,31 @@ last_mask (const struct bitmap *b) {
 	return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
 
+/* Returns a mask of the bits of the element that contains bit
+   START that also lie within the CNT bits starting at START.
+   CNT must be nonzero. */
+static inline elem_type
+range_mask (size_t start, size_t cnt) {
+	size_t ofs = start % ELEM_BITS;
+	size_t n = ELEM_BITS - ofs < cnt ? ELEM_BITS - ofs : cnt;
+	elem_type mask = n == ELEM_BITS ? (elem_type) -1 : ((elem_type) 1 << n) - 1;
+
+	return mask << ofs;
+}
+
+/* Returns the bits of B's element IDX that are set to VALUE,
+   as 1s. */
+static inline elem_type
+matching_bits (const struct bitmap *b, size_t idx, bool value) {
+	return value ? b->bits[idx] : ~b->bits[idx];
+}
+
+/* Returns the number of trailing 1 bits in X. */
+static inline size_t
+trailing_ones (elem_type x) {
+	return ~x == 0 ? ELEM_BITS : (size_t) __builtin_ctzl (~x);
+}
+
 /* Creation and destruction. */
 
 /* Initializes B to be a bitmap of BIT_CNT bits
@@ -74,6 +100,7 @@ bitmap_create (size_t bit_cnt) {
 	struct bitmap *b = malloc (sizeof *b);
 	if (b != NULL) {
 		b->bit_cnt = bit_cnt;
+		b->clear_hint = 0;
 		b->bits = malloc (byte_cnt (bit_cnt));
 		if (b->bits != NULL || bit_cnt == 0) {
 			bitmap_set_all (b, false);
@@ -94,6 +121,7 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED) {
 	ASSERT (block_size >= bitmap_buf_size (bit_cnt));
 
 	b->bit_cnt = bit_cnt;
+	b->clear_hint = 0;
 	b->bits = (elem_type *) (b + 1);
 	bitmap_set_all (b, false);
 	return b;
@@ -160,6 +188,8 @@ bitmap_reset (struct bitmap *b, size_t bit_idx) {
 	   is guaranteed to be atomic on a uniprocessor machine.  See
 	   the description of the AND instruction in [IA32-v2a]. */
 	asm ("lock andq %1, %0" : "=m" (b->bits[idx]) : "r" (~mask) : "cc");
+	if (bit_idx < b->clear_hint)
+		b->clear_hint = bit_idx;
 }
 
 /* Atomically toggles the bit numbered IDX in B;
@@ -174,6 +204,8 @@ bitmap_flip (struct bitmap *b, size_t bit_idx) {
 	   is guaranteed to be atomic on a uniprocessor machine.  See
 	   the description of the XOR instruction in [IA32-v2b]. */
 	asm ("lock xorq %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+	if (bit_idx < b->clear_hint)
+		b->clear_hint = bit_idx;
 }
 
 /* Returns the value of the bit numbered IDX in B. */
@@ -194,33 +226,53 @@ bitmap_set_all (struct bitmap *b, bool value) {
 	bitmap_set_multiple (b, 0, bitmap_size (b), value);
 }
 
-/* Sets the CNT bits starting at START in B to VALUE. */
+/* Sets the CNT bits starting at START in B to VALUE.
+   Each element is updated atomically, a whole element at a
+   time. */
 void
 bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value) {
-	size_t i;
-
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 	ASSERT (start + cnt <= b->bit_cnt);
 
-	for (i = 0; i < cnt; i++)
-		bitmap_set (b, start + i, value);
+	if (!value && cnt > 0 && start < b->clear_hint)
+		b->clear_hint = start;
+
+	while (cnt > 0) {
+		elem_type mask = range_mask (start, cnt);
+		elem_type *elem = &b->bits[elem_idx (start)];
+		size_t n = __builtin_popcountl (mask);
+
+		/* See bitmap_mark() and bitmap_reset(). */
+		if (value)
+			asm ("lock orq %1, %0" : "+m" (*elem) : "r" (mask) : "cc");
+		else
+			asm ("lock andq %1, %0" : "+m" (*elem) : "r" (~mask) : "cc");
+		start += n;
+		cnt -= n;
+	}
 }
 
 /* Returns the number of bits in B between START and START + CNT,
    exclusive, that are set to VALUE. */
 size_t
 bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value) {
-	size_t i, value_cnt;
+	size_t value_cnt;
 
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 	ASSERT (start + cnt <= b->bit_cnt);
 
 	value_cnt = 0;
-	for (i = 0; i < cnt; i++)
-		if (bitmap_test (b, start + i) == value)
-			value_cnt++;
+	while (cnt > 0) {
+		elem_type mask = range_mask (start, cnt);
+		size_t n = __builtin_popcountl (mask);
+
+		value_cnt += __builtin_popcountl (
+				matching_bits (b, elem_idx (start), value) & mask);
+		start += n;
+		cnt -= n;
+	}
 	return value_cnt;
 }
 
@@ -228,15 +280,19 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value) {
    exclusive, are set to VALUE, and false otherwise. */
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) {
-	size_t i;
-
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 	ASSERT (start + cnt <= b->bit_cnt);
 
-	for (i = 0; i < cnt; i++)
-		if (bitmap_test (b, start + i) == value)
+	while (cnt > 0) {
+		elem_type mask = range_mask (start, cnt);
+		size_t n = __builtin_popcountl (mask);
+
+		if (matching_bits (b, elem_idx (start), value) & mask)
 			return true;
+		start += n;
+		cnt -= n;
+	}
 	return false;
 }
 
@@ -261,7 +317,72 @@ bitmap_all (const struct bitmap *b, size_t start, size_t cnt) {
 	return !bitmap_contains (b, start, cnt, false);
 }
 
-/* Finding set or unset bits. */
+/* Finding set or unset bits.
+
+   Scans look at a whole element at a time: elements without a
+   single bit of the wanted value are skipped outright, and within
+   an element, runs of matching and non-matching bits are
+   measured with find-first-set.  Searches for false bits, which
+   is how callers allocate, also start no earlier than the
+   bitmap's clear hint, below which every bit is known to be
+   true. */
+
+/* Finds and returns the starting index of the first group of CNT
+   consecutive bits in B at or after START that are all set to
+   VALUE, or BITMAP_ERROR if there is none.  Also stores in *FIRST
+   the index of the first bit at or after START that is set to
+   VALUE, or BITMAP_ERROR if there is none. */
+static size_t
+scan_run (const struct bitmap *b, size_t start, size_t cnt, bool value,
+		size_t *first) {
+	size_t run_start = start, run = 0;
+
+	*first = BITMAP_ERROR;
+	if (cnt == 0)
+		return start;
+
+	while (start < b->bit_cnt) {
+		size_t ofs = start % ELEM_BITS;
+		size_t avail = ELEM_BITS - ofs;
+		elem_type m = matching_bits (b, elem_idx (start), value) >> ofs;
+
+		if (avail > b->bit_cnt - start) {
+			avail = b->bit_cnt - start;
+			m &= ((elem_type) 1 << avail) - 1;
+		}
+		if (m == 0) {
+			/* Nothing here. */
+			run = 0;
+			start += avail;
+			continue;
+		}
+		if (*first == BITMAP_ERROR)
+			*first = start + __builtin_ctzl (m);
+
+		/* Walk the runs of 1s and 0s in M. */
+		while (avail > 0) {
+			size_t n;
+
+			if (m & 1) {
+				n = trailing_ones (m);
+				if (n > avail)
+					n = avail;
+				if (run == 0)
+					run_start = start;
+				run += n;
+				if (run >= cnt)
+					return run_start;
+			} else {
+				n = m != 0 ? (size_t) __builtin_ctzl (m) : avail;
+				run = 0;
+			}
+			start += n;
+			avail -= n;
+			m = n < ELEM_BITS ? m >> n : 0;
+		}
+	}
+	return BITMAP_ERROR;
+}
 
 /* Finds and returns the starting index of the first group of CNT
    consecutive bits in B at or after START that are all set to
@@ -269,17 +390,14 @@ bitmap_all (const struct bitmap *b, size_t start, size_t cnt) {
    If there is no such group, returns BITMAP_ERROR. */
 size_t
 bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) {
+	size_t first;
+
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 
-	if (cnt <= b->bit_cnt) {
-		size_t last = b->bit_cnt - cnt;
-		size_t i;
-		for (i = start; i <= last; i++)
-			if (!bitmap_contains (b, i, cnt, !value))
-				return i;
-	}
-	return BITMAP_ERROR;
+	if (!value && cnt > 0 && start < b->clear_hint)
+		start = b->clear_hint;
+	return scan_run (b, start, cnt, value, &first);
 }
 
 /* Finds the first group of CNT consecutive bits in B at or after
@@ -291,9 +409,28 @@ bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) {
    setting them. */
 size_t
 bitmap_scan_and_flip (struct bitmap *b, size_t start, size_t cnt, bool value) {
-	size_t idx = bitmap_scan (b, start, cnt, value);
+	bool from_hint = !value && cnt > 0 && start <= b->clear_hint;
+	size_t idx, first;
+
+	ASSERT (b != NULL);
+	ASSERT (start <= b->bit_cnt);
+
+	if (from_hint)
+		start = b->clear_hint;
+	idx = scan_run (b, start, cnt, value, &first);
 	if (idx != BITMAP_ERROR)
 		bitmap_set_multiple (b, idx, cnt, !value);
+
+	/* The scan saw every bit from the hint up to FIRST, so the
+	   hint can move past the bits that are now known to be true. */
+	if (from_hint) {
+		if (first == BITMAP_ERROR)
+			b->clear_hint = b->bit_cnt;
+		else if (first == idx)
+			b->clear_hint = idx + cnt;
+		else
+			b->clear_hint = first;
+	}
 	return idx;
 }
 
@@ -315,6 +452,7 @@ bitmap_read (struct bitmap *b, struct file *file) {
 		off_t size = byte_cnt (b->bit_cnt);
 		success = file_read_at (file, b->bits, size, 0) == size;
 		b->bits[elem_cnt (b->bit_cnt) - 1] &= last_mask (b);
+		b->clear_hint = 0;
 	}
 	return success;
 }
@@ -326,6 +464,27 @@ bitmap_write (const struct bitmap *b, struct file *file) {
 	off_t size = byte_cnt (b->bit_cnt);
 	return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes the part of B that holds the CNT bits starting at START
+   to FILE, which must hold the rest of B already.  Return true if
+   successful, false otherwise. */
+bool
+bitmap_write_part (const struct bitmap *b, struct file *file,
+		size_t start, size_t cnt) {
+	size_t first, last;
+	off_t size;
+
+	ASSERT (start <= b->bit_cnt);
+	ASSERT (start + cnt <= b->bit_cnt);
+
+	if (cnt == 0)
+		return true;
+	first = elem_idx (start);
+	last = elem_idx (start + cnt - 1);
+	size = (last - first + 1) * sizeof (elem_type);
+	return file_write_at (file, b->bits + first, size,
+			first * sizeof (elem_type)) == size;
+}
 #endif /* FILESYS */
 
 /* Debugging. */
@@ -0,0 +1,49 @@
+/* Child process for syn-readers test.
+   Reader IDX of CNT reads every CNT'th file starting from file
+   IDX, a block at a time, and checks its contents. */
+
+#include <random.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/filesys/base/syn-readers.h"
+
+static char expected[FILE_SIZE];
+static char block[BLOCK_SIZE];
+
+int
+main (int argc, const char *argv[])
+{
+  int reader_idx, reader_cnt;
+  int i;
+
+  test_name = "child-readers";
+  quiet = true;
+
+  CHECK (argc == 3, "argc must be 3, actually %d", argc);
+  reader_idx = atoi (argv[1]);
+  reader_cnt = atoi (argv[2]);
+
+  for (i = reader_idx; i < FILE_CNT; i += reader_cnt)
+    {
+      char name[16];
+      size_t ofs;
+      int fd;
+
+      reader_file_name (name, sizeof name, i);
+      random_init (i);
+      random_bytes (expected, sizeof expected);
+
+      CHECK ((fd = open (name)) > 1, "open \"%s\"", name);
+      for (ofs = 0; ofs < sizeof expected; ofs += BLOCK_SIZE)
+        {
+          CHECK (read (fd, block, BLOCK_SIZE) == BLOCK_SIZE,
+                 "read \"%s\"", name);
+          compare_bytes (block, expected + ofs, BLOCK_SIZE, ofs, name);
+        }
+      close (fd);
+    }
+
+  return reader_idx;
+}
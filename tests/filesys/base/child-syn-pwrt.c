@@ -0,0 +1,48 @@
+/* Child process for syn-pwrite test.
+   Writes every CHILD_CNT'th chunk of a test file, starting from
+   its own index and going backward, while the other processes
+   write the chunks in between.  Then syncs the file and reads
+   its own chunks back. */
+
+#include <random.h>
+#include <stdlib.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/filesys/base/syn-pwrite.h"
+
+char buf[BUF_SIZE];
+char chunk[CHUNK_SIZE];
+
+int
+main (int argc, char *argv[])
+{
+  int child_idx;
+  int fd, i;
+
+  test_name = "child-syn-pwrt";
+  quiet = true;
+
+  CHECK (argc == 2, "argc must be 2, actually %d", argc);
+  child_idx = atoi (argv[1]);
+
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  for (i = CHUNK_CNT - CHILD_CNT + child_idx; i >= 0; i -= CHILD_CNT)
+    CHECK (pwrite (fd, buf + CHUNK_SIZE * i, CHUNK_SIZE, CHUNK_SIZE * i)
+           == CHUNK_SIZE, "pwrite chunk %d of \"%s\"", i, file_name);
+  CHECK (fsync (fd) == 0, "fsync \"%s\"", file_name);
+
+  for (i = child_idx; i < CHUNK_CNT; i += CHILD_CNT)
+    {
+      CHECK (pread (fd, chunk, CHUNK_SIZE, CHUNK_SIZE * i) == CHUNK_SIZE,
+             "pread chunk %d of \"%s\"", i, file_name);
+      compare_bytes (chunk, buf + CHUNK_SIZE * i, CHUNK_SIZE,
+                     CHUNK_SIZE * i, file_name);
+    }
+  CHECK (tell (fd) == 0, "tell \"%s\"", file_name);
+  close (fd);
+
+  return child_idx;
+}
@@ -0,0 +1,61 @@
+/* Child process for crash-ops test, run on the boot after the
+   power was cut.  Checks that each file crash-ops was working
+   on either does not exist or has a consistent size and can be
+   read and removed, then that every file can be created and
+   written again in the recovered file system. */
+
+#include <random.h>
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/filesys/base/crash.h"
+
+static char buf[FILE_SIZE];
+
+int
+main (void)
+{
+  int i;
+
+  test_name = "crash-check";
+  msg ("begin");
+
+  quiet = true;
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      char name[16];
+      int fd, size;
+
+      crash_file_name (name, sizeof name, i);
+      fd = open (name);
+      if (fd < 0)
+        continue;
+
+      size = filesize (fd);
+      CHECK (size == 0 || size == FILE_SIZE,
+             "size of \"%s\" is %d", name, size);
+      CHECK (read (fd, buf, sizeof buf) == size, "read \"%s\"", name);
+      close (fd);
+      CHECK (remove (name), "remove \"%s\"", name);
+    }
+
+  random_init (0);
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      char name[16];
+      int fd;
+
+      crash_file_name (name, sizeof name, i);
+      random_bytes (buf, sizeof buf);
+      CHECK (create (name, 0), "create \"%s\"", name);
+      CHECK ((fd = open (name)) > 1, "open \"%s\"", name);
+      CHECK (write (fd, buf, sizeof buf) == (int) sizeof buf,
+             "write \"%s\"", name);
+      close (fd);
+      check_file (name, buf, sizeof buf);
+    }
+  quiet = false;
+
+  msg ("end");
+  return 0;
+}
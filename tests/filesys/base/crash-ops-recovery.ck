@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+my (@output) = read_text_file ("$test.output");
+common_checks ("recovery run", @output);
+my ($fsck) = grep (/^\d+ files: \d+ sectors leaked/, @output);
+fail "Recovery run printed no fsck summary\n" if !defined $fsck;
+fail "File system is inconsistent after recovery: $fsck\n"
+  if $fsck !~ /: 0 sectors leaked, 0 free but in use, 0 in use twice$/;
+compare_output ("recovery run", IGNORE_EXIT_CODES => 1, \@output, [<<'EOF']);
+(crash-check) begin
+(crash-check) end
+EOF
+pass;
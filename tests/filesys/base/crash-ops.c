@@ -0,0 +1,35 @@
+/* Creates, writes, and removes files over and over until the
+   kernel, run with -powercut, cuts the power in the middle of
+   an operation.  The file system is then checked on the next
+   boot by crash-check. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/filesys/base/crash.h"
+
+static char buf[FILE_SIZE];
+
+void
+test_main (void)
+{
+  int i;
+
+  quiet = true;
+  for (i = 0; i < ITERATIONS; i++)
+    {
+      char name[16];
+      int fd;
+
+      crash_file_name (name, sizeof name, i % FILE_CNT);
+      if (remove (name))
+        continue;
+
+      CHECK (create (name, 0), "create \"%s\"", name);
+      CHECK ((fd = open (name)) > 1, "open \"%s\"", name);
+      CHECK (write (fd, buf, sizeof buf) == (int) sizeof buf,
+             "write \"%s\"", name);
+      close (fd);
+    }
+  quiet = false;
+}
@@ -0,0 +1,10 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+fail "Test finished before the power was cut\n"
+  if grep (/^\(crash-ops\) end$/, @output);
+fail "Power was never cut\n" if !grep (/power cut after \d+ writes/, @output);
+pass;
@@ -0,0 +1,18 @@
+#ifndef TESTS_FILESYS_BASE_CRASH_H
+#define TESTS_FILESYS_BASE_CRASH_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#define FILE_CNT 32             /* Files created and removed. */
+#define FILE_SIZE 2048          /* Bytes written to each new file. */
+#define ITERATIONS 4000         /* Creates and removes, in all. */
+
+/* Stores the name of file I in NAME. */
+static inline void
+crash_file_name (char *name, size_t size, int i)
+{
+  snprintf (name, size, "c%d", i);
+}
+
+#endif /* tests/filesys/base/crash.h */
@@ -0,0 +1,96 @@
+/* Holds 5,000 files open at once, spread over a chain of
+   processes since each one has room for only so many
+   descriptors, then opens and closes files from the whole set
+   10,000 times in the last process.  Every one of those opens
+   looks up the table of open inodes while it is that full; the
+   kernel's tick count at shutdown gives the throughput. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 5000           /* Files held open. */
+#define PER_PROC 100            /* Files held by each process. */
+#define CYCLES 10000            /* Timed open/close pairs. */
+
+static int fds[PER_PROC];
+
+static void
+file_name (char *name, size_t size, int i)
+{
+  snprintf (name, size, "f%d", i);
+}
+
+static void
+open_and_close (void)
+{
+  char name[16];
+  int i;
+
+  for (i = 0; i < CYCLES; i++)
+    {
+      int fd;
+
+      file_name (name, sizeof name, i * 7919 % FILE_CNT);
+      fd = open (name);
+      if (fd < 2)
+        fail ("open \"%s\" failed", name);
+      close (fd);
+    }
+}
+
+void
+test_main (void)
+{
+  char name[16];
+  int first, i;
+
+  msg ("create %d files", FILE_CNT);
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      file_name (name, sizeof name, i);
+      if (!create (name, 0))
+        fail ("create \"%s\" failed", name);
+    }
+
+  msg ("hold them open, %d per process", PER_PROC);
+  for (first = 0; ; first += PER_PROC)
+    {
+      pid_t pid;
+
+      for (i = 0; i < PER_PROC; i++)
+        {
+          file_name (name, sizeof name, first + i);
+          fds[i] = open (name);
+          if (fds[i] < 2)
+            fail ("open \"%s\" failed", name);
+        }
+      if (first + PER_PROC == FILE_CNT)
+        {
+          msg ("open and close %d times", CYCLES);
+          open_and_close ();
+          break;
+        }
+
+      /* The child holds the next PER_PROC files, not the copies
+         of ours that fork() hands it. */
+      pid = fork ("holder");
+      if (pid < 0)
+        fail ("fork failed");
+      if (pid > 0)
+        {
+          if (wait (pid) != 0)
+            fail ("process holding files %d and up failed",
+                  first + PER_PROC);
+          break;
+        }
+      for (i = 0; i < PER_PROC; i++)
+        close (fds[i]);
+    }
+
+  for (i = 0; i < PER_PROC; i++)
+    close (fds[i]);
+  if (first > 0)
+    exit (0);
+}
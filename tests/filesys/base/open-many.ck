@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(open-many) begin
+(open-many) create 5000 files
+(open-many) hold them open, 100 per process
+(open-many) open and close 10000 times
+(open-many) end
+EOF
+pass;
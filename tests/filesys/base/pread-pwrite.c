@@ -0,0 +1,43 @@
+/* Writes and reads a file with pwrite() and pread() at various
+   offsets and checks that neither moves the file position. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[2048];
+static char rbuf[2048];
+
+void
+test_main (void)
+{
+  const char *file_name = "positional";
+  int fd;
+
+  random_bytes (buf, sizeof buf);
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+
+  CHECK (pwrite (fd, buf + 1024, 1024, 1024) == 1024,
+         "pwrite second half of \"%s\"", file_name);
+  CHECK (filesize (fd) == (int) sizeof buf, "filesize \"%s\"", file_name);
+  CHECK (pwrite (fd, buf, 1024, 0) == 1024,
+         "pwrite first half of \"%s\"", file_name);
+  CHECK (tell (fd) == 0, "tell \"%s\" after pwrite", file_name);
+
+  seek (fd, 100);
+  CHECK (pread (fd, rbuf, sizeof rbuf, 0) == (int) sizeof rbuf,
+         "pread \"%s\"", file_name);
+  compare_bytes (rbuf, buf, sizeof rbuf, 0, file_name);
+  CHECK (tell (fd) == 100, "tell \"%s\" after pread", file_name);
+  CHECK (pread (fd, rbuf, 100, sizeof buf) == 0,
+         "pread at end of \"%s\"", file_name);
+  CHECK (pread (fd, rbuf, 100, -1) == -1,
+         "pread at negative offset in \"%s\"", file_name);
+
+  CHECK (fsync (fd) == 0, "fsync \"%s\"", file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  CHECK (fsync (fd) == -1, "fsync closed \"%s\"", file_name);
+}
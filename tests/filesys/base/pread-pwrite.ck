@@ -0,0 +1,22 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(pread-pwrite) begin
+(pread-pwrite) create "positional"
+(pread-pwrite) open "positional"
+(pread-pwrite) pwrite second half of "positional"
+(pread-pwrite) filesize "positional"
+(pread-pwrite) pwrite first half of "positional"
+(pread-pwrite) tell "positional" after pwrite
+(pread-pwrite) pread "positional"
+(pread-pwrite) tell "positional" after pread
+(pread-pwrite) pread at end of "positional"
+(pread-pwrite) pread at negative offset in "positional"
+(pread-pwrite) fsync "positional"
+(pread-pwrite) close "positional"
+(pread-pwrite) fsync closed "positional"
+(pread-pwrite) end
+EOF
+pass;
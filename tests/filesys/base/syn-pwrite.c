@@ -0,0 +1,33 @@
+/* Spawns several child processes that write interleaved chunks
+   of an empty file with pwrite(), growing it as they go, and
+   waits for them to finish.  Then reads back the file with
+   pread() and verifies its contents. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/filesys/base/syn-pwrite.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+char buf1[BUF_SIZE];
+char buf2[BUF_SIZE];
+
+void
+test_main (void)
+{
+  pid_t children[CHILD_CNT];
+  int fd;
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+
+  exec_children ("child-syn-pwrt", children, CHILD_CNT);
+  wait_children (children, CHILD_CNT);
+
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (filesize (fd) == BUF_SIZE, "filesize \"%s\"", file_name);
+  CHECK (pread (fd, buf1, sizeof buf1, 0) == BUF_SIZE,
+         "pread \"%s\"", file_name);
+  random_bytes (buf2, sizeof buf2);
+  compare_bytes (buf1, buf2, sizeof buf1, 0, file_name);
+  CHECK (tell (fd) == 0, "tell \"%s\"", file_name);
+}
@@ -0,0 +1,30 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(syn-pwrite) begin
+(syn-pwrite) create "striped"
+(syn-pwrite) exec child 1 of 8: "child-syn-pwrt 0"
+(syn-pwrite) exec child 2 of 8: "child-syn-pwrt 1"
+(syn-pwrite) exec child 3 of 8: "child-syn-pwrt 2"
+(syn-pwrite) exec child 4 of 8: "child-syn-pwrt 3"
+(syn-pwrite) exec child 5 of 8: "child-syn-pwrt 4"
+(syn-pwrite) exec child 6 of 8: "child-syn-pwrt 5"
+(syn-pwrite) exec child 7 of 8: "child-syn-pwrt 6"
+(syn-pwrite) exec child 8 of 8: "child-syn-pwrt 7"
+(syn-pwrite) wait for child 1 of 8 returned 0 (expected 0)
+(syn-pwrite) wait for child 2 of 8 returned 1 (expected 1)
+(syn-pwrite) wait for child 3 of 8 returned 2 (expected 2)
+(syn-pwrite) wait for child 4 of 8 returned 3 (expected 3)
+(syn-pwrite) wait for child 5 of 8 returned 4 (expected 4)
+(syn-pwrite) wait for child 6 of 8 returned 5 (expected 5)
+(syn-pwrite) wait for child 7 of 8 returned 6 (expected 6)
+(syn-pwrite) wait for child 8 of 8 returned 7 (expected 7)
+(syn-pwrite) open "striped"
+(syn-pwrite) filesize "striped"
+(syn-pwrite) pread "striped"
+(syn-pwrite) tell "striped"
+(syn-pwrite) end
+EOF
+pass;
@@ -0,0 +1,10 @@
+#ifndef TESTS_FILESYS_BASE_SYN_PWRITE_H
+#define TESTS_FILESYS_BASE_SYN_PWRITE_H
+
+#define CHILD_CNT 8
+#define CHUNK_SIZE 512
+#define CHUNK_CNT (CHILD_CNT * 8)
+#define BUF_SIZE (CHUNK_CNT * CHUNK_SIZE)
+static const char file_name[] = "striped";
+
+#endif /* tests/filesys/base/syn-pwrite.h */
@@ -0,0 +1,68 @@
+/* Reads FILE_CNT files in rounds of 1, 2, 4, and 8 concurrent
+   reader processes, each of which reads a different share of
+   the files.  Every round reads the same amount of data, more
+   than fits in the buffer cache, so the kernel's tick count
+   for the whole test goes down as reads of different files
+   stop waiting on each other in the file system. */
+
+#include <random.h>
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/filesys/base/syn-readers.h"
+
+static char buf[FILE_SIZE];
+
+/* Runs FILE_CNT / READER_CNT passes over the files in
+   READER_CNT children at once. */
+static void
+read_round (int reader_cnt)
+{
+  pid_t children[FILE_CNT];
+  int i;
+
+  msg ("%d readers", reader_cnt);
+  for (i = 0; i < reader_cnt; i++)
+    {
+      char cmd_line[64];
+
+      snprintf (cmd_line, sizeof cmd_line, "child-readers %d %d",
+                i, reader_cnt);
+      children[i] = fork ("child-readers");
+      if (children[i] == 0)
+        exec (cmd_line);
+      if (children[i] == PID_ERROR)
+        fail ("exec \"%s\" failed", cmd_line);
+    }
+  for (i = 0; i < reader_cnt; i++)
+    {
+      int status = wait (children[i]);
+      if (status != i)
+        fail ("reader %d of %d returned %d", i + 1, reader_cnt, status);
+    }
+}
+
+void
+test_main (void)
+{
+  int reader_cnt;
+  int i;
+
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      char name[16];
+      int fd;
+
+      reader_file_name (name, sizeof name, i);
+      CHECK (create (name, 0), "create \"%s\"", name);
+      CHECK ((fd = open (name)) > 1, "open \"%s\"", name);
+      random_init (i);
+      random_bytes (buf, sizeof buf);
+      CHECK (write (fd, buf, sizeof buf) == (int) sizeof buf, "write \"%s\"", name);
+      close (fd);
+    }
+
+  for (reader_cnt = 1; reader_cnt <= FILE_CNT; reader_cnt *= 2)
+    read_round (reader_cnt);
+}
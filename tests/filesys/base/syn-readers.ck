@@ -0,0 +1,37 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(syn-readers) begin
+(syn-readers) create "r0"
+(syn-readers) open "r0"
+(syn-readers) write "r0"
+(syn-readers) create "r1"
+(syn-readers) open "r1"
+(syn-readers) write "r1"
+(syn-readers) create "r2"
+(syn-readers) open "r2"
+(syn-readers) write "r2"
+(syn-readers) create "r3"
+(syn-readers) open "r3"
+(syn-readers) write "r3"
+(syn-readers) create "r4"
+(syn-readers) open "r4"
+(syn-readers) write "r4"
+(syn-readers) create "r5"
+(syn-readers) open "r5"
+(syn-readers) write "r5"
+(syn-readers) create "r6"
+(syn-readers) open "r6"
+(syn-readers) write "r6"
+(syn-readers) create "r7"
+(syn-readers) open "r7"
+(syn-readers) write "r7"
+(syn-readers) 1 readers
+(syn-readers) 2 readers
+(syn-readers) 4 readers
+(syn-readers) 8 readers
+(syn-readers) end
+EOF
+pass;
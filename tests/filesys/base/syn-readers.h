@@ -0,0 +1,18 @@
+#ifndef TESTS_FILESYS_BASE_SYN_READERS_H
+#define TESTS_FILESYS_BASE_SYN_READERS_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#define FILE_CNT 8              /* Files read in each round. */
+#define FILE_SIZE 32768         /* Bytes in each file. */
+#define BLOCK_SIZE 4096         /* Bytes per read() call. */
+
+/* Stores the name of file I in NAME. */
+static inline void
+reader_file_name (char *name, size_t size, int i)
+{
+  snprintf (name, size, "r%d", i);
+}
+
+#endif /* tests/filesys/base/syn-readers.h */
@@ -0,0 +1,161 @@
+/* Test program for lib/kernel/bitmap.c.
+
+   Checks the word-at-a-time scanning, counting and setting code
+   against bit-at-a-time references on sparse, dense and
+   fragmented maps, and times allocations from each kind of map
+   with bitmap_scan_and_flip().
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <bitmap.h>
+#include <debug.h>
+#include <random.h>
+#include <stdio.h>
+#include "intrinsic.h"
+#include "threads/test.h"
+
+/* Number of bits in the maps we test. */
+#define BIT_CNT 4096
+
+/* Number of allocations timed per map. */
+#define ALLOC_CNT 128
+
+/* Kinds of maps. */
+enum shape
+  {
+    SPARSE,                     /* About 1 bit in 16 set. */
+    DENSE,                      /* About 15 bits in 16 set. */
+    FRAGMENTED                  /* Short set and clear runs. */
+  };
+static const char *shape_names[] = {"sparse", "dense", "fragmented"};
+
+static void fill (struct bitmap *, enum shape);
+static void verify (const struct bitmap *);
+static size_t ref_scan (const struct bitmap *, size_t start, size_t cnt,
+                        bool value);
+static uint64_t time_allocs (enum shape, size_t cnt);
+
+/* Test the bitmap implementation. */
+void
+test (void) 
+{
+  enum shape shape;
+
+  for (shape = SPARSE; shape <= FRAGMENTED; shape++) 
+    {
+      uint64_t one = time_allocs (shape, 1);
+      uint64_t eight = time_allocs (shape, 8);
+
+      printf ("%s: %llu cycles per 1-bit allocation, "
+              "%llu per 8-bit allocation\n",
+              shape_names[shape], one, eight);
+    }
+  printf ("bitmap: PASS\n");
+}
+
+/* Makes a map of the given SHAPE, checks it, allocates
+   ALLOC_CNT runs of CNT clear bits from it, checks it again, and
+   returns the mean number of cycles per allocation. */
+static uint64_t
+time_allocs (enum shape shape, size_t cnt) 
+{
+  struct bitmap *b = bitmap_create (BIT_CNT);
+  uint64_t cycles = 0;
+  size_t i;
+
+  ASSERT (b != NULL);
+  fill (b, shape);
+  verify (b);
+
+  for (i = 0; i < ALLOC_CNT; i++) 
+    {
+      size_t expected = ref_scan (b, 0, cnt, false);
+      uint64_t start;
+      size_t idx;
+
+      /* Only the allocation itself is timed. */
+      start = rdtsc ();
+      idx = bitmap_scan_and_flip (b, 0, cnt, false);
+      cycles += rdtsc () - start;
+
+      ASSERT (idx == expected);
+      ASSERT (idx == BITMAP_ERROR || bitmap_all (b, idx, cnt));
+    }
+  verify (b);
+  bitmap_destroy (b);
+  return cycles / ALLOC_CNT;
+}
+
+/* Sets B's bits according to SHAPE. */
+static void
+fill (struct bitmap *b, enum shape shape) 
+{
+  size_t i, run;
+
+  switch (shape) 
+    {
+    case SPARSE:
+    case DENSE:
+      for (i = 0; i < BIT_CNT; i++)
+        bitmap_set (b, i, (random_ulong () % 16 == 0) == (shape == SPARSE));
+      break;
+
+    case FRAGMENTED:
+      for (i = 0; i < BIT_CNT; i += run) 
+        {
+          run = random_ulong () % 12 + 1;
+          if (run > BIT_CNT - i)
+            run = BIT_CNT - i;
+          bitmap_set_multiple (b, i, run, (i / 7) % 2);
+        }
+      break;
+    }
+}
+
+/* Checks B's counting and scanning functions against
+   bit-at-a-time references over a range of random intervals. */
+static void
+verify (const struct bitmap *b) 
+{
+  int i;
+
+  for (i = 0; i < 256; i++) 
+    {
+      size_t start = random_ulong () % BIT_CNT;
+      size_t cnt = random_ulong () % (BIT_CNT - start);
+      bool value = random_ulong () % 2;
+      size_t j, value_cnt = 0;
+
+      for (j = start; j < start + cnt; j++)
+        if (bitmap_test (b, j) == value)
+          value_cnt++;
+      ASSERT (bitmap_count (b, start, cnt, value) == value_cnt);
+      ASSERT (bitmap_contains (b, start, cnt, value) == (value_cnt > 0));
+
+      cnt = random_ulong () % 24;
+      ASSERT (bitmap_scan (b, start, cnt, value)
+              == ref_scan (b, start, cnt, value));
+    }
+}
+
+/* Returns the index of the first run of CNT bits set to VALUE
+   in B at or after START, testing one bit at a time, or
+   BITMAP_ERROR if there is none. */
+static size_t
+ref_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) 
+{
+  size_t i, run = 0;
+
+  if (cnt == 0)
+    return start;
+  for (i = start; i < bitmap_size (b); i++) 
+    {
+      run = bitmap_test (b, i) == value ? run + 1 : 0;
+      if (run == cnt)
+        return i + 1 - cnt;
+    }
+  return BITMAP_ERROR;
+}
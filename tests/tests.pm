@@ -14,7 +14,7 @@ my ($msg_file) = tempfile ();
 select ($msg_file);
 
 our (@prereq_tests) = ();
-if ($test =~ /^(.*)-persistence$/) {
+if ($test =~ /^(.*)-(?:persistence|recovery)$/) {
     push (@prereq_tests, $1);
 }
 for my $prereq_test (@prereq_tests) {
@@ -0,0 +1,65 @@
+/* Fragments the kernel pool by freeing every other page of a
+   large allocation, then times single-page and 16-page
+   allocations from it.  Also checks that multi-page allocations
+   come back aligned to their size, as buddy blocks should. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+#include "intrinsic.h"
+
+#define FRAG_CNT 1024           /* Pages used to fragment the pool. */
+#define ITER_CNT 64             /* Timed allocations per size. */
+
+static void *frag[FRAG_CNT];
+static void *blocks[ITER_CNT];
+
+static uint64_t time_allocs (size_t page_cnt);
+
+void
+test_palloc_buddy (void) 
+{
+  size_t i;
+
+  msg ("fragment the kernel pool");
+  for (i = 0; i < FRAG_CNT; i++)
+    {
+      frag[i] = palloc_get_page (0);
+      if (frag[i] == NULL)
+        fail ("out of pages after %zu allocations", i);
+    }
+  for (i = 0; i < FRAG_CNT; i += 2)
+    palloc_free_page (frag[i]);
+
+  msg ("%llu cycles per 1-page allocation", time_allocs (1));
+  msg ("%llu cycles per 16-page allocation", time_allocs (16));
+
+  for (i = 1; i < FRAG_CNT; i += 2)
+    palloc_free_page (frag[i]);
+  pass ();
+}
+
+/* Allocates ITER_CNT blocks of PAGE_CNT pages, checks and frees
+   them, and returns the mean number of cycles per allocation. */
+static uint64_t
+time_allocs (size_t page_cnt) 
+{
+  uint64_t start, cycles;
+  size_t i;
+
+  start = rdtsc ();
+  for (i = 0; i < ITER_CNT; i++)
+    blocks[i] = palloc_get_multiple (0, page_cnt);
+  cycles = rdtsc () - start;
+
+  for (i = 0; i < ITER_CNT; i++)
+    {
+      if (blocks[i] == NULL)
+        fail ("%zu-page allocation %zu failed", page_cnt, i);
+      if (pg_no (blocks[i]) % page_cnt != 0)
+        fail ("%zu-page block at %p is misaligned", page_cnt, blocks[i]);
+      palloc_free_multiple (blocks[i], page_cnt);
+    }
+  return cycles / ITER_CNT;
+}
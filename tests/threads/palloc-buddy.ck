@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+
+# Timings vary from run to run.
+@output = grep (!/^\(palloc-buddy\) \d+ cycles per \d+-page allocation$/,
+		@output);
+compare_output ("run", \@output, [<<'EOF']);
+(palloc-buddy) begin
+(palloc-buddy) fragment the kernel pool
+(palloc-buddy) PASS
+(palloc-buddy) end
+EOF
+pass;
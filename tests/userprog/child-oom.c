@@ -0,0 +1,28 @@
+/* Child process run by the oom-stress test.
+   Fills a buffer too large for many copies of it to fit in
+   memory at once, checks it and exits with status 0.  Prints
+   nothing, because it may be killed at any point. */
+
+#include <string.h>
+#include "tests/lib.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_CNT 768
+
+static char buf[PAGE_CNT * PAGE_SIZE];
+
+int
+main (void)
+{
+  int i;
+
+  test_name = "child-oom";
+
+  for (i = 0; i < PAGE_CNT; i++)
+    memset (buf + i * PAGE_SIZE, i, PAGE_SIZE);
+  for (i = 0; i < PAGE_CNT; i++)
+    if (buf[i * PAGE_SIZE] != (char) i
+        || buf[i * PAGE_SIZE + PAGE_SIZE - 1] != (char) i)
+      return 1;
+  return 0;
+}
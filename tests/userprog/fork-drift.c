@@ -0,0 +1,64 @@
+/* Forks and waits for 1,000 child processes that exit right
+   away, and checks that the kernel ends up using as many pages
+   and as much malloc() memory as it did after the first few. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+/* Number of fork/exit cycles. */
+#define CYCLES 1000
+
+/* Cycles run before taking the baseline, so that caches that
+   fill up on first use are already full. */
+#define WARMUP 10
+
+/* The last child may still be tearing itself down when its
+   parent's wait() returns, so allow for one process's worth of
+   memory.  A leak of a page per cycle shows up as hundreds. */
+#define SLACK_PAGES 16
+#define SLACK_BYTES (SLACK_PAGES * 4096)
+
+static void
+fork_and_wait (void)
+{
+  pid_t pid = fork ("child");
+
+  if (pid == 0)
+    exit (0);
+  if (pid < 0)
+    fail ("fork failed");
+  if (wait (pid) != 0)
+    fail ("wait returned wrong status");
+}
+
+static void
+check_drift (const char *what, size_t before, size_t after, size_t slack)
+{
+  if (after > before + slack)
+    fail ("%s grew from %zu to %zu after %d cycles",
+          what, before, after, CYCLES);
+}
+
+void
+test_main (void)
+{
+  struct memstat before, after;
+  int i;
+
+  for (i = 0; i < WARMUP; i++)
+    fork_and_wait ();
+  CHECK (memstat (&before), "memstat");
+
+  for (; i < CYCLES; i++)
+    fork_and_wait ();
+  CHECK (memstat (&after), "memstat");
+
+  check_drift ("kernel pages", before.kernel_pages, after.kernel_pages,
+               SLACK_PAGES);
+  check_drift ("user pages", before.user_pages, after.user_pages,
+               SLACK_PAGES);
+  check_drift ("malloc bytes", before.malloc_bytes, after.malloc_bytes,
+               SLACK_BYTES);
+  msg ("no drift after %d cycles", CYCLES);
+}
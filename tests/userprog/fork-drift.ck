@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fork-drift) begin
+(fork-drift) memstat
+(fork-drift) memstat
+(fork-drift) no drift after 1000 cycles
+(fork-drift) end
+EOF
+pass;
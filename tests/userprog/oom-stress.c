@@ -0,0 +1,67 @@
+/* Runs more copies of child-oom at once than fit in memory, so
+   that the kernel has to reclaim memory and kill some of them.
+   Checks that every child either finishes or is killed with
+   status -1, that the system still runs a child to completion
+   afterward, and that all the memory comes back. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+/* Number of children run at once. */
+#define CHILD_CNT 8
+
+/* Pages the kernel may legitimately hold on to afterward, as in
+   fork-drift. */
+#define SLACK_PAGES 16
+
+static pid_t
+spawn_child (void)
+{
+  pid_t pid = fork ("child-oom");
+
+  if (pid == 0)
+    {
+      exec ("child-oom");
+      exit (-1);
+    }
+  if (pid < 0)
+    fail ("fork failed");
+  return pid;
+}
+
+void
+test_main (void)
+{
+  struct memstat before, after;
+  pid_t pids[CHILD_CNT];
+  int i;
+
+  CHECK (memstat (&before), "memstat");
+
+  msg ("spawn %d children", CHILD_CNT);
+  for (i = 0; i < CHILD_CNT; i++)
+    pids[i] = spawn_child ();
+
+  msg ("wait for children");
+  for (i = 0; i < CHILD_CNT; i++)
+    {
+      int status = wait (pids[i]);
+
+      if (status != 0 && status != -1)
+        fail ("child %d exited with status %d", i, status);
+    }
+
+  msg ("run one more child");
+  if (wait (spawn_child ()) != 0)
+    fail ("child failed with memory available");
+
+  CHECK (memstat (&after), "memstat");
+  if (after.user_pages > before.user_pages + SLACK_PAGES)
+    fail ("user pages grew from %zu to %zu",
+          before.user_pages, after.user_pages);
+  if (after.kernel_pages > before.kernel_pages + SLACK_PAGES)
+    fail ("kernel pages grew from %zu to %zu",
+          before.kernel_pages, after.kernel_pages);
+  msg ("memory reclaimed");
+}
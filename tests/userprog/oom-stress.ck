@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+
+# Which children the OOM killer picks, and when, varies.
+@output = grep (!/^oom: killed /, @output);
+compare_output ("run", IGNORE_EXIT_CODES => 1, \@output, [<<'EOF']);
+(oom-stress) begin
+(oom-stress) memstat
+(oom-stress) spawn 8 children
+(oom-stress) wait for children
+(oom-stress) run one more child
+(oom-stress) memstat
+(oom-stress) memory reclaimed
+(oom-stress) end
+EOF
+pass;
@@ -0,0 +1,63 @@
+/* Fills a buffer with zeros and forks, so that parent and child
+   both hold many zero pages, and waits for the merging scanner to
+   fold them into one frame.  The child then read()s a file into
+   its copy, which makes the kernel, not the process, write to the
+   merged frame.  Checks that the child sees the data and that the
+   parent's copy stays zero. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_CNT 64
+
+static char buf[PAGE_CNT * PAGE_SIZE];
+
+/* Returns the number of user pool pages in use. */
+static size_t
+user_pages (void)
+{
+  struct memstat st;
+
+  if (!memstat (&st))
+    fail ("memstat");
+  return st.user_pages;
+}
+
+void
+test_main (void)
+{
+  size_t slen = strlen (sample);
+  size_t i, start;
+  pid_t pid;
+  int handle;
+
+  for (i = 0; i < PAGE_CNT; i++)
+    memset (buf + i * PAGE_SIZE, 0, PAGE_SIZE);
+
+  pid = fork ("merge-read");
+  if (pid == 0)
+    {
+      /* Half the zero pages freed means these are merged too. */
+      start = user_pages ();
+      while (user_pages () + PAGE_CNT / 2 > start)
+        continue;
+
+      CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+      CHECK (read (handle, buf, slen) == (int) slen, "read \"sample.txt\"");
+      close (handle);
+      if (memcmp (buf, sample, slen))
+        fail ("child does not see the data it read");
+      exit (0);
+    }
+
+  if (pid < 0)
+    fail ("fork");
+  CHECK (wait (pid) == 0, "wait for child");
+  for (i = 0; i < sizeof buf; i++)
+    if (buf[i] != 0)
+      fail ("parent's byte %zu changed to %d", i, buf[i]);
+}
@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(merge-read) begin
+(merge-read) open "sample.txt"
+(merge-read) read "sample.txt"
+(merge-read) wait for child
+(merge-read) end
+EOF
+pass;
@@ -0,0 +1,39 @@
+/* Maps the same file twice and checks that a write through one
+   mapping shows up in the other at once, and in the file after
+   both are unmapped. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static const char message[] = "written through the first mapping";
+
+void
+test_main (void)
+{
+  char *actual[2] = {(char *) 0x10000000, (char *) 0x20000000};
+  char buf[sizeof message];
+  size_t i;
+  int handle;
+
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  for (i = 0; i < 2; i++)
+    CHECK (mmap (actual[i], 4096, 1, handle, 0) != MAP_FAILED,
+           "mmap \"sample.txt\" #%zu", i);
+
+  msg ("write through mapping #0");
+  memcpy (actual[0], message, sizeof message);
+  if (memcmp (actual[1], message, sizeof message))
+    fail ("mapping #1 does not see the write");
+
+  for (i = 0; i < 2; i++)
+    munmap (actual[i]);
+
+  seek (handle, 0);
+  CHECK (read (handle, buf, sizeof buf) == (int) sizeof buf,
+         "read \"sample.txt\"");
+  if (memcmp (buf, message, sizeof message))
+    fail ("file does not contain the write");
+  close (handle);
+}
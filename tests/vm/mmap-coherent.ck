@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(mmap-coherent) begin
+(mmap-coherent) open "sample.txt"
+(mmap-coherent) mmap "sample.txt" #0
+(mmap-coherent) mmap "sample.txt" #1
+(mmap-coherent) write through mapping #0
+(mmap-coherent) read "sample.txt"
+(mmap-coherent) end
+mmap-coherent: exit(0)
+EOF
+pass;
@@ -0,0 +1,55 @@
+/* Scans large.txt once with read() and once through a memory
+   mapping, and checks that both scans see the same bytes.
+
+   This doubles as a benchmark: the kernel statistics printed at
+   power-off show the page faults and file page reads each way
+   costs.  The mapped scan reads every page once, straight into
+   the frame the process uses, without copying it through a user
+   buffer. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ACTUAL ((void *) 0x10000000)
+
+static char buf[4096];
+
+/* Folds SIZE bytes at P into checksum SUM. */
+static unsigned
+checksum (const char *p, size_t size, unsigned sum)
+{
+  size_t i;
+
+  for (i = 0; i < size; i++)
+    sum = sum * 31 + (unsigned char) p[i];
+  return sum;
+}
+
+void
+test_main (void)
+{
+  unsigned read_sum = 0, mmap_sum;
+  size_t size;
+  char *map;
+  int handle;
+  int n;
+
+  CHECK ((handle = open ("large.txt")) > 1, "open \"large.txt\"");
+  size = filesize (handle);
+
+  msg ("scan with read()");
+  while ((n = read (handle, buf, sizeof buf)) > 0)
+    read_sum = checksum (buf, n, read_sum);
+
+  CHECK ((map = mmap (ACTUAL, size, 0, handle, 0)) != MAP_FAILED,
+         "mmap \"large.txt\"");
+  msg ("scan with mmap()");
+  mmap_sum = checksum (map, size, 0);
+  munmap (map);
+  close (handle);
+
+  if (read_sum != mmap_sum)
+    fail ("checksums differ: read() %08x, mmap() %08x", read_sum, mmap_sum);
+}
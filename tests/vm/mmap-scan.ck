@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(mmap-scan) begin
+(mmap-scan) open "large.txt"
+(mmap-scan) scan with read()
+(mmap-scan) mmap "large.txt"
+(mmap-scan) scan with mmap()
+(mmap-scan) end
+mmap-scan: exit(0)
+EOF
+pass;
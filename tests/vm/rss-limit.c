@@ -0,0 +1,44 @@
+/* Runs with each process limited to LIMIT resident pages, and
+   fills a buffer four times that size.  Checks that the contents
+   survive, that the process was made to evict its own pages and
+   that its resident set never grew past the limit. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+/* Must match -rss-limit in Make.tests. */
+#define LIMIT 64
+
+#define PAGE_SIZE 4096
+#define PAGE_CNT (4 * LIMIT)
+
+static char buf[PAGE_CNT * PAGE_SIZE];
+
+void
+test_main (void)
+{
+  struct memstat st;
+  size_t i;
+
+  msg ("write pass");
+  for (i = 0; i < PAGE_CNT; i++)
+    memset (buf + i * PAGE_SIZE, i & 0xff, PAGE_SIZE);
+
+  msg ("read pass");
+  for (i = 0; i < PAGE_CNT; i++)
+    if (buf[i * PAGE_SIZE] != (char) (i & 0xff)
+        || buf[i * PAGE_SIZE + PAGE_SIZE - 1] != (char) (i & 0xff))
+      fail ("page %zu has wrong contents", i);
+
+  CHECK (memstat (&st), "memstat");
+  if (st.peak_rss > LIMIT)
+    fail ("peak RSS %zu exceeds limit %d", st.peak_rss, LIMIT);
+  if (st.rss > st.peak_rss)
+    fail ("RSS %zu exceeds peak RSS %zu", st.rss, st.peak_rss);
+  if (st.evictions < PAGE_CNT - LIMIT)
+    fail ("only %lld evictions", st.evictions);
+  if (st.faults < PAGE_CNT)
+    fail ("only %lld faults", st.faults);
+}
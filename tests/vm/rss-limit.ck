@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(rss-limit) begin
+(rss-limit) write pass
+(rss-limit) read pass
+(rss-limit) memstat
+(rss-limit) end
+EOF
+pass;
@@ -0,0 +1,127 @@
+#include "threads/arena.h"
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Per-thread scratch memory.
+
+   A lot of kernel code needs a buffer only until it returns: a
+   bounce sector for a partial disk read, a kernel copy of a
+   file name.  Getting such buffers from malloc() costs a trip
+   through the allocator both ways, for memory whose lifetime is
+   plainly nested in the caller's stack frame.
+
+   Instead, each thread owns a small region of ARENA_PAGES pages,
+   allocated the first time it is needed and freed when the
+   thread exits.  Code that wants scratch memory brackets its use
+   with arena_begin() and arena_end(), and in between gets
+   buffers from arena_alloc(), which just bumps a pointer.
+   arena_end() releases everything allocated since the matching
+   arena_begin() in one step.  Scopes nest, which matters because
+   a page fault taken in the middle of one scope may well open
+   another, e.g. to read a lazily loaded page from a file.
+
+   Only the running thread touches its own region, so none of
+   this needs a lock.  Interrupt handlers must not use it. */
+
+/* Number of pages in a thread's scratch region. */
+#define ARENA_PAGES 2
+
+/* Size of a thread's scratch region. */
+#define ARENA_SIZE (ARENA_PAGES * PGSIZE)
+
+/* Allocations are aligned to this many bytes. */
+#define ARENA_ALIGN 16
+
+/* Statistics. */
+static long long alloc_cnt;     /* Successful arena_alloc() calls. */
+static long long fail_cnt;      /* Failed arena_alloc() calls. */
+static long long region_cnt;    /* Regions allocated. */
+static size_t peak_used;        /* Most bytes of a region ever in use. */
+
+/* Opens a scratch scope in the current thread and returns a mark
+   to pass to arena_end() when the scope closes. */
+size_t
+arena_begin (void) {
+	ASSERT (!intr_context ());
+	return thread_current ()->arena_used;
+}
+
+/* Returns SIZE bytes of scratch memory from the current thread's
+   region, or a null pointer if the region is too full or cannot
+   be allocated.  The memory is not zeroed, and it stays valid
+   until the innermost open scope closes. */
+void *
+arena_alloc (size_t size) {
+	struct thread *t = thread_current ();
+	void *p;
+
+	ASSERT (!intr_context ());
+
+	if (t->arena == NULL) {
+		t->arena = palloc_get_multiple (0, ARENA_PAGES);
+		if (t->arena == NULL) {
+			fail_cnt++;
+			return NULL;
+		}
+		region_cnt++;
+	}
+
+	size = ROUND_UP (size, ARENA_ALIGN);
+	if (size > ARENA_SIZE - t->arena_used) {
+		fail_cnt++;
+		return NULL;
+	}
+
+	p = t->arena + t->arena_used;
+	t->arena_used += size;
+	if (t->arena_used > peak_used)
+		peak_used = t->arena_used;
+	alloc_cnt++;
+	return p;
+}
+
+/* Closes the scope opened by the arena_begin() call that
+   returned MARK, releasing all the scratch memory allocated
+   since then. */
+void
+arena_end (size_t mark) {
+	struct thread *t = thread_current ();
+
+	ASSERT (mark <= t->arena_used);
+	t->arena_used = mark;
+}
+
+/* Closes every scope in the current thread.  For use when the
+   kernel stack that the scopes belong to is abandoned, as on the
+   way out to a freshly loaded user program. */
+void
+arena_reset (void) {
+	thread_current ()->arena_used = 0;
+}
+
+/* Frees the current thread's scratch region.  Called when the
+   thread exits. */
+void
+arena_destroy (void) {
+	struct thread *t = thread_current ();
+
+	if (t->arena != NULL) {
+		palloc_free_multiple (t->arena, ARENA_PAGES);
+		t->arena = NULL;
+	}
+	t->arena_used = 0;
+}
+
+/* Prints scratch memory statistics. */
+void
+arena_print_stats (void) {
+	printf ("Arena: %lld scratch allocations, %lld failed, %lld regions, "
+			"peak %zu of %d bytes\n",
+			alloc_cnt, fail_cnt, region_cnt, peak_used, ARENA_SIZE);
+}
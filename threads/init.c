@@ -13,6 +13,7 @@
 #include "devices/serial.h"
 #include "devices/timer.h"
 #include "devices/vga.h"
+#include "threads/arena.h"
 #include "threads/interrupt.h"
 #include "threads/io.h"
 #include "threads/loader.h"
@@ -20,12 +21,15 @@
 #include "threads/mmu.h"
 #include "threads/palloc.h"
 #include "threads/pte.h"
+#include "threads/slab.h"
 #include "threads/thread.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #include "userprog/exception.h"
 #include "userprog/gdt.h"
+#include "userprog/oom.h"
 #include "userprog/syscall.h"
+#include "userprog/text-cache.h"
 #include "userprog/tss.h"
 #endif
 #include "tests/threads/tests.h"
@@ -44,6 +48,10 @@ uint64_t *base_pml4;
 #ifdef FILESYS
 /* -f: Format the file system? */
 static bool format_filesys;
+
+/* -powercut: Writes to the file system disk, counted from the
+   start of the task, before the power is cut, or 0. */
+static long long powercut_writes;
 #endif
 
 /* -q: Power off after kernel tasks complete? */
@@ -100,6 +108,7 @@ main (void) {
 #ifdef USERPROG
 	exception_init ();
 	syscall_init ();
+	text_cache_init ();
 #endif
 	/* Start thread scheduler and enable interrupts. */
 	thread_start ();
@@ -152,18 +161,32 @@ paging_init (uint64_t mem_end) {
 	extern char start, _end_kernel_text;
 	// Maps physical address [0 ~ mem_end] to
 	//   [LOADER_KERN_BASE ~ LOADER_KERN_BASE + mem_end].
-	for (uint64_t pa = 0; pa < mem_end; pa += PGSIZE) {
+	// Whole 2 MB chunks get a single huge page each, which saves
+	// page tables and TLB entries.  The chunks that hold kernel
+	// text need read-only 4 kB pages, as does the ragged end.
+	for (uint64_t pa = 0; pa < mem_end; ) {
 		uint64_t va = (uint64_t) ptov(pa);
 
+		if (hpg_ofs (pa) == 0 && pa + HPGSIZE <= mem_end
+				&& (va + HPGSIZE <= (uint64_t) &start
+					|| va >= (uint64_t) &_end_kernel_text)) {
+			if ((pte = pml4e_walk_pde (pml4, va, 1)) != NULL)
+				*pte = pa | PTE_PS | PTE_P | PTE_W;
+			pa += HPGSIZE;
+			continue;
+		}
+
 		perm = PTE_P | PTE_W;
 		if ((uint64_t) &start <= va && va < (uint64_t) &_end_kernel_text)
 			perm &= ~PTE_W;
 
 		if ((pte = pml4e_walk (pml4, va, 1)) != NULL)
 			*pte = pa | perm;
+		pa += PGSIZE;
 	}
 
 	// reload cr3
+	pml4_pcid_init ();
 	pml4_activate(0);
 }
 
@@ -216,16 +239,38 @@ parse_options (char **argv) {
 #ifdef FILESYS
 		else if (!strcmp (name, "-f"))
 			format_filesys = true;
+		else if (!strcmp (name, "-powercut"))
+			powercut_writes = atoi (value);
 #endif
 		else if (!strcmp (name, "-rs"))
 			random_init (atoi (value));
 		else if (!strcmp (name, "-mlfqs"))
 			thread_mlfqs = true;
+		else if (!strcmp (name, "-mtrack"))
+			track_alloc_sites = true;
 #ifdef USERPROG
 		else if (!strcmp (name, "-ul"))
 			user_page_limit = atoi (value);
+		else if (!strcmp (name, "-hugepages"))
+			user_huge_pages = true;
 		else if (!strcmp (name, "-threads-tests"))
 			thread_tests = true;
+#endif
+#ifdef VM
+		else if (!strcmp (name, "-nozswap"))
+			swap_compress = false;
+		else if (!strcmp (name, "-merge-pages"))
+			merge_batch = atoi (value);
+		else if (!strcmp (name, "-merge-ms"))
+			merge_interval = atoi (value);
+		else if (!strcmp (name, "-stack-max"))
+			stack_max = (size_t) atoi (value) * 1024 * 1024;
+		else if (!strcmp (name, "-rss-limit"))
+			rss_limit = atoi (value);
+		else if (!strcmp (name, "-ws-ms"))
+			ws_interval = atoi (value);
+		else if (!strcmp (name, "-rss-report"))
+			rss_report = true;
 #endif
 		else
 			PANIC ("unknown option `%s' (use -h for help)", name);
@@ -240,6 +285,13 @@ run_task (char **argv) {
 	const char *task = argv[1];
 
 	printf ("Executing '%s':\n", task);
+#ifdef FILESYS
+	if (powercut_writes > 0) {
+		/* Files put on the disk before the task must survive. */
+		filesys_sync ();
+		disk_cut_power (filesys_disk, powercut_writes);
+	}
+#endif
 #ifdef USERPROG
 	if (thread_tests){
 		run_test (task);
@@ -252,6 +304,12 @@ run_task (char **argv) {
 	printf ("Execution of '%s' complete.\n", task);
 }
 
+/* Prints kernel memory usage. */
+static void
+run_memdump (char **argv UNUSED) {
+	malloc_dump ();
+}
+
 /* Executes all of the actions specified in ARGV[]
    up to the null pointer sentinel. */
 static void
@@ -266,12 +324,14 @@ run_actions (char **argv) {
 	/* Table of supported actions. */
 	static const struct action actions[] = {
 		{"run", 2, run_task},
+		{"memdump", 1, run_memdump},
 #ifdef FILESYS
 		{"ls", 1, fsutil_ls},
 		{"cat", 2, fsutil_cat},
 		{"rm", 2, fsutil_rm},
 		{"put", 2, fsutil_put},
 		{"get", 2, fsutil_get},
+		{"fsck", 1, fsutil_fsck},
 #endif
 		{NULL, 0, NULL},
 	};
@@ -319,15 +379,32 @@ usage (void) {
 			"Use these actions indirectly via `pintos' -g and -p options:\n"
 			"  put FILE           Put FILE into file system from scratch disk.\n"
 			"  get FILE           Get FILE from file system into scratch disk.\n"
+			"  fsck               Check the free map against the files.\n"
 #endif
+			"  memdump            Print kernel memory usage.\n"
 			"\nOptions:\n"
 			"  -h                 Print this help message and power off.\n"
 			"  -q                 Power off VM after actions or on panic.\n"
 			"  -f                 Format file system disk during startup.\n"
+			"  -powercut=N        Cut the power, without syncing the file system,\n"
+			"                     after the task writes N sectors to its disk.\n"
 			"  -rs=SEED           Set random number seed to SEED.\n"
 			"  -mlfqs             Use multi-level feedback queue scheduler.\n"
+			"  -mtrack            Record who allocated each page and block.\n"
 #ifdef USERPROG
 			"  -ul=COUNT          Limit user memory to COUNT pages.\n"
+			"  -hugepages         Map large user data regions with 2 MB pages.\n"
+#endif
+#ifdef VM
+			"  -nozswap           Swap to disk without compressing in RAM first.\n"
+			"  -merge-pages=N     Scan N frames for identical pages per pass\n"
+			"                     (0 disables merging; default 100).\n"
+			"  -merge-ms=MS       Pause MS milliseconds between passes (default 50).\n"
+			"  -stack-max=MB      Let user stacks grow to MB megabytes (default 1).\n"
+			"  -rss-limit=N       Limit each process to N resident pages.\n"
+			"  -ws-ms=MS          Sample working sets every MS milliseconds\n"
+			"                     (0 disables sampling; default 100).\n"
+			"  -rss-report        Report each process's memory use at exit.\n"
 #endif
 			);
 	power_off ();
@@ -341,7 +418,13 @@ power_off (void) {
 #ifdef FILESYS
 	filesys_done ();
 #endif
+	power_cut ();
+}
 
+/* Powers down the machine at once, as if it were unplugged.
+   Unlike power_off(), leaves the file system disk as it is. */
+void
+power_cut (void) {
 	print_stats ();
 
 	printf ("Powering off...\n");
@@ -354,6 +437,11 @@ static void
 print_stats (void) {
 	timer_print_stats ();
 	thread_print_stats ();
+	pml4_print_stats ();
+	palloc_print_stats ();
+	kmem_print_stats ();
+	malloc_print_stats ();
+	arena_print_stats ();
 #ifdef FILESYS
 	disk_print_stats ();
 #endif
@@ -361,5 +449,10 @@ print_stats (void) {
 	kbd_print_stats ();
 #ifdef USERPROG
 	exception_print_stats ();
+	text_cache_print_stats ();
+	oom_print_stats ();
+#endif
+#ifdef VM
+	vm_print_stats ();
 #endif
 }
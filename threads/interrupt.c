@@ -369,6 +369,15 @@ intr_handler (struct intr_frame *frame) {
 		in_external_intr = false;
 		pic_end_of_interrupt (frame->vec_no);
 
+#ifdef USERPROG
+		/* A user process chosen by the OOM killer dies here if it
+		   does not enter the kernel by itself. */
+		if (frame->cs == SEL_UCSEG && thread_current ()->killed) {
+			intr_enable ();
+			thread_exit ();
+		}
+#endif
+
 		if (yield_on_return)
 			thread_yield ();
 	}
@@ -5,142 +5,103 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
 #include "threads/palloc.h"
-#include "threads/synch.h"
+#include "threads/slab.h"
 #include "threads/vaddr.h"
 
 /* A simple implementation of malloc().
 
-   The size of each request, in bytes, is rounded up to a power
-   of 2 and assigned to the "descriptor" that manages blocks of
-   that size.  The descriptor keeps a list of free blocks.  If
-   the free list is nonempty, one of its blocks is used to
-   satisfy the request.
-
-   Otherwise, a new page of memory, called an "arena", is
-   obtained from the page allocator (if none is available,
-   malloc() returns a null pointer).  The new arena is divided
-   into blocks, all of which are added to the descriptor's free
-   list.  Then we return one of the new blocks.
-
-   When we free a block, we add it to its descriptor's free list.
-   But if the arena that the block was in now has no in-use
-   blocks, we remove all of the arena's blocks from the free list
-   and give the arena back to the page allocator.
-
-   We can't handle blocks bigger than 2 kB using this scheme,
-   because they're too big to fit in a single page with a
-   descriptor.  We handle those by allocating contiguous pages
-   with the page allocator and sticking the allocation size at
-   the beginning of the allocated block's arena header. */
-
-/* Descriptor. */
-struct desc {
-	size_t block_size;          /* Size of each element in bytes. */
-	size_t blocks_per_arena;    /* Number of blocks in an arena. */
-	struct list free_list;      /* List of free blocks. */
-	struct lock lock;           /* Lock. */
-};
+   Requests of up to 1.5 kB are served by the slab allocator (see
+   slab.c), from one cache per size class.  The classes are the
+   powers of 2 from 16 bytes up and the sizes halfway between
+   them, so a block wastes at most a third of its size rather
+   than up to half.  Kernel objects that are allocated often
+   have caches of their own, sized exactly, and do not go
+   through malloc() at all; free() still accepts them, though,
+   since it looks up the cache of any slab object it is given.
+
+   We can't handle bigger blocks using this scheme, because too
+   few of them fit in a single page with a slab header.  We
+   handle those by allocating contiguous pages with the page
+   allocator and sticking the allocation size at the beginning
+   of the allocated block's arena header.
+
+   With -mtrack, every block also starts with a small header that
+   records its caller and puts it on a list, so that
+   malloc_dump() can say who holds how much memory. */
 
 /* Magic number for detecting arena corruption. */
 #define ARENA_MAGIC 0x9a548eed
 
-/* Arena. */
+/* Arena of a big block. */
 struct arena {
 	unsigned magic;             /* Always set to ARENA_MAGIC. */
-	struct desc *desc;          /* Owning descriptor, null for big block. */
-	size_t free_cnt;            /* Free blocks; pages in big block. */
+	size_t page_cnt;            /* Pages in the arena. */
+};
+
+/* Block sizes of the slab caches. */
+static const size_t class_sizes[] = {
+	16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536
 };
+#define CLASS_CNT (sizeof class_sizes / sizeof *class_sizes)
 
-/* Free block. */
-struct block {
-	struct list_elem free_elem; /* Free list element. */
+/* Slab cache for each entry in CLASS_SIZES. */
+static struct kmem_cache *classes[CLASS_CNT];
+
+/* Header of a block under -mtrack. */
+struct tracked_block {
+	struct list_elem elem;      /* Element in tracked_blocks. */
+	void *site;                 /* Return address of the allocating call. */
+	size_t size;                /* Size asked for. */
 };
 
-/* Our set of descriptors. */
-static struct desc descs[10];   /* Descriptors. */
-static size_t desc_cnt;         /* Number of descriptors. */
+/* All blocks under -mtrack.  Protected by disabling interrupts. */
+static struct list tracked_blocks;
+
+/* Statistics.  Protected by disabling interrupts. */
+static size_t block_cnt;        /* Blocks in use. */
+static size_t byte_cnt;         /* Bytes in use, including slack. */
+static size_t peak_byte_cnt;    /* Most bytes ever in use. */
+static long long alloc_cnt;     /* Blocks allocated. */
+static long long big_cnt;       /* Blocks allocated as whole pages. */
+
+/* Usage by allocation site, for malloc_dump(). */
+#define SITE_MAX 16
+struct site_usage {
+	void *site;                 /* Return address, or NULL for the rest. */
+	size_t cnt;                 /* Number of blocks or pages. */
+	size_t bytes;               /* Bytes held. */
+};
 
-static struct arena *block_to_arena (struct block *);
-static struct block *arena_to_block (struct arena *, size_t idx);
+static void *alloc_block (size_t size, void *site);
+static size_t raw_block_size (void *);
+static bool is_malloc_cache (const struct kmem_cache *);
+static void count_block (size_t size, bool big, bool alloc);
+static struct arena *block_to_arena (void *);
+static void add_site (struct site_usage *, void *site, size_t bytes);
+static void add_page_site (void *site, void *sites);
+static void print_sites (const char *what, struct site_usage *);
 
-/* Initializes the malloc() descriptors. */
+/* Initializes the malloc() size classes. */
 void
 malloc_init (void) {
-	size_t block_size;
-
-	for (block_size = 16; block_size < PGSIZE / 2; block_size *= 2) {
-		struct desc *d = &descs[desc_cnt++];
-		ASSERT (desc_cnt <= sizeof descs / sizeof *descs);
-		d->block_size = block_size;
-		d->blocks_per_arena = (PGSIZE - sizeof (struct arena)) / block_size;
-		list_init (&d->free_list);
-		lock_init (&d->lock);
+	size_t i;
+
+	for (i = 0; i < CLASS_CNT; i++) {
+		char name[16];
+
+		snprintf (name, sizeof name, "malloc-%zu", class_sizes[i]);
+		classes[i] = kmem_cache_create (name, class_sizes[i]);
 	}
+	list_init (&tracked_blocks);
 }
 
 /* Obtains and returns a new block of at least SIZE bytes.
    Returns a null pointer if memory is not available. */
 void *
 malloc (size_t size) {
-	struct desc *d;
-	struct block *b;
-	struct arena *a;
-
-	/* A null pointer satisfies a request for 0 bytes. */
-	if (size == 0)
-		return NULL;
-
-	/* Find the smallest descriptor that satisfies a SIZE-byte
-	   request. */
-	for (d = descs; d < descs + desc_cnt; d++)
-		if (d->block_size >= size)
-			break;
-	if (d == descs + desc_cnt) {
-		/* SIZE is too big for any descriptor.
-		   Allocate enough pages to hold SIZE plus an arena. */
-		size_t page_cnt = DIV_ROUND_UP (size + sizeof *a, PGSIZE);
-		a = palloc_get_multiple (0, page_cnt);
-		if (a == NULL)
-			return NULL;
-
-		/* Initialize the arena to indicate a big block of PAGE_CNT
-		   pages, and return it. */
-		a->magic = ARENA_MAGIC;
-		a->desc = NULL;
-		a->free_cnt = page_cnt;
-		return a + 1;
-	}
-
-	lock_acquire (&d->lock);
-
-	/* If the free list is empty, create a new arena. */
-	if (list_empty (&d->free_list)) {
-		size_t i;
-
-		/* Allocate a page. */
-		a = palloc_get_page (0);
-		if (a == NULL) {
-			lock_release (&d->lock);
-			return NULL;
-		}
-
-		/* Initialize arena and add its blocks to the free list. */
-		a->magic = ARENA_MAGIC;
-		a->desc = d;
-		a->free_cnt = d->blocks_per_arena;
-		for (i = 0; i < d->blocks_per_arena; i++) {
-			struct block *b = arena_to_block (a, i);
-			list_push_back (&d->free_list, &b->free_elem);
-		}
-	}
-
-	/* Get a block from free list and return it. */
-	b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
-	a = block_to_arena (b);
-	a->free_cnt--;
-	lock_release (&d->lock);
-	return b;
+	return alloc_block (size, __builtin_return_address (0));
 }
 
 /* Allocates and return A times B bytes initialized to zeroes.
@@ -156,7 +117,7 @@ calloc (size_t a, size_t b) {
 		return NULL;
 
 	/* Allocate and zero memory. */
-	p = malloc (size);
+	p = alloc_block (size, __builtin_return_address (0));
 	if (p != NULL)
 		memset (p, 0, size);
 
@@ -166,11 +127,10 @@ calloc (size_t a, size_t b) {
 /* Returns the number of bytes allocated for BLOCK. */
 static size_t
 block_size (void *block) {
-	struct block *b = block;
-	struct arena *a = block_to_arena (b);
-	struct desc *d = a->desc;
-
-	return d != NULL ? d->block_size : PGSIZE * a->free_cnt - pg_ofs (block);
+	if (track_alloc_sites)
+		return raw_block_size ((struct tracked_block *) block - 1)
+			- sizeof (struct tracked_block);
+	return raw_block_size (block);
 }
 
 /* Attempts to resize OLD_BLOCK to NEW_SIZE bytes, possibly
@@ -185,7 +145,7 @@ realloc (void *old_block, size_t new_size) {
 		free (old_block);
 		return NULL;
 	} else {
-		void *new_block = malloc (new_size);
+		void *new_block = alloc_block (new_size, __builtin_return_address (0));
 		if (old_block != NULL && new_block != NULL) {
 			size_t old_size = block_size (old_block);
 			size_t min_size = new_size < old_size ? new_size : old_size;
@@ -200,48 +160,198 @@ realloc (void *old_block, size_t new_size) {
    malloc(), calloc(), or realloc(). */
 void
 free (void *p) {
-	if (p != NULL) {
-		struct block *b = p;
-		struct arena *a = block_to_arena (b);
-		struct desc *d = a->desc;
-
-		if (d != NULL) {
-			/* It's a normal block.  We handle it here. */
-
-#ifndef NDEBUG
-			/* Clear the block to help detect use-after-free bugs. */
-			memset (b, 0xcc, d->block_size);
-#endif
-
-			lock_acquire (&d->lock);
-
-			/* Add block to free list. */
-			list_push_front (&d->free_list, &b->free_elem);
-
-			/* If the arena is now entirely unused, free it. */
-			if (++a->free_cnt >= d->blocks_per_arena) {
-				size_t i;
-
-				ASSERT (a->free_cnt == d->blocks_per_arena);
-				for (i = 0; i < d->blocks_per_arena; i++) {
-					struct block *b = arena_to_block (a, i);
-					list_remove (&b->free_elem);
-				}
-				palloc_free_page (a);
-			}
-
-			lock_release (&d->lock);
-		} else {
-			/* It's a big block.  Free its pages. */
-			palloc_free_multiple (a, a->free_cnt);
-			return;
+	struct kmem_cache *c;
+
+	if (p == NULL)
+		return;
+
+	c = kmem_cache_of (p);
+	if (c != NULL && !is_malloc_cache (c)) {
+		/* It's an object from one of the named caches. */
+		kmem_cache_free (c, p);
+		return;
+	}
+
+	if (track_alloc_sites) {
+		struct tracked_block *t = (struct tracked_block *) p - 1;
+		enum intr_level old_level = intr_disable ();
+
+		list_remove (&t->elem);
+		intr_set_level (old_level);
+		p = t;
+	}
+	count_block (raw_block_size (p), c == NULL, false);
+
+	if (c != NULL) {
+		/* It's a small block.  Its cache handles it. */
+		kmem_cache_free (c, p);
+	} else {
+		/* It's a big block.  Free its pages. */
+		struct arena *a = block_to_arena (p);
+		palloc_free_multiple (a, a->page_cnt);
+	}
+}
+
+/* Stores the number of bytes in malloc() blocks into *USED, and
+   the most there have ever been into *PEAK.  Objects from named
+   slab caches are not included. */
+void
+malloc_usage (size_t *used, size_t *peak) {
+	enum intr_level old_level = intr_disable ();
+
+	*used = byte_cnt;
+	*peak = peak_byte_cnt;
+	intr_set_level (old_level);
+}
+
+/* Prints malloc() statistics. */
+void
+malloc_print_stats (void) {
+	enum intr_level old_level = intr_disable ();
+	size_t blocks = block_cnt, bytes = byte_cnt, peak = peak_byte_cnt;
+	long long allocs = alloc_cnt, bigs = big_cnt;
+
+	intr_set_level (old_level);
+	printf ("Malloc: %zu blocks (%zu bytes) in use, peak %zu bytes, "
+			"%lld allocated, %lld big\n", blocks, bytes, peak, allocs, bigs);
+}
+
+/* Prints everything there is to know about kernel memory: page
+   pools, slab caches, malloc() blocks and, with -mtrack, the
+   call sites that hold the most pages and blocks.  Run
+   `backtrace' on the kernel binary to turn the addresses into
+   function names. */
+void
+malloc_dump (void) {
+	struct site_usage sites[SITE_MAX];
+	enum intr_level old_level;
+	struct list_elem *e;
+
+	palloc_print_stats ();
+	kmem_print_stats ();
+	malloc_print_stats ();
+	if (!track_alloc_sites)
+		return;
+
+	memset (sites, 0, sizeof sites);
+	palloc_for_each_site (add_page_site, sites);
+	print_sites ("Pages", sites);
+
+	memset (sites, 0, sizeof sites);
+	old_level = intr_disable ();
+	for (e = list_begin (&tracked_blocks); e != list_end (&tracked_blocks);
+			e = list_next (e)) {
+		struct tracked_block *t = list_entry (e, struct tracked_block, elem);
+		add_site (sites, t->site, t->size);
+	}
+	intr_set_level (old_level);
+	print_sites ("Malloc blocks", sites);
+}
+
+/* Does the work of malloc(), recording SITE as the caller. */
+static void *
+alloc_block (size_t size, void *site) {
+	size_t raw_size = size;
+	struct arena *a;
+	void *p = NULL;
+	size_t i, page_cnt;
+
+	/* A null pointer satisfies a request for 0 bytes. */
+	if (size == 0)
+		return NULL;
+	if (track_alloc_sites) {
+		raw_size += sizeof (struct tracked_block);
+		if (raw_size < size)
+			return NULL;
+	}
+
+	/* Find the smallest size class that satisfies a RAW_SIZE-byte
+	   request. */
+	for (i = 0; i < CLASS_CNT; i++)
+		if (class_sizes[i] >= raw_size) {
+			p = kmem_cache_alloc (classes[i]);
+			break;
 		}
+
+	if (i == CLASS_CNT) {
+		/* RAW_SIZE is too big for any size class.
+		   Allocate enough pages to hold RAW_SIZE plus an arena. */
+		page_cnt = DIV_ROUND_UP (raw_size + sizeof *a, PGSIZE);
+		a = palloc_get_multiple (0, page_cnt);
+		if (a != NULL) {
+			/* Initialize the arena to indicate a big block of
+			   PAGE_CNT pages. */
+			a->magic = ARENA_MAGIC;
+			a->page_cnt = page_cnt;
+			p = a + 1;
+		}
+	}
+	if (p == NULL)
+		return NULL;
+	count_block (raw_block_size (p), i == CLASS_CNT, true);
+
+	if (track_alloc_sites) {
+		struct tracked_block *t = p;
+		enum intr_level old_level;
+
+		t->site = site;
+		t->size = size;
+		old_level = intr_disable ();
+		list_push_back (&tracked_blocks, &t->elem);
+		intr_set_level (old_level);
+		p = t + 1;
 	}
+	return p;
 }
-
-/* Returns the arena that block B is inside. */
+
+/* Returns the number of bytes allocated for BLOCK, counting its
+   tracking header if it has one. */
+static size_t
+raw_block_size (void *block) {
+	struct kmem_cache *c = kmem_cache_of (block);
+
+	if (c != NULL)
+		return kmem_cache_size (c);
+	return PGSIZE * block_to_arena (block)->page_cnt - pg_ofs (block);
+}
+
+/* Returns true if C is one of malloc()'s size classes, false if
+   it is a named cache. */
+static bool
+is_malloc_cache (const struct kmem_cache *c) {
+	size_t i;
+
+	for (i = 0; i < CLASS_CNT; i++)
+		if (classes[i] == c)
+			return true;
+	return false;
+}
+
+/* Counts the allocation, if ALLOC is true, or the release of a
+   block of SIZE bytes, which is BIG if it has pages of its
+   own. */
+static void
+count_block (size_t size, bool big, bool alloc) {
+	enum intr_level old_level = intr_disable ();
+
+	if (alloc) {
+		block_cnt++;
+		byte_cnt += size;
+		if (byte_cnt > peak_byte_cnt)
+			peak_byte_cnt = byte_cnt;
+		alloc_cnt++;
+		if (big)
+			big_cnt++;
+	} else {
+		block_cnt--;
+		byte_cnt -= size;
+	}
+	intr_set_level (old_level);
+}
+
+/* Returns the arena of big block B. */
 static struct arena *
-block_to_arena (struct block *b) {
+block_to_arena (void *b) {
 	struct arena *a = pg_round_down (b);
 
 	/* Check that the arena is valid. */
@@ -249,20 +359,58 @@ block_to_arena (struct block *b) {
 	ASSERT (a->magic == ARENA_MAGIC);
 
 	/* Check that the block is properly aligned for the arena. */
-	ASSERT (a->desc == NULL
-			|| (pg_ofs (b) - sizeof *a) % a->desc->block_size == 0);
-	ASSERT (a->desc != NULL || pg_ofs (b) == sizeof *a);
+	ASSERT (pg_ofs (b) == sizeof *a);
 
 	return a;
 }
 
-/* Returns the (IDX - 1)'th block within arena A. */
-static struct block *
-arena_to_block (struct arena *a, size_t idx) {
-	ASSERT (a != NULL);
-	ASSERT (a->magic == ARENA_MAGIC);
-	ASSERT (idx < a->desc->blocks_per_arena);
-	return (struct block *) ((uint8_t *) a
-			+ sizeof *a
-			+ idx * a->desc->block_size);
+/* Adds BYTES held by SITE to the usage table SITES.  Once the
+   table is full, sites that are not in it yet are lumped
+   together in the last entry. */
+static void
+add_site (struct site_usage *sites, void *site, size_t bytes) {
+	size_t i;
+
+	for (i = 0; i < SITE_MAX - 1; i++)
+		if (sites[i].site == site || sites[i].cnt == 0)
+			break;
+	if (i == SITE_MAX - 1)
+		site = NULL;
+	sites[i].site = site;
+	sites[i].cnt++;
+	sites[i].bytes += bytes;
+}
+
+/* palloc_for_each_site() callback that adds a page held by SITE
+   to the usage table SITES_. */
+static void
+add_page_site (void *site, void *sites_) {
+	add_site (sites_, site, PGSIZE);
+}
+
+/* Prints the usage table SITES for WHAT, biggest first. */
+static void
+print_sites (const char *what, struct site_usage *sites) {
+	size_t i, j;
+
+	printf ("%s by allocation site:\n", what);
+	for (i = 0; i < SITE_MAX && sites[i].cnt > 0; i++) {
+		size_t max = i;
+
+		for (j = i + 1; j < SITE_MAX && sites[j].cnt > 0; j++)
+			if (sites[j].bytes > sites[max].bytes)
+				max = j;
+		if (max != i) {
+			struct site_usage tmp = sites[i];
+			sites[i] = sites[max];
+			sites[max] = tmp;
+		}
+
+		if (sites[i].site != NULL)
+			printf ("  %p: %zu held, %zu bytes\n",
+					sites[i].site, sites[i].cnt, sites[i].bytes);
+		else
+			printf ("  (other): %zu held, %zu bytes\n",
+					sites[i].cnt, sites[i].bytes);
+	}
 }
@@ -1,18 +1,64 @@
+#include <bitmap.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <string.h>
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/pte.h"
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/mmu.h"
 #include "intrinsic.h"
 
+/* Process-context identifiers.
+ *
+ * With CR4.PCIDE set, the TLB tags every translation with the PCID
+ * in the low 12 bits of CR3, and a CR3 write with CR3_NOFLUSH set
+ * keeps the translations of all PCIDs.  Each page map gets a PCID
+ * of its own in pml4_create(), so a process that is switched back
+ * in finds its translations still cached.
+ *
+ * The PCID is kept in the page map itself, in the software bits of
+ * the unused, not-present entry PCID_SLOT, next to PCID_STALE.
+ * That flag means the TLB may still hold translations for the PCID
+ * that are no longer valid, either because a destroyed page map
+ * used the PCID before, or because one of the page map's entries
+ * changed while it was not loaded and so could not be invlpg'd.
+ * A stale page map is loaded once with a flushing CR3 write.
+ * PCID 0 belongs to base_pml4, and to any page map created while
+ * all others are taken; loading it always flushes. */
+#define PCID_CNT 4096               /* Number of PCIDs. */
+#define PCID_SLOT 511               /* PML4 entry that holds the PCID. */
+#define PCID_SHIFT 12               /* First bit of the PCID in the slot. */
+#define PCID_STALE 0x2              /* Slot flag: flush on next load. */
+#define CR3_NOFLUSH (1ULL << 63)    /* Keep TLB entries on CR3 write. */
+#define CR4_PCIDE (1 << 17)         /* PCID enable. */
+#define CPUID_PCID (1 << 17)        /* CPUID.1:ECX PCID support. */
+
+static bool pcid_enabled;
+static struct bitmap *pcid_used;    /* PCIDs owned by a page map. */
+static struct bitmap *pcid_stale;   /* Free PCIDs with TLB leftovers. */
+static uint64_t pcid_used_buf[PCID_CNT / 64 + 2];
+static uint64_t pcid_stale_buf[PCID_CNT / 64 + 2];
+
+/* Statistics. */
+static long long cr3_load_cnt;      /* CR3 writes. */
+static long long cr3_noflush_cnt;   /* ...that kept the TLB. */
+static long long cr3_skip_cnt;      /* Switches to the loaded page map. */
+
+/* Returns the entry for VA in page directory PDP.  That is the
+ * PTE in the page table under it, or the page directory entry
+ * itself if it maps a 2 MB huge page: either way, the entry that
+ * holds VA's frame address and present, writable, accessed and
+ * dirty bits, which sit in the same place in both. */
 static uint64_t *
 pgdir_walk (uint64_t *pdp, const uint64_t va, int create) {
 	int idx = PDX (va);
 	if (pdp) {
 		uint64_t *pte = (uint64_t *) pdp[idx];
+		if ((uint64_t) pte & PTE_PS)
+			return &pdp[idx];
 		if (!((uint64_t) pte & PTE_P)) {
 			if (create) {
 				uint64_t *new_page = palloc_get_page (PAL_ZERO);
@@ -88,6 +134,104 @@ pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
 	return pte;
 }
 
+/* Returns the page directory entry for virtual address VA in
+ * PML4, for mapping a huge page there.  If the page directory
+ * does not exist, behavior depends on CREATE: if it is true, the
+ * missing tables are created, otherwise a null pointer is
+ * returned. */
+uint64_t *
+pml4e_walk_pde (uint64_t *pml4, const uint64_t va, int create) {
+	uint64_t *pdpe;
+
+	if (!(pml4[PML4 (va)] & PTE_P)) {
+		uint64_t *new_page;
+
+		if (!create || (new_page = palloc_get_page (PAL_ZERO)) == NULL)
+			return NULL;
+		pml4[PML4 (va)] = vtop (new_page) | PTE_U | PTE_W | PTE_P;
+	}
+	pdpe = ptov (PTE_ADDR (pml4[PML4 (va)]));
+
+	if (!(pdpe[PDPE (va)] & PTE_P)) {
+		uint64_t *new_page;
+
+		if (!create || (new_page = palloc_get_page (PAL_ZERO)) == NULL)
+			return NULL;
+		pdpe[PDPE (va)] = vtop (new_page) | PTE_U | PTE_W | PTE_P;
+	}
+	return (uint64_t *) ptov (PTE_ADDR (pdpe[PDPE (va)])) + PDX (va);
+}
+
+/* Turns on PCIDs if the CPU has them.  Called once, with
+ * base_pml4 built but not yet loaded. */
+void
+pml4_pcid_init (void) {
+	ASSERT (base_pml4[PCID_SLOT] == 0);
+
+	if (!(cpuid_ecx (1) & CPUID_PCID))
+		return;
+
+	pcid_used = bitmap_create_in_buf (PCID_CNT, pcid_used_buf,
+			sizeof pcid_used_buf);
+	pcid_stale = bitmap_create_in_buf (PCID_CNT, pcid_stale_buf,
+			sizeof pcid_stale_buf);
+	bitmap_mark (pcid_used, 0);
+
+	/* Setting PCIDE requires the current PCID to be 0, which it is
+	 * since nothing has put one in CR3 yet. */
+	lcr4 (rcr4 () | CR4_PCIDE);
+	pcid_enabled = true;
+}
+
+/* Gives PML4 a PCID of its own, if one is free. */
+static void
+pcid_assign (uint64_t *pml4) {
+	enum intr_level old_level;
+	size_t pcid;
+
+	if (!pcid_enabled)
+		return;
+
+	old_level = intr_disable ();
+	pcid = bitmap_scan_and_flip (pcid_used, 1, 1, false);
+	if (pcid != BITMAP_ERROR) {
+		pml4[PCID_SLOT] = (uint64_t) pcid << PCID_SHIFT;
+		if (bitmap_test (pcid_stale, pcid)) {
+			pml4[PCID_SLOT] |= PCID_STALE;
+			bitmap_reset (pcid_stale, pcid);
+		}
+	}
+	intr_set_level (old_level);
+}
+
+/* Returns PML4's PCID to the free set. */
+static void
+pcid_release (uint64_t *pml4) {
+	size_t pcid = pml4[PCID_SLOT] >> PCID_SHIFT;
+	enum intr_level old_level;
+
+	if (!pcid_enabled || pcid == 0)
+		return;
+
+	old_level = intr_disable ();
+	bitmap_reset (pcid_used, pcid);
+	bitmap_mark (pcid_stale, pcid);
+	intr_set_level (old_level);
+}
+
+/* Makes the TLB forget the translation of VA in PML4 after its
+ * entry changed.  Only the loaded page map can be invalidated page
+ * by page.  Any other one may still have translations cached under
+ * its PCID, so it is marked for a flush when next loaded.  Without
+ * PCIDs, loading it flushes anyway. */
+static void
+invalidate_page (uint64_t *pml4, const void *va) {
+	if (PTE_ADDR (rcr3 ()) == vtop (pml4))
+		invlpg ((uint64_t) va);
+	else if (pcid_enabled)
+		pml4[PCID_SLOT] |= PCID_STALE;
+}
+
 /* Creates a new page map level 4 (pml4) has mappings for kernel
  * virtual addresses, but none for user virtual addresses.
  * Returns the new page directory, or a null pointer if memory
@@ -95,8 +239,10 @@ pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
 uint64_t *
 pml4_create (void) {
 	uint64_t *pml4 = palloc_get_page (0);
-	if (pml4)
+	if (pml4) {
 		memcpy (pml4, base_pml4, PGSIZE);
+		pcid_assign (pml4);
+	}
 	return pml4;
 }
 
@@ -122,10 +268,18 @@ pgdir_for_each (uint64_t *pdp, pte_for_each_func *func, void *aux,
 		unsigned pml4_index, unsigned pdp_index) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pte) & PTE_P)
-			if (!pt_for_each ((uint64_t *) PTE_ADDR (pte), func, aux,
-					pml4_index, pdp_index, i))
+		if (!(((uint64_t) pte) & PTE_P))
+			continue;
+		if (is_huge_pte (&pdp[i])) {
+			/* A huge page: the PDE is its PTE. */
+			void *va = (void *) (((uint64_t) pml4_index << PML4SHIFT) |
+								 ((uint64_t) pdp_index << PDPESHIFT) |
+								 ((uint64_t) i << PDXSHIFT));
+			if (!func (&pdp[i], va, aux))
 				return false;
+		} else if (!pt_for_each ((uint64_t *) PTE_ADDR (pte), func, aux,
+					pml4_index, pdp_index, i))
+			return false;
 	}
 	return true;
 }
@@ -169,7 +323,11 @@ static void
 pgdir_destroy (uint64_t *pdp) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pte) & PTE_P)
+		if (!(((uint64_t) pte) & PTE_P))
+			continue;
+		if (is_huge_pte (&pdp[i]))
+			palloc_free_multiple ((void *) PTE_ADDR (pte), HPG_PAGE_CNT);
+		else
 			pt_destroy (PTE_ADDR (pte));
 	}
 	palloc_free_page ((void *) pdp);
@@ -196,14 +354,43 @@ pml4_destroy (uint64_t *pml4) {
 	uint64_t *pdpe = ptov ((uint64_t *) pml4[0]);
 	if (((uint64_t) pdpe) & PTE_P)
 		pdpe_destroy ((void *) PTE_ADDR (pdpe));
+	pcid_release (pml4);
 	palloc_free_page ((void *) pml4);
 }
 
 /* Loads page directory PD into the CPU's page directory base
- * register. */
+ * register.  Does nothing if it is loaded already.  With PCIDs, the
+ * TLB entries of other page maps survive the switch. */
 void
 pml4_activate (uint64_t *pml4) {
-	lcr3 (vtop (pml4 ? pml4 : base_pml4));
+	uint64_t *target = pml4 ? pml4 : base_pml4;
+	uint64_t cr3 = vtop (target);
+
+	if (PTE_ADDR (rcr3 ()) == cr3) {
+		cr3_skip_cnt++;
+		return;
+	}
+
+	if (pcid_enabled) {
+		uint64_t pcid = target[PCID_SLOT] >> PCID_SHIFT;
+
+		cr3 |= pcid;
+		if (pcid != 0 && !(target[PCID_SLOT] & PCID_STALE)) {
+			cr3 |= CR3_NOFLUSH;
+			cr3_noflush_cnt++;
+		}
+		target[PCID_SLOT] &= ~(uint64_t) PCID_STALE;
+	}
+	cr3_load_cnt++;
+	lcr3 (cr3);
+}
+
+/* Prints page map switching statistics. */
+void
+pml4_print_stats (void) {
+	printf ("Paging: PCIDs %s, %lld CR3 loads (%lld without flush), "
+			"%lld skipped\n", pcid_enabled ? "on" : "off", cr3_load_cnt,
+			cr3_noflush_cnt, cr3_skip_cnt);
 }
 
 /* Looks up the physical address that corresponds to user virtual
@@ -217,7 +404,8 @@ pml4_get_page (uint64_t *pml4, const void *uaddr) {
 	uint64_t *pte = pml4e_walk (pml4, (uint64_t) uaddr, 0);
 
 	if (pte && (*pte & PTE_P))
-		return ptov (PTE_ADDR (*pte)) + pg_ofs (uaddr);
+		return ptov (PTE_ADDR (*pte))
+			+ (is_huge_pte (pte) ? hpg_ofs (uaddr) : pg_ofs (uaddr));
 	return NULL;
 }
 
@@ -238,9 +426,34 @@ pml4_set_page (uint64_t *pml4, void *upage, void *kpage, bool rw) {
 
 	uint64_t *pte = pml4e_walk (pml4, (uint64_t) upage, 1);
 
-	if (pte)
-		*pte = vtop (kpage) | PTE_P | (rw ? PTE_W : 0) | PTE_U;
-	return pte != NULL;
+	/* UPAGE must not lie inside a huge page. */
+	if (pte == NULL || is_huge_pte (pte))
+		return false;
+	*pte = vtop (kpage) | PTE_P | (rw ? PTE_W : 0) | PTE_U;
+	return true;
+}
+
+/* Adds a mapping in PML4 from the 2 MB user virtual region
+ * starting at UPAGE to the physically contiguous frames starting
+ * at KPAGE, using a single huge page.  Both addresses must be 2 MB
+ * aligned, and KPAGE should come from palloc_get_huge_page().  The
+ * region must not already contain any mapping.  The other pml4_*
+ * functions work on any page inside a huge page and act on all of
+ * it.  Returns true if successful, false if memory allocation
+ * failed or the region is in use. */
+bool
+pml4_set_huge_page (uint64_t *pml4, void *upage, void *kpage, bool rw) {
+	ASSERT (hpg_ofs (upage) == 0);
+	ASSERT (hpg_ofs (kpage) == 0);
+	ASSERT (is_user_vaddr (upage));
+	ASSERT (pml4 != base_pml4);
+
+	uint64_t *pde = pml4e_walk_pde (pml4, (uint64_t) upage, 1);
+
+	if (pde == NULL || (*pde & (PTE_P | PTE_PS)))
+		return false;
+	*pde = vtop (kpage) | PTE_PS | PTE_P | (rw ? PTE_W : 0) | PTE_U;
+	return true;
 }
 
 /* Marks user virtual page UPAGE "not present" in page
@@ -257,8 +470,7 @@ pml4_clear_page (uint64_t *pml4, void *upage) {
 
 	if (pte != NULL && (*pte & PTE_P) != 0) {
 		*pte &= ~PTE_P;
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) upage);
+		invalidate_page (pml4, upage);
 	}
 }
 
@@ -281,10 +493,24 @@ pml4_set_dirty (uint64_t *pml4, const void *vpage, bool dirty) {
 		if (dirty)
 			*pte |= PTE_D;
 		else
-			*pte &= ~(uint32_t) PTE_D;
+			*pte &= ~(uint64_t) PTE_D;
+
+		invalidate_page (pml4, vpage);
+	}
+}
+
+/* Makes the mapping of virtual page VPAGE in PML4 writable if
+ * WRITABLE is true, read-only otherwise. */
+void
+pml4_set_writable (uint64_t *pml4, const void *vpage, bool writable) {
+	uint64_t *pte = pml4e_walk (pml4, (uint64_t) vpage, false);
+	if (pte) {
+		if (writable)
+			*pte |= PTE_W;
+		else
+			*pte &= ~(uint64_t) PTE_W;
 
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) vpage);
+		invalidate_page (pml4, vpage);
 	}
 }
 
@@ -307,9 +533,8 @@ pml4_set_accessed (uint64_t *pml4, const void *vpage, bool accessed) {
 		if (accessed)
 			*pte |= PTE_A;
 		else
-			*pte &= ~(uint32_t) PTE_A;
+			*pte &= ~(uint64_t) PTE_A;
 
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) vpage);
+		invalidate_page (pml4, vpage);
 	}
 }
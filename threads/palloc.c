@@ -2,14 +2,16 @@
 #include <bitmap.h>
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "intrinsic.h"
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/loader.h"
-#include "threads/synch.h"
 #include "threads/vaddr.h"
 
 /* Page allocator.  Hands out memory in page-size (or
@@ -24,24 +26,104 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+
+   Within a pool, free pages are managed by a binary buddy
+   allocator.  Free memory is kept as blocks of 2**K pages, for
+   "order" K, each starting at a page number that is a multiple
+   of its size, on one free list per order.  An allocation takes
+   the smallest block that fits, splitting larger blocks in half
+   as needed, and gives back the tail beyond the pages it asked
+   for.  Freeing a block merges it with its buddy, the other half
+   of the block of the next order, for as long as the buddy is
+   free too.  Both take O(log n) list operations.  Blocks are
+   aligned by kernel virtual page number.  KERN_BASE is a multiple
+   of 64 MB, so blocks up to order 14 are aligned physically as
+   well, which makes an order HPG_ORDER block a properly aligned
+   huge page; larger blocks need not be.  The free lists are
+   linked through an array with an element per page, rather than
+   through the free pages themselves, which need not be mapped
+   yet when the pools are set up.  The bitmap of used pages is
+   kept alongside for sanity checks.
+
+   Pages are freed from the scheduler with interrupts off, when a
+   dying thread's page is reclaimed, so a pool is protected by
+   disabling interrupts rather than by a lock.
+
+   Most callers want zeroed pages, and zeroing a page on the
+   allocating thread's critical path is the bulk of the cost of
+   allocating it.  So each pool also keeps a small stack of pages
+   that the idle thread has zeroed ahead of time (see
+   palloc_prezero()).  Pages on the stack count as allocated;
+   they go back to the free lists if the pool otherwise runs dry.
+   The stack is linked through the first word of each page,
+   which is cleared again when the page is handed out.
+
+   For leak hunting, the -mtrack option makes each pool record
+   the caller that allocated each of its pages, in one more
+   array with an element per page.  palloc_for_each_site() walks
+   it. */
+
+/* Largest block order, 1 GB. */
+#define MAX_ORDER 18
+
+/* Order of a huge page. */
+#define HPG_ORDER (HPGBITS - PGBITS)
+
+/* FREE_ORDER value of a page that does not start a free block. */
+#define NOT_FREE 0xff
 
 /* A memory pool. */
 struct pool {
-	struct lock lock;               /* Mutual exclusion. */
-	struct bitmap *used_map;        /* Bitmap of free pages. */
+	struct bitmap *used_map;        /* Bitmap of used pages. */
 	uint8_t *base;                  /* Base of pool. */
+	uint8_t *free_order;            /* Order of the free block starting at
+	                                   each page, or NOT_FREE. */
+	struct list_elem *free_elems;   /* Free list element of each page. */
+	struct list free_lists[MAX_ORDER + 1]; /* Free blocks, by order. */
+	size_t free_cnt;                /* Number of free pages. */
+	void **zeroed;                  /* Stack of pre-zeroed pages. */
+	size_t zeroed_cnt;              /* Number of pages in ZEROED. */
+	size_t page_cnt;                /* Number of usable pages. */
+	size_t peak_used;               /* Most pages ever in use. */
+	void **sites;                   /* Allocating caller of each page,
+	                                   with -mtrack. */
 };
 
+/* Maximum number of pre-zeroed pages kept per pool. */
+#define ZEROED_MAX 64
+
 /* Two pools: one for kernel data, one for user pages. */
 static struct pool kernel_pool, user_pool;
 
 /* Maximum number of pages to put in user pool. */
 size_t user_page_limit = SIZE_MAX;
+
+/* -mtrack: Record the caller of each page and malloc() block? */
+bool track_alloc_sites;
 static void
 init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end);
 
 static bool page_from_pool (const struct pool *, void *page);
+static void *get_pages (enum palloc_flags, size_t page_cnt, void *site);
+static void *alloc_pages (struct pool *, size_t page_cnt);
+static void *alloc_block (struct pool *, unsigned order);
+static void free_range (struct pool *, size_t page_idx, size_t page_cnt);
+static void free_block (struct pool *, size_t page_idx, unsigned order);
+static void print_pool_stats (const char *name, struct pool *);
+static void *pop_zeroed (struct pool *);
+static void push_zeroed (struct pool *, void *page);
+static size_t release_zeroed (struct pool *);
+static void count_zeroed (bool hit, uint64_t cycles);
+static size_t pool_used (const struct pool *);
+static void note_alloc (struct pool *, void *pages, size_t page_cnt,
+		void *site);
+
+/* Statistics for single zeroed pages. */
+static long long zero_hit_cnt;      /* Served from a pre-zeroed stack. */
+static long long zero_miss_cnt;     /* Zeroed on request. */
+static uint64_t zero_hit_cycles;    /* Time spent allocating hits. */
+static uint64_t zero_miss_cycles;   /* Time spent allocating misses. */
 
 /* multiboot info */
 struct multiboot_info {
@@ -223,15 +305,18 @@ split:
 			page_idx = pg_no (start) - pg_no (pool->base);
 			if ((uint64_t) pool_end < end) {
 				page_cnt = ((uint64_t) pool_end - start) / PGSIZE;
-				bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+				free_range (pool, page_idx, page_cnt);
 				start = (uint64_t) pool_end;
 				goto split;
 			} else {
 				page_cnt = ((uint64_t) end - start) / PGSIZE;
-				bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+				free_range (pool, page_idx, page_cnt);
 			}
 		}
 	}
+
+	kernel_pool.page_cnt = kernel_pool.free_cnt;
+	user_pool.page_cnt = user_pool.free_cnt;
 }
 
 /* Initializes the page allocator and get the memory size */
@@ -261,21 +346,53 @@ palloc_init (void) {
    FLAGS, in which case the kernel panics. */
 void *
 palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
-	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+	return get_pages (flags, page_cnt, __builtin_return_address (0));
+}
 
-	lock_acquire (&pool->lock);
-	size_t page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-	lock_release (&pool->lock);
+/* Obtains a single free page and returns its kernel virtual
+   address.
+   If PAL_USER is set, the page is obtained from the user pool,
+   otherwise from the kernel pool.  If PAL_ZERO is set in FLAGS,
+   then the page is filled with zeros.  If no pages are
+   available, returns a null pointer, unless PAL_ASSERT is set in
+   FLAGS, in which case the kernel panics. */
+void *
+palloc_get_page (enum palloc_flags flags) {
+	return get_pages (flags, 1, __builtin_return_address (0));
+}
+
+/* Does the work of palloc_get_multiple(), recording SITE as the
+   caller. */
+static void *
+get_pages (enum palloc_flags flags, size_t page_cnt, void *site) {
+	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+	bool zero_page = (flags & PAL_ZERO) && page_cnt == 1;
+	uint64_t start = zero_page ? rdtsc () : 0;
+	enum intr_level old_level;
 	void *pages;
 
-	if (page_idx != BITMAP_ERROR)
-		pages = pool->base + PGSIZE * page_idx;
-	else
-		pages = NULL;
+	if (zero_page) {
+		pages = pop_zeroed (pool);
+		if (pages != NULL) {
+			note_alloc (pool, pages, 1, site);
+			count_zeroed (true, rdtsc () - start);
+			return pages;
+		}
+	}
+
+	old_level = intr_disable ();
+	pages = alloc_pages (pool, page_cnt);
+	if (pages == NULL && release_zeroed (pool) > 0)
+		pages = alloc_pages (pool, page_cnt);
+	if (pages != NULL)
+		note_alloc (pool, pages, page_cnt, site);
+	intr_set_level (old_level);
 
 	if (pages) {
 		if (flags & PAL_ZERO)
 			memset (pages, 0, PGSIZE * page_cnt);
+		if (zero_page)
+			count_zeroed (false, rdtsc () - start);
 	} else {
 		if (flags & PAL_ASSERT)
 			PANIC ("palloc_get: out of pages");
@@ -284,16 +401,37 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
 	return pages;
 }
 
-/* Obtains a single free page and returns its kernel virtual
-   address.
-   If PAL_USER is set, the page is obtained from the user pool,
-   otherwise from the kernel pool.  If PAL_ZERO is set in FLAGS,
-   then the page is filled with zeros.  If no pages are
-   available, returns a null pointer, unless PAL_ASSERT is set in
-   FLAGS, in which case the kernel panics. */
+/* Obtains HPG_PAGE_CNT contiguous free pages that start on a
+   huge page boundary, for mapping with a single huge page, and
+   returns the kernel virtual address of the first one.  FLAGS
+   work as for palloc_get_multiple().  Free the pages with
+   palloc_free_multiple(). */
 void *
-palloc_get_page (enum palloc_flags flags) {
-	return palloc_get_multiple (flags, 1);
+palloc_get_huge_page (enum palloc_flags flags) {
+	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+	enum intr_level old_level;
+	void *pages;
+
+	/* Kernel virtual addresses and physical addresses differ by
+	   KERN_BASE, which is itself huge page aligned, so a block of
+	   HPG_ORDER is aligned both ways. */
+	old_level = intr_disable ();
+	pages = alloc_block (pool, HPG_ORDER);
+	if (pages == NULL && release_zeroed (pool) > 0)
+		pages = alloc_block (pool, HPG_ORDER);
+	if (pages != NULL)
+		note_alloc (pool, pages, HPG_PAGE_CNT, __builtin_return_address (0));
+	intr_set_level (old_level);
+
+	if (pages) {
+		if (flags & PAL_ZERO)
+			memset (pages, 0, HPGSIZE);
+	} else {
+		if (flags & PAL_ASSERT)
+			PANIC ("palloc_get_huge_page: out of pages");
+	}
+
+	return pages;
 }
 
 /* Frees the PAGE_CNT pages starting at PAGES. */
@@ -301,6 +439,7 @@ void
 palloc_free_multiple (void *pages, size_t page_cnt) {
 	struct pool *pool;
 	size_t page_idx;
+	enum intr_level old_level;
 
 	ASSERT (pg_ofs (pages) == 0);
 	if (pages == NULL || page_cnt == 0)
@@ -318,8 +457,12 @@ palloc_free_multiple (void *pages, size_t page_cnt) {
 #ifndef NDEBUG
 	memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
+	old_level = intr_disable ();
 	ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
-	bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+	if (pool->sites != NULL)
+		memset (pool->sites + page_idx, 0, page_cnt * sizeof *pool->sites);
+	free_range (pool, page_idx, page_cnt);
+	intr_set_level (old_level);
 }
 
 /* Frees the page at PAGE. */
@@ -328,6 +471,302 @@ palloc_free_page (void *page) {
 	palloc_free_multiple (page, 1);
 }
 
+/* Zeroes one free page and sets it aside for a later PAL_ZERO
+   request.  Called by the idle thread.  Returns true if a page
+   was zeroed, false if there was nothing to do. */
+bool
+palloc_prezero (void) {
+	struct pool *pools[] = { &user_pool, &kernel_pool };
+	size_t i;
+
+	for (i = 0; i < sizeof pools / sizeof *pools; i++) {
+		struct pool *pool = pools[i];
+		enum intr_level old_level;
+		void *page;
+
+		if (pool->zeroed_cnt >= ZEROED_MAX)
+			continue;
+		old_level = intr_disable ();
+		page = alloc_pages (pool, 1);
+		intr_set_level (old_level);
+		if (page == NULL)
+			continue;
+
+		memset (page, 0, PGSIZE);
+		push_zeroed (pool, page);
+		return true;
+	}
+	return false;
+}
+
+/* Stores the number of pages in use in the user pool, if PAL_USER
+   is set in FLAGS, or the kernel pool otherwise, into *USED, and
+   the most that have ever been in use into *PEAK.  Pages that the
+   idle thread has zeroed ahead of time count as free. */
+void
+palloc_usage (enum palloc_flags flags, size_t *used, size_t *peak) {
+	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+	enum intr_level old_level = intr_disable ();
+
+	*used = pool_used (pool);
+	*peak = pool->peak_used;
+	intr_set_level (old_level);
+}
+
+/* With -mtrack, calls SITE_FUNC once for each page in use, with
+   the return address of the call that allocated it and AUX.
+   Pages that were in use since before -mtrack took effect, e.g.
+   the kernel's page tables and the pools' own arrays, are not
+   visited.  The walk is not atomic, so the pools should be
+   quiet. */
+void
+palloc_for_each_site (void (*site_func) (void *site, void *aux),
+		void *aux) {
+	struct pool *pools[] = { &kernel_pool, &user_pool };
+	size_t i, page_idx;
+
+	for (i = 0; i < sizeof pools / sizeof *pools; i++) {
+		struct pool *pool = pools[i];
+
+		if (pool->sites == NULL)
+			continue;
+		for (page_idx = 0; page_idx < bitmap_size (pool->used_map); page_idx++)
+			if (pool->sites[page_idx] != NULL)
+				site_func (pool->sites[page_idx], aux);
+	}
+}
+
+/* Prints page allocator statistics. */
+void
+palloc_print_stats (void) {
+	long long zero_cnt = zero_hit_cnt + zero_miss_cnt;
+
+	print_pool_stats ("Kernel pool", &kernel_pool);
+	print_pool_stats ("User pool", &user_pool);
+	printf ("Zeroed pages: %lld allocated, %lld%% pre-zeroed, "
+			"%llu cycles per hit, %llu per miss\n",
+			zero_cnt, zero_cnt ? zero_hit_cnt * 100 / zero_cnt : 0,
+			zero_hit_cnt ? zero_hit_cycles / zero_hit_cnt : 0,
+			zero_miss_cnt ? zero_miss_cycles / zero_miss_cnt : 0);
+}
+
+/* Prints the free memory of POOL, labeled NAME.  Fragmentation
+   is the share of free pages outside the largest free block, so
+   0% means all free memory could be handed out in one piece. */
+static void
+print_pool_stats (const char *name, struct pool *pool) {
+	enum intr_level old_level = intr_disable ();
+	size_t block_cnt = 0, largest = 0, free_cnt = pool->free_cnt;
+	size_t used = pool_used (pool), peak = pool->peak_used;
+	unsigned order;
+
+	for (order = 0; order <= MAX_ORDER; order++)
+		if (!list_empty (&pool->free_lists[order])) {
+			block_cnt += list_size (&pool->free_lists[order]);
+			largest = (size_t) 1 << order;
+		}
+	intr_set_level (old_level);
+
+	printf ("%s: %zu of %zu pages used (peak %zu), %zu free in %zu blocks, "
+			"largest %zu pages, %zu%% fragmented\n", name, used,
+			pool->page_cnt, peak, free_cnt, block_cnt, largest,
+			free_cnt ? 100 - largest * 100 / free_cnt : 0);
+}
+
+/* Returns the number of pages in use in POOL, not counting the
+   pre-zeroed stack.  Interrupts must be off. */
+static size_t
+pool_used (const struct pool *pool) {
+	return pool->page_cnt - pool->free_cnt - pool->zeroed_cnt;
+}
+
+/* Records that PAGE_CNT pages starting at PAGES were handed out
+   of POOL to the caller at SITE. */
+static void
+note_alloc (struct pool *pool, void *pages, size_t page_cnt, void *site) {
+	enum intr_level old_level = intr_disable ();
+	size_t used = pool_used (pool);
+
+	if (used > pool->peak_used)
+		pool->peak_used = used;
+	if (pool->sites != NULL) {
+		size_t page_idx = pg_no (pages) - pg_no (pool->base);
+		size_t i;
+
+		for (i = 0; i < page_cnt; i++)
+			pool->sites[page_idx + i] = site;
+	}
+	intr_set_level (old_level);
+}
+
+/* Allocates PAGE_CNT contiguous pages from POOL and returns the
+   first one, or a null pointer if there is no large enough free
+   block.  Interrupts must be off. */
+static void *
+alloc_pages (struct pool *pool, size_t page_cnt) {
+	unsigned order;
+	uint8_t *pages;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	if (page_cnt == 0 || page_cnt > (size_t) 1 << MAX_ORDER)
+		return NULL;
+
+	/* Smallest order that holds PAGE_CNT pages. */
+	order = page_cnt == 1 ? 0 : 64 - __builtin_clzll (page_cnt - 1);
+	pages = alloc_block (pool, order);
+
+	/* Give back the tail of the block that was not asked for. */
+	if (pages != NULL && page_cnt < (size_t) 1 << order)
+		free_range (pool, pg_no (pages) - pg_no (pool->base) + page_cnt,
+				((size_t) 1 << order) - page_cnt);
+	return pages;
+}
+
+/* Takes a free block of ORDER out of POOL, splitting a larger
+   block if there is none, and returns its first page, or a null
+   pointer if POOL has no block of ORDER or larger.  Interrupts
+   must be off. */
+static void *
+alloc_block (struct pool *pool, unsigned order) {
+	struct list_elem *block;
+	size_t page_idx;
+	unsigned k;
+
+	for (k = order; k <= MAX_ORDER; k++)
+		if (!list_empty (&pool->free_lists[k]))
+			break;
+	if (k > MAX_ORDER)
+		return NULL;
+
+	block = list_pop_front (&pool->free_lists[k]);
+	page_idx = block - pool->free_elems;
+	ASSERT (pool->free_order[page_idx] == k);
+	pool->free_order[page_idx] = NOT_FREE;
+
+	/* Split off upper halves until the block is the right size. */
+	while (k > order) {
+		k--;
+		free_block (pool, page_idx + ((size_t) 1 << k), k);
+	}
+
+	pool->free_cnt -= (size_t) 1 << order;
+	bitmap_set_multiple (pool->used_map, page_idx, (size_t) 1 << order, true);
+	return pool->base + PGSIZE * page_idx;
+}
+
+/* Frees the PAGE_CNT pages of POOL starting at index PAGE_IDX,
+   which need not form a single block.  Interrupts must be off,
+   except while the pools are set up. */
+static void
+free_range (struct pool *pool, size_t page_idx, size_t page_cnt) {
+	pool->free_cnt += page_cnt;
+	bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+
+	/* Cut the range into the largest aligned blocks that fit. */
+	while (page_cnt > 0) {
+		uint64_t page_no = pg_no (pool->base) + page_idx;
+		unsigned order = 63 - __builtin_clzll (page_cnt);
+
+		if (page_no != 0 && (unsigned) __builtin_ctzll (page_no) < order)
+			order = __builtin_ctzll (page_no);
+		if (order > MAX_ORDER)
+			order = MAX_ORDER;
+
+		free_block (pool, page_idx, order);
+		page_idx += (size_t) 1 << order;
+		page_cnt -= (size_t) 1 << order;
+	}
+}
+
+/* Puts the free block of ORDER at index PAGE_IDX of POOL on its
+   free list, after merging it with its buddy for as long as the
+   buddy is free as well.  Does not update the page counts. */
+static void
+free_block (struct pool *pool, size_t page_idx, unsigned order) {
+	uint64_t base_no = pg_no (pool->base);
+	uint64_t page_no = base_no + page_idx;
+
+	while (order < MAX_ORDER) {
+		uint64_t buddy_no = page_no ^ ((uint64_t) 1 << order);
+		size_t buddy_idx = buddy_no - base_no;
+
+		if (buddy_no < base_no || buddy_idx >= bitmap_size (pool->used_map)
+				|| pool->free_order[buddy_idx] != order)
+			break;
+		list_remove (&pool->free_elems[buddy_idx]);
+		pool->free_order[buddy_idx] = NOT_FREE;
+		page_no &= ~((uint64_t) 1 << order);
+		order++;
+	}
+
+	page_idx = page_no - base_no;
+	pool->free_order[page_idx] = order;
+	list_push_front (&pool->free_lists[order], &pool->free_elems[page_idx]);
+}
+
+/* Pops a page off POOL's pre-zeroed stack and returns it, or a
+   null pointer if the stack is empty. */
+static void *
+pop_zeroed (struct pool *pool) {
+	enum intr_level old_level = intr_disable ();
+	void **page = pool->zeroed;
+
+	if (page != NULL) {
+		pool->zeroed = *page;
+		pool->zeroed_cnt--;
+	}
+	intr_set_level (old_level);
+
+	if (page != NULL)
+		*page = NULL;
+	return page;
+}
+
+/* Pushes zeroed PAGE onto POOL's pre-zeroed stack. */
+static void
+push_zeroed (struct pool *pool, void *page) {
+	enum intr_level old_level = intr_disable ();
+
+	*(void **) page = pool->zeroed;
+	pool->zeroed = page;
+	pool->zeroed_cnt++;
+	intr_set_level (old_level);
+}
+
+/* Returns every page on POOL's pre-zeroed stack to its free
+   lists, and returns the number of pages released.  Interrupts
+   must be off. */
+static size_t
+release_zeroed (struct pool *pool) {
+	size_t cnt = 0;
+	void *page;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	while ((page = pop_zeroed (pool)) != NULL) {
+		free_range (pool, pg_no (page) - pg_no (pool->base), 1);
+		cnt++;
+	}
+	return cnt;
+}
+
+/* Records a zeroed single-page allocation that took CYCLES and
+   was served from a pre-zeroed stack if HIT is true. */
+static void
+count_zeroed (bool hit, uint64_t cycles) {
+	enum intr_level old_level = intr_disable ();
+
+	if (hit) {
+		zero_hit_cnt++;
+		zero_hit_cycles += cycles;
+	} else {
+		zero_miss_cnt++;
+		zero_miss_cycles += cycles;
+	}
+	intr_set_level (old_level);
+}
+
 /* Initializes pool P as starting at START and ending at END */
 static void
 init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end) {
@@ -336,15 +775,35 @@ init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end) {
      and subtract it from the pool's size. */
 	uint64_t pgcnt = (end - start) / PGSIZE;
 	size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (pgcnt), PGSIZE) * PGSIZE;
+	size_t order_pages = DIV_ROUND_UP (pgcnt, PGSIZE) * PGSIZE;
+	size_t elem_pages = DIV_ROUND_UP (pgcnt * sizeof (struct list_elem),
+			PGSIZE) * PGSIZE;
+	size_t site_pages = track_alloc_sites
+		? DIV_ROUND_UP (pgcnt * sizeof (void *), PGSIZE) * PGSIZE : 0;
+	unsigned order;
 
-	lock_init(&p->lock);
 	p->used_map = bitmap_create_in_buf (pgcnt, *bm_base, bm_pages);
 	p->base = (void *) start;
+	p->free_order = *bm_base + bm_pages;
+	p->free_elems = *bm_base + bm_pages + order_pages;
+	for (order = 0; order <= MAX_ORDER; order++)
+		list_init (&p->free_lists[order]);
+	p->free_cnt = 0;
+	p->zeroed = NULL;
+	p->zeroed_cnt = 0;
+	p->page_cnt = 0;
+	p->peak_used = 0;
+	p->sites = NULL;
+	if (track_alloc_sites) {
+		p->sites = *bm_base + bm_pages + order_pages + elem_pages;
+		memset (p->sites, 0, site_pages);
+	}
 
 	// Mark all to unusable.
 	bitmap_set_all(p->used_map, true);
+	memset (p->free_order, NOT_FREE, pgcnt);
 
-	*bm_base += bm_pages;
+	*bm_base += bm_pages + order_pages + elem_pages + site_pages;
 }
 
 /* Returns true if PAGE was allocated from POOL,
@@ -0,0 +1,403 @@
+#include "threads/slab.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Slab allocator.
+
+   A cache hands out objects of one exact size.  It carves pages
+   called "slabs" into as many objects as fit after a small
+   header, and keeps its slabs on three lists: partial (some
+   objects free), full and empty.  Objects come from a partial
+   slab if there is one, so that empty slabs stay empty and can
+   be given back to the page allocator.  An empty slab is not
+   given back right away, though: each cache keeps up to
+   EMPTY_MAX of them, so that a loop that allocates and frees
+   one object does not get and free a page every time.
+
+   In front of the slabs sits a magazine, a small stack of free
+   objects that is only touched with interrupts disabled.  Since
+   there is just one CPU, that makes it this CPU's private
+   cache, and allocation and free take no lock as long as the
+   magazine is neither empty nor full.  Otherwise they move half
+   a magazine's worth of objects from or to the slabs at once,
+   under the cache's lock.
+
+   The header at the start of each slab page lets
+   kmem_cache_of() find the cache that any object came from,
+   which is how free() tells slab objects from big blocks. */
+
+/* Magic number for detecting slab corruption. */
+#define SLAB_MAGIC 0x51ab0b1e
+
+/* Number of objects a magazine holds. */
+#define MAG_SIZE 16
+
+/* Number of empty slabs a cache holds on to. */
+#define EMPTY_MAX 1
+
+/* Maximum number of caches. */
+#define CACHE_MAX 32
+
+/* Objects are aligned to this many bytes. */
+#define OBJ_ALIGN 8
+
+/* A cache of objects of one size. */
+struct kmem_cache {
+	char name[16];              /* Name, for statistics. */
+	size_t obj_size;            /* Object size, rounded up to OBJ_ALIGN. */
+	size_t objs_per_slab;       /* Number of objects in a slab. */
+
+	/* Protected by LOCK. */
+	struct lock lock;           /* Protects the slab lists. */
+	struct list partial;        /* Slabs with free and used objects. */
+	struct list full;           /* Slabs without free objects. */
+	struct list empty;          /* Slabs without used objects. */
+	size_t empty_cnt;           /* Number of slabs in EMPTY. */
+	size_t slab_cnt;            /* Number of slabs. */
+	long long grow_cnt;         /* Slabs allocated. */
+	long long reap_cnt;         /* Slabs given back. */
+
+	/* Protected by disabling interrupts. */
+	void *mag[MAG_SIZE];        /* Free objects. */
+	size_t mag_cnt;             /* Number of objects in MAG. */
+	long long alloc_cnt;        /* Objects allocated. */
+	long long free_cnt;         /* Objects freed. */
+	long long mag_hit_cnt;      /* Allocations served from MAG. */
+	long long peak_cnt;         /* Most objects ever in use. */
+};
+
+/* Header at the start of a slab page. */
+struct slab {
+	unsigned magic;             /* Always set to SLAB_MAGIC. */
+	struct kmem_cache *cache;   /* Owning cache. */
+	struct list_elem elem;      /* Element in one of the cache's lists. */
+	size_t used_cnt;            /* Objects not on FREE. */
+	void *free;                 /* Free objects, linked by first word. */
+};
+
+/* Offset of the first object in a slab. */
+#define SLAB_HDR_SIZE ROUND_UP (sizeof (struct slab), OBJ_ALIGN)
+
+/* All the caches. */
+static struct kmem_cache caches[CACHE_MAX];
+static size_t cache_cnt;
+
+static size_t fill (struct kmem_cache *, void **objs, size_t cnt);
+static void drain (struct kmem_cache *, void **objs, size_t cnt);
+static struct slab *slab_of (const void *);
+static void count_alloc (struct kmem_cache *);
+
+/* Creates and returns a cache of objects of SIZE bytes, called
+   NAME.  SIZE must leave room for at least two objects in a
+   slab.  Panics if there are too many caches. */
+struct kmem_cache *
+kmem_cache_create (const char *name, size_t size) {
+	struct kmem_cache *c;
+	enum intr_level old_level;
+
+	ASSERT (size > 0);
+	size = ROUND_UP (size, OBJ_ALIGN);
+	ASSERT (SLAB_HDR_SIZE + 2 * size <= PGSIZE);
+
+	old_level = intr_disable ();
+	if (cache_cnt >= CACHE_MAX)
+		PANIC ("kmem_cache_create: too many caches");
+	c = &caches[cache_cnt++];
+	intr_set_level (old_level);
+
+	strlcpy (c->name, name, sizeof c->name);
+	c->obj_size = size;
+	c->objs_per_slab = (PGSIZE - SLAB_HDR_SIZE) / size;
+	lock_init (&c->lock);
+	list_init (&c->partial);
+	list_init (&c->full);
+	list_init (&c->empty);
+	return c;
+}
+
+/* Obtains and returns a new object from cache C, or a null
+   pointer if memory is not available. */
+void *
+kmem_cache_alloc (struct kmem_cache *c) {
+	void *batch[MAG_SIZE / 2];
+	enum intr_level old_level;
+	void *obj = NULL;
+	size_t cnt;
+
+	old_level = intr_disable ();
+	if (c->mag_cnt > 0) {
+		obj = c->mag[--c->mag_cnt];
+		count_alloc (c);
+		c->mag_hit_cnt++;
+	}
+	intr_set_level (old_level);
+	if (obj != NULL)
+		return obj;
+
+	/* The magazine is empty.  Refill half of it from the slabs,
+	   keeping one object for ourselves. */
+	cnt = fill (c, batch, MAG_SIZE / 2);
+	if (cnt == 0)
+		return NULL;
+	obj = batch[--cnt];
+
+	old_level = intr_disable ();
+	count_alloc (c);
+	while (cnt > 0 && c->mag_cnt < MAG_SIZE)
+		c->mag[c->mag_cnt++] = batch[--cnt];
+	intr_set_level (old_level);
+
+	/* Another thread refilled the magazine meanwhile. */
+	if (cnt > 0)
+		drain (c, batch, cnt);
+	return obj;
+}
+
+/* Like kmem_cache_alloc(), but zeroes the object. */
+void *
+kmem_cache_zalloc (struct kmem_cache *c) {
+	void *obj = kmem_cache_alloc (c);
+
+	if (obj != NULL)
+		memset (obj, 0, c->obj_size);
+	return obj;
+}
+
+/* Frees OBJ, which must have been allocated from cache C.  Does
+   nothing if OBJ is a null pointer. */
+void
+kmem_cache_free (struct kmem_cache *c, void *obj) {
+	void *batch[MAG_SIZE / 2];
+	enum intr_level old_level;
+	size_t cnt = 0;
+
+	if (obj == NULL)
+		return;
+	ASSERT (slab_of (obj)->cache == c);
+
+#ifndef NDEBUG
+	/* Clear the object to help detect use-after-free bugs. */
+	memset (obj, 0xcc, c->obj_size);
+#endif
+
+	old_level = intr_disable ();
+	c->free_cnt++;
+	if (c->mag_cnt == MAG_SIZE) {
+		/* The magazine is full.  Move its older half back to the
+		   slabs. */
+		cnt = MAG_SIZE / 2;
+		memcpy (batch, c->mag, sizeof batch);
+		memmove (c->mag, c->mag + cnt, (MAG_SIZE - cnt) * sizeof *c->mag);
+		c->mag_cnt -= cnt;
+	}
+	c->mag[c->mag_cnt++] = obj;
+	intr_set_level (old_level);
+
+	if (cnt > 0)
+		drain (c, batch, cnt);
+}
+
+/* Returns the cache that OBJ was allocated from, or a null
+   pointer if OBJ is not in a slab. */
+struct kmem_cache *
+kmem_cache_of (const void *obj) {
+	const struct slab *s = pg_round_down (obj);
+
+	return s->magic == SLAB_MAGIC ? s->cache : NULL;
+}
+
+/* Returns the size of C's objects, which may be a little larger
+   than the size it was created with. */
+size_t
+kmem_cache_size (const struct kmem_cache *c) {
+	return c->obj_size;
+}
+
+/* Gives every cache's magazine back to its slabs, and every
+   empty slab back to the page allocator, for use when memory
+   runs short.  Returns the number of pages freed. */
+size_t
+kmem_cache_reap (void) {
+	size_t i, page_cnt = 0;
+
+	for (i = 0; i < cache_cnt; i++) {
+		struct kmem_cache *c = &caches[i];
+		void *batch[MAG_SIZE];
+		enum intr_level old_level;
+		size_t cnt;
+
+		old_level = intr_disable ();
+		cnt = c->mag_cnt;
+		memcpy (batch, c->mag, cnt * sizeof *c->mag);
+		c->mag_cnt = 0;
+		intr_set_level (old_level);
+		if (cnt > 0)
+			drain (c, batch, cnt);
+
+		lock_acquire (&c->lock);
+		while (!list_empty (&c->empty)) {
+			struct slab *s = list_entry (list_pop_front (&c->empty),
+					struct slab, elem);
+
+			s->magic = 0;
+			palloc_free_page (s);
+			c->empty_cnt--;
+			c->slab_cnt--;
+			c->reap_cnt++;
+			page_cnt++;
+		}
+		lock_release (&c->lock);
+	}
+	return page_cnt;
+}
+
+/* Prints statistics for each cache that has been used. */
+void
+kmem_print_stats (void) {
+	size_t i;
+
+	for (i = 0; i < cache_cnt; i++) {
+		struct kmem_cache *c = &caches[i];
+		long long in_use;
+
+		if (c->alloc_cnt == 0)
+			continue;
+		in_use = c->alloc_cnt - c->free_cnt;
+		printf ("Slab %s: %zu-byte objects, %lld in use (peak %lld), "
+				"%zu slabs (%zu empty), %lld allocs (%lld%% from magazine), "
+				"%lld slabs grown, %lld reaped, %lld%% utilized\n",
+				c->name, c->obj_size, in_use, c->peak_cnt,
+				c->slab_cnt, c->empty_cnt,
+				c->alloc_cnt, c->mag_hit_cnt * 100 / c->alloc_cnt,
+				c->grow_cnt, c->reap_cnt,
+				c->slab_cnt ? in_use * 100 / (long long) (c->slab_cnt
+					* c->objs_per_slab) : 0);
+	}
+}
+
+/* Takes up to CNT free objects out of C's slabs, allocating a new
+   slab if none has any, and stores them in OBJS.  Returns the
+   number of objects stored, which is 0 only if memory is not
+   available. */
+static size_t
+fill (struct kmem_cache *c, void **objs, size_t cnt) {
+	size_t n = 0;
+
+	lock_acquire (&c->lock);
+	while (n < cnt) {
+		struct slab *s;
+
+		if (!list_empty (&c->partial))
+			s = list_entry (list_front (&c->partial), struct slab, elem);
+		else if (!list_empty (&c->empty)) {
+			s = list_entry (list_pop_front (&c->empty), struct slab, elem);
+			c->empty_cnt--;
+			list_push_front (&c->partial, &s->elem);
+		} else {
+			/* Grow the cache by a slab. */
+			uint8_t *obj;
+			size_t i;
+
+			s = palloc_get_page (0);
+			if (s == NULL)
+				break;
+			s->magic = SLAB_MAGIC;
+			s->cache = c;
+			s->used_cnt = 0;
+			s->free = NULL;
+			obj = (uint8_t *) s + SLAB_HDR_SIZE;
+			for (i = 0; i < c->objs_per_slab; i++, obj += c->obj_size) {
+				*(void **) obj = s->free;
+				s->free = obj;
+			}
+			list_push_front (&c->partial, &s->elem);
+			c->slab_cnt++;
+			c->grow_cnt++;
+		}
+
+		/* Take objects from S until it runs out. */
+		while (n < cnt && s->free != NULL) {
+			objs[n] = s->free;
+			s->free = *(void **) objs[n];
+			s->used_cnt++;
+			n++;
+		}
+		if (s->free == NULL) {
+			list_remove (&s->elem);
+			list_push_back (&c->full, &s->elem);
+		}
+	}
+	lock_release (&c->lock);
+	return n;
+}
+
+/* Returns the CNT objects in OBJS to their slabs in C.  A slab
+   that becomes empty is kept for reuse if C has fewer than
+   EMPTY_MAX empty slabs, and given back to the page allocator
+   otherwise. */
+static void
+drain (struct kmem_cache *c, void **objs, size_t cnt) {
+	size_t i;
+
+	lock_acquire (&c->lock);
+	for (i = 0; i < cnt; i++) {
+		struct slab *s = slab_of (objs[i]);
+
+		ASSERT (s->cache == c);
+		ASSERT (s->used_cnt > 0);
+		if (s->free == NULL) {
+			/* Full slab gets a free object. */
+			list_remove (&s->elem);
+			list_push_front (&c->partial, &s->elem);
+		}
+		*(void **) objs[i] = s->free;
+		s->free = objs[i];
+
+		if (--s->used_cnt == 0) {
+			list_remove (&s->elem);
+			if (c->empty_cnt < EMPTY_MAX) {
+				list_push_front (&c->empty, &s->elem);
+				c->empty_cnt++;
+			} else {
+				s->magic = 0;
+				palloc_free_page (s);
+				c->slab_cnt--;
+				c->reap_cnt++;
+			}
+		}
+	}
+	lock_release (&c->lock);
+}
+
+/* Counts an allocation from C.  Interrupts must be off. */
+static void
+count_alloc (struct kmem_cache *c) {
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	c->alloc_cnt++;
+	if (c->alloc_cnt - c->free_cnt > c->peak_cnt)
+		c->peak_cnt = c->alloc_cnt - c->free_cnt;
+}
+
+/* Returns the slab that OBJ is inside. */
+static struct slab *
+slab_of (const void *obj) {
+	struct slab *s = pg_round_down (obj);
+
+	/* Check that the slab is valid. */
+	ASSERT (s->magic == SLAB_MAGIC);
+
+	/* Check that the object is properly aligned for the slab. */
+	ASSERT (pg_ofs (obj) >= SLAB_HDR_SIZE);
+	ASSERT ((pg_ofs (obj) - SLAB_HDR_SIZE) % s->cache->obj_size == 0);
+
+	return s;
+}
@@ -356,3 +356,75 @@ cond_broadcast (struct condition *cond, struct lock *lock) {
 	while (!list_empty (&cond->waiters))
 		cond_signal (cond, lock);
 }
+
+/* Initializes RW as a readers-writer lock, which any number of
+   threads may hold for reading at once, or one thread for
+   writing.
+
+   Readers get in whenever no thread is writing, even if a writer
+   is waiting.  That way a thread that already holds RW for
+   reading may acquire it for reading again, as happens when a
+   page fault taken while reading a file reads the same file; the
+   price is that a steady stream of readers can starve writers. */
+void
+rwlock_init (struct rwlock *rw) {
+	ASSERT (rw != NULL);
+
+	lock_init (&rw->lock);
+	cond_init (&rw->changed);
+	rw->reader_cnt = 0;
+	rw->writer = NULL;
+}
+
+/* Acquires RW for reading, sleeping until no thread writes. */
+void
+rwlock_acquire_read (struct rwlock *rw) {
+	ASSERT (rw != NULL);
+	ASSERT (!intr_context ());
+	ASSERT (rw->writer != thread_current ());
+
+	lock_acquire (&rw->lock);
+	while (rw->writer != NULL)
+		cond_wait (&rw->changed, &rw->lock);
+	rw->reader_cnt++;
+	lock_release (&rw->lock);
+}
+
+/* Releases RW, which the current thread holds for reading. */
+void
+rwlock_release_read (struct rwlock *rw) {
+	ASSERT (rw != NULL);
+
+	lock_acquire (&rw->lock);
+	ASSERT (rw->reader_cnt > 0);
+	if (--rw->reader_cnt == 0)
+		cond_broadcast (&rw->changed, &rw->lock);
+	lock_release (&rw->lock);
+}
+
+/* Acquires RW for writing, sleeping until no other thread reads
+   or writes. */
+void
+rwlock_acquire_write (struct rwlock *rw) {
+	ASSERT (rw != NULL);
+	ASSERT (!intr_context ());
+	ASSERT (rw->writer != thread_current ());
+
+	lock_acquire (&rw->lock);
+	while (rw->writer != NULL || rw->reader_cnt > 0)
+		cond_wait (&rw->changed, &rw->lock);
+	rw->writer = thread_current ();
+	lock_release (&rw->lock);
+}
+
+/* Releases RW, which the current thread holds for writing. */
+void
+rwlock_release_write (struct rwlock *rw) {
+	ASSERT (rw != NULL);
+
+	lock_acquire (&rw->lock);
+	ASSERT (rw->writer == thread_current ());
+	rw->writer = NULL;
+	cond_broadcast (&rw->changed, &rw->lock);
+	lock_release (&rw->lock);
+}
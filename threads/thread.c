@@ -4,6 +4,7 @@
 #include <random.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/arena.h"
 #include "threads/flags.h"
 #include "threads/interrupt.h"
 #include "threads/intr-stubs.h"
@@ -29,6 +30,10 @@
 static struct list ready_list;
 static struct list sleep_list; // sleep list 생성 (sleep queue)
 
+/* List of all threads.  Threads are added to this list when
+   they are created and removed when they exit. */
+static struct list all_list;
+
 /* Idle thread. */
 static struct thread *idle_thread;
 
@@ -112,6 +117,7 @@ thread_init (void) {
 	list_init (&ready_list);
 	list_init (&sleep_list);
 	list_init (&destruction_req);
+	list_init (&all_list);
 
 	/* Set up a thread structure for the running thread. */
 	initial_thread = running_thread ();
@@ -294,6 +300,21 @@ thread_tid (void) {
 	return thread_current ()->tid;
 }
 
+/* Invoke function 'func' on all threads, passing along 'aux'.
+   This function must be called with interrupts off. */
+void
+thread_foreach (thread_action_func *func, void *aux) {
+	struct list_elem *e;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	for (e = list_begin (&all_list); e != list_end (&all_list);
+			e = list_next (e)) {
+		struct thread *t = list_entry (e, struct thread, allelem);
+		func (t, aux);
+	}
+}
+
 /* Deschedules the current thread and destroys it.  Never
    returns to the caller. */
 void
@@ -301,17 +322,24 @@ thread_exit (void) {
 	ASSERT (!intr_context ());
 
 #ifdef USERPROG
+	/* Release the process's memory before waiting for the parent
+	   to collect the exit status, so that a process that is never
+	   waited for, e.g. one killed by the OOM killer, does not keep
+	   it. */
+	process_exit ();
 	sema_up(&thread_current()->sema_wait);
 	sema_down(&thread_current()->sema_exit);
 	// 자식 프로세스 디스크립터 삭제
 	list_remove(&thread_current()->child_elem);
 	thread_current()->is_exit = 1;
-	process_exit ();
 #endif
+	arena_destroy ();
 
-	/* Just set our status to dying and schedule another process.
-	   We will be destroyed during the call to schedule_tail(). */
+	/* Leave the list of all threads, set our status to dying and
+	   schedule another process.  We will be destroyed during the
+	   call to schedule_tail(). */
 	intr_disable ();
+	list_remove (&thread_current ()->allelem);
 	do_schedule (THREAD_DYING);
 	NOT_REACHED ();
 }
@@ -523,6 +551,17 @@ idle (void *idle_started_ UNUSED) {
 		intr_disable ();
 		thread_block ();
 
+		/* Nothing else is ready, so spend the time zeroing free
+		   pages for later PAL_ZERO allocations.  Interrupts stay on
+		   while we do, and we stop as soon as a thread becomes
+		   ready; one page takes only a few microseconds. */
+		intr_enable ();
+		while (list_empty (&ready_list) && palloc_prezero ())
+			continue;
+		intr_disable ();
+		if (!list_empty (&ready_list))
+			continue;
+
 		/* Re-enable interrupts and wait for the next one.
 
 		   The `sti' instruction disables interrupts until the
@@ -554,6 +593,8 @@ kernel_thread (thread_func *function, void *aux) {
    NAME. */
 static void
 init_thread (struct thread *t, const char *name, int priority) {
+	enum intr_level old_level;
+
 	ASSERT (t != NULL);
 	ASSERT (PRI_MIN <= priority && priority <= PRI_MAX);
 	ASSERT (name != NULL);
@@ -568,6 +609,10 @@ init_thread (struct thread *t, const char *name, int priority) {
 	list_init(&t->donations);
 	list_init(&t->child_list);
 	t->magic = THREAD_MAGIC;
+
+	old_level = intr_disable ();
+	list_push_back (&all_list, &t->allelem);
+	intr_set_level (old_level);
 }
 
 /* Chooses and returns the next thread to be scheduled.  Should
@@ -5,6 +5,7 @@
 #include "userprog/syscall.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
 #include "intrinsic.h"
 
 /* Number of page faults processed. */
@@ -144,10 +145,18 @@ page_fault (struct intr_frame *f) {
 	write = (f->error_code & PF_W) != 0;
 	user = (f->error_code & PF_U) != 0;
 
+	/* A process chosen by the OOM killer gets no more memory. */
+	if (user && thread_current ()->killed)
+		thread_exit ();
+
 #ifdef VM
 	/* For project 3 and later. */
 	if (vm_try_handle_fault (f, fault_addr, user, write, not_present))
 		return;
+
+	/* A bad user pointer handed to a system call. */
+	if (!user && is_user_vaddr (fault_addr))
+		exit (-1);
 #endif
 
 	/* Count page faults. */
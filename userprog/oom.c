@@ -0,0 +1,173 @@
+#include "userprog/oom.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "threads/interrupt.h"
+#include "threads/mmu.h"
+#include "threads/slab.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#ifdef VM
+#include "vm/vm.h"
+#endif
+
+/* Allocation with reclaim under memory pressure.
+
+   Callers that would otherwise fail as soon as palloc_get_page()
+   comes back empty go through oom_get_page() instead, which
+   tries, in order:
+
+     1. Eviction: with virtual memory, write a frame out to swap
+        or its file and give its page back to the user pool.
+
+     2. Cache shrinking: give the slab allocator's magazines and
+        empty slabs back to the kernel pool.
+
+     3. Killing a process: mark the user process holding the most
+        pages (the one of lowest priority, among equals) to exit
+        with status -1, and wait for it to release its memory.
+
+   A killed process notices the mark the next time it makes a
+   system call or takes a page fault, or on the next timer
+   interrupt if it just spins in user mode.  Only one victim is
+   outstanding at a time: while a killed process still holds its
+   address space, allocators wait for it instead of picking
+   another. */
+
+/* Time to wait for a victim to exit, per try, and number of
+   tries before giving up. */
+#define OOM_WAIT_MS 10
+#define OOM_TRIES 200
+
+/* Statistics. */
+static long long evict_cnt;     /* Pages freed by eviction. */
+static long long reap_cnt;      /* Pages freed by shrinking caches. */
+static long long kill_cnt;      /* Processes killed. */
+static long long fail_cnt;      /* Allocations that failed anyway. */
+
+static bool reclaim (enum palloc_flags);
+static bool kill_process (void);
+
+/* Obtains a single free page from the pool selected by FLAGS, as
+   palloc_get_page() does, reclaiming memory and killing processes
+   if necessary.  Returns a null pointer only if no page turns up
+   even so, or if the current process was chosen to die. */
+void *
+oom_get_page (enum palloc_flags flags) {
+	int tries;
+
+	for (tries = 0; tries < OOM_TRIES; tries++) {
+		void *page = palloc_get_page (flags);
+
+		if (page != NULL)
+			return page;
+		if (reclaim (flags))
+			continue;
+		if (!kill_process ())
+			break;
+		timer_msleep (OOM_WAIT_MS);
+	}
+	fail_cnt++;
+	return NULL;
+}
+
+/* Prints OOM statistics. */
+void
+oom_print_stats (void) {
+	printf ("OOM: %lld pages evicted, %lld pages reaped, "
+			"%lld processes killed, %lld allocations failed\n",
+			evict_cnt, reap_cnt, kill_cnt, fail_cnt);
+}
+
+/* Tries to free a page for the pool selected by FLAGS without
+   killing anything.  Returns true if successful. */
+static bool
+reclaim (enum palloc_flags flags) {
+#ifdef VM
+	if ((flags & PAL_USER) && vm_reclaim ()) {
+		evict_cnt++;
+		return true;
+	}
+#endif
+	if (!(flags & PAL_USER)) {
+		size_t page_cnt = kmem_cache_reap ();
+
+		reap_cnt += page_cnt;
+		if (page_cnt > 0)
+			return true;
+	}
+	return false;
+}
+
+/* Victim selection state for kill_process(). */
+struct oom_scan {
+	struct thread *victim;      /* Largest process so far. */
+	size_t victim_pages;        /* Pages it holds. */
+	bool pending;               /* A killed process is still exiting? */
+};
+
+static bool
+count_page (uint64_t *pte UNUSED, void *va, void *aux) {
+	if (is_user_vaddr (va))
+		++*(size_t *) aux;
+	return true;
+}
+
+/* Considers T as a victim for kill_process().  A process that
+   was killed but still has its address space counts as pending. */
+static void
+scan_thread (struct thread *t, void *scan_) {
+	struct oom_scan *scan = scan_;
+	size_t page_cnt = 0;
+
+	if (t->pml4 == NULL)
+		return;
+	if (t->killed) {
+		scan->pending = true;
+		return;
+	}
+
+	pml4_for_each (t->pml4, count_page, &page_cnt);
+	if (scan->victim == NULL || page_cnt > scan->victim_pages
+			|| (page_cnt == scan->victim_pages
+				&& t->priority < scan->victim->priority)) {
+		scan->victim = t;
+		scan->victim_pages = page_cnt;
+	}
+}
+
+/* Marks the user process that holds the most pages to exit, unless
+   a process killed earlier is still exiting.  Returns true if the
+   caller should wait for memory to be freed, false if there is
+   nothing to wait for, because the current process is the one to
+   die or there is no process to kill. */
+static bool
+kill_process (void) {
+	struct oom_scan scan = { NULL, 0, false };
+	enum intr_level old_level;
+	char name[sizeof scan.victim->name];
+	tid_t tid;
+
+	old_level = intr_disable ();
+	thread_foreach (scan_thread, &scan);
+	if (!scan.pending && scan.victim != NULL) {
+		/* The victim may be gone as soon as interrupts are back
+		 * on, so take what the message needs now. */
+		scan.victim->killed = true;
+		scan.victim->exit_status = -1;
+		strlcpy (name, scan.victim->name, sizeof name);
+		tid = scan.victim->tid;
+	}
+	intr_set_level (old_level);
+
+	if (scan.pending)
+		return !thread_current ()->killed;
+	if (scan.victim == NULL)
+		return false;
+
+	kill_cnt++;
+	printf ("oom: killed %s (tid %d), which held %zu pages\n",
+			name, tid, scan.victim_pages);
+	return scan.victim != thread_current ();
+}
@@ -6,13 +6,18 @@
 #include <stdlib.h>
 #include <string.h>
 #include "userprog/gdt.h"
+#include "userprog/oom.h"
 #include "userprog/tss.h"
+#include "userprog/text-cache.h"
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/inode.h"
+#include "threads/arena.h"
 #include "threads/flags.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/mmu.h"
@@ -23,6 +28,9 @@
 #include "vm/vm.h"
 #endif
 
+/* -hugepages: Back large writable segments with huge pages? */
+bool user_huge_pages;
+
 static void process_cleanup (void);
 static bool load (const char *file_name, struct intr_frame *if_);
 static void initd (void *f_name);
@@ -64,13 +72,22 @@ process_create_initd (const char *file_name) {
 
 /* A thread function that launches first user process. */
 static void
-initd (void *f_name) {
+initd (void *fn_copy) {
+	char *f_name;
+
 #ifdef VM
 	supplemental_page_table_init (&thread_current ()->spt);
 #endif
 
 	process_init ();
 
+	/* process_exec() wants a command line that it need not free. */
+	f_name = arena_alloc (strlen (fn_copy) + 1);
+	if (f_name == NULL)
+		PANIC("Fail to launch initd\n");
+	strlcpy (f_name, fn_copy, strlen (fn_copy) + 1);
+	palloc_free_page (fn_copy);
+
 	if (process_exec (f_name) < 0)
 		PANIC("Fail to launch initd\n");
 	NOT_REACHED ();
@@ -123,9 +140,29 @@ duplicate_pte (uint64_t *pte, void *va, void *aux) {
 	/* 2. Resolve VA from the parent's page map level 4. */
 	parent_page = pml4_get_page (parent->pml4, va);
 
+	/* Read-only executable pages are shared, not copied. */
+	if (is_shared_pte (pte))
+		return text_cache_share (current->pml4, va, parent_page);
+
+	/* A huge page is copied whole. */
+	if (is_huge_pte (pte)) {
+		newpage = palloc_get_huge_page (PAL_USER);
+		if (newpage == NULL)
+			return false;
+		memcpy (newpage, parent_page, HPGSIZE);
+		if (!pml4_set_huge_page (current->pml4, va, newpage,
+					is_writable (pte))) {
+			palloc_free_multiple (newpage, HPG_PAGE_CNT);
+			return false;
+		}
+		return true;
+	}
+
 	/* 3. TODO: Allocate new PAL_USER page for the child and set result to
 	 *    TODO: NEWPAGE. */
-	newpage = palloc_get_page(PAL_USER | PAL_ZERO);
+	newpage = oom_get_page(PAL_USER);
+	if (newpage == NULL)
+		return false;
 
 	/* 4. TODO: Duplicate parent's page to the new page and
 	 *    TODO: check whether parent's page is writable or not (set WRITABLE
@@ -192,6 +229,14 @@ __do_fork (void *aux) {
 	}
 	current->fd_max = parent->fd_max;
 
+	/* The child maps the parent's text, so it keeps the executable
+	 * unwritable too, for as long as it runs it. */
+	if (parent->run_file != NULL) {
+		current->run_file = file_duplicate(parent->run_file);
+		if (current->run_file == NULL)
+			goto error;
+	}
+
 	sema_up(&current->sema_load);
 	process_init ();
 	/* Finally, switch to the newly created process. */
@@ -204,7 +249,8 @@ error:
 }
 
 /* Switch the current execution context to the f_name.
- * Returns -1 on fail. */
+ * Returns -1 on fail.  F_NAME belongs to the caller, typically
+ * as scratch memory; it is modified but not freed. */
 int
 process_exec (void *f_name) {
 	char *file_name = f_name;
@@ -220,16 +266,22 @@ process_exec (void *f_name) {
 
 	/* We first kill the current context */
 	process_cleanup ();
+	file_close (thread_current ()->run_file);
+	thread_current ()->run_file = NULL;
+#ifdef VM
+	supplemental_page_table_init (&thread_current ()->spt);
+#endif
 
 	/* And then load the binary */
 	success = load (file_name, &_if);
 
 	/* If load failed, quit. */
-	palloc_free_page (file_name);
 	if (!success)
 		return -1;
 
-	/* Start switched process. */
+	/* Start switched process.  Nothing on this kernel stack
+	 * survives, so neither does its scratch memory. */
+	arena_reset ();
 	do_iret (&_if);
 	NOT_REACHED ();
 }
@@ -285,15 +337,22 @@ process_exit (void) {
 	 * TODO: project2/process_termination.html).
 	 * TODO: We recommend you to implement process resource cleanup here. */
 	printf("%s: exit(%d)\n", thread_current()->name, thread_current()->exit_status);
+#ifdef VM
+	if (rss_report)
+		vm_print_process(curr);
+#endif
 	// 프로세스 종료 시 프로세스에 열려있는 모든 파일 닫기
-	file_close(curr->run_file);
-
-	for (int i = 0; i < curr->fd_max; i++) {
+	for (int i = 0; i <= curr->fd_max; i++) {
 		if (curr->fd_table[i] != NULL)
 			file_close(curr->fd_table[i]);
 	}
 
 	process_cleanup ();
+
+	/* Only now that none of its pages is mapped may the executable
+	 * be written again, see text-cache.c. */
+	file_close(curr->run_file);
+	curr->run_file = NULL;
 }
 
 /* Free the current process's resources. */
@@ -319,6 +378,7 @@ process_cleanup (void) {
 		 * that's been freed (and cleared). */
 		curr->pml4 = NULL;
 		pml4_activate (NULL);
+		text_cache_release (pml4);
 		pml4_destroy (pml4);
 	}
 }
@@ -327,8 +387,12 @@ process_cleanup (void) {
  * This function is called on every context switch. */
 void
 process_activate (struct thread *next) {
-	/* Activate thread's page tables. */
-	pml4_activate (next->pml4);
+	/* Activate thread's page tables.  A kernel thread only touches
+	 * kernel mappings, which every page map shares, so it keeps
+	 * whatever is loaded rather than paying for a switch there and
+	 * another one back. */
+	if (next->pml4 != NULL)
+		pml4_activate (next->pml4);
 
 	/* Set thread's kernel stack for use in processing interrupts. */
 	tss_update (next);
@@ -563,8 +627,10 @@ load (const char *file_name, struct intr_frame *if_) {
 
 done:
 	/* We arrive here whether the load is successful or not. */
-	if (!success)
+	if (!success) {
 		file_close (file);
+		thread_current ()->run_file = NULL;
+	}
 	return success;
 }
 
@@ -621,6 +687,32 @@ validate_segment (const struct Phdr *phdr, struct file *file) {
 /* load() helpers. */
 static bool install_page (void *upage, void *kpage, bool writable);
 
+/* Maps a writable huge page at UPAGE holding the first READ_BYTES
+ * bytes (at most HPGSIZE) of FILE starting at offset OFS, followed
+ * by zeros.  Returns false, leaving UPAGE unmapped, if no huge page
+ * is free or the read fails; the caller then falls back to small
+ * pages. */
+static bool
+load_huge_page (struct file *file, off_t ofs, uint8_t *upage,
+		size_t read_bytes) {
+	uint8_t *kpage = palloc_get_huge_page (PAL_USER);
+
+	if (read_bytes > HPGSIZE)
+		read_bytes = HPGSIZE;
+	if (kpage == NULL)
+		return false;
+	if (file_read_at (file, kpage, read_bytes, ofs) != (int) read_bytes)
+		goto fail;
+	memset (kpage + read_bytes, 0, HPGSIZE - read_bytes);
+	if (!pml4_set_huge_page (thread_current ()->pml4, upage, kpage, true))
+		goto fail;
+	return true;
+
+fail:
+	palloc_free_multiple (kpage, HPG_PAGE_CNT);
+	return false;
+}
+
 /* Loads a segment starting at offset OFS in FILE at address
  * UPAGE.  In total, READ_BYTES + ZERO_BYTES bytes of virtual
  * memory are initialized, as follows:
@@ -642,7 +734,6 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 	ASSERT (pg_ofs (upage) == 0);
 	ASSERT (ofs % PGSIZE == 0);
 
-	file_seek (file, ofs);
 	while (read_bytes > 0 || zero_bytes > 0) {
 		/* Do calculate how to fill this page.
 		 * We will read PAGE_READ_BYTES bytes from FILE
@@ -650,28 +741,51 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 		size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
 		size_t page_zero_bytes = PGSIZE - page_read_bytes;
 
-		/* Get a page of memory. */
-		uint8_t *kpage = palloc_get_page (PAL_USER);
-		if (kpage == NULL)
-			return false;
-
-		/* Load this page. */
-		if (file_read (file, kpage, page_read_bytes) != (int) page_read_bytes) {
-			palloc_free_page (kpage);
-			return false;
+		/* With -hugepages, map each aligned 2 MB stretch of a
+		 * writable segment with one huge page if we can get one. */
+		if (writable && user_huge_pages && hpg_ofs (upage) == 0
+				&& read_bytes + zero_bytes >= HPGSIZE
+				&& load_huge_page (file, ofs, upage, read_bytes)) {
+			page_read_bytes = read_bytes < HPGSIZE ? read_bytes : HPGSIZE;
+			read_bytes -= page_read_bytes;
+			zero_bytes -= HPGSIZE - page_read_bytes;
+			ofs += HPGSIZE;
+			upage += HPGSIZE;
+			continue;
 		}
-		memset (kpage + page_read_bytes, 0, page_zero_bytes);
 
-		/* Add the page to the process's address space. */
-		if (!install_page (upage, kpage, writable)) {
-			printf("fail\n");
-			palloc_free_page (kpage);
-			return false;
+		if (!writable) {
+			/* Read-only pages come from the text cache, so every
+			 * process running this executable maps the same frame. */
+			if (!text_cache_install (thread_current ()->pml4, upage, file,
+						ofs, page_read_bytes))
+				return false;
+		} else {
+			/* Get a page of memory. */
+			uint8_t *kpage = oom_get_page (PAL_USER);
+			if (kpage == NULL)
+				return false;
+
+			/* Load this page. */
+			if (file_read_at (file, kpage, page_read_bytes, ofs)
+					!= (int) page_read_bytes) {
+				palloc_free_page (kpage);
+				return false;
+			}
+			memset (kpage + page_read_bytes, 0, page_zero_bytes);
+
+			/* Add the page to the process's address space. */
+			if (!install_page (upage, kpage, writable)) {
+				printf("fail\n");
+				palloc_free_page (kpage);
+				return false;
+			}
 		}
 
 		/* Advance. */
 		read_bytes -= page_read_bytes;
 		zero_bytes -= page_zero_bytes;
+		ofs += PGSIZE;
 		upage += PGSIZE;
 	}
 	return true;
@@ -683,7 +797,7 @@ setup_stack (struct intr_frame *if_) {
 	uint8_t *kpage;
 	bool success = false;
 
-	kpage = palloc_get_page (PAL_USER | PAL_ZERO);
+	kpage = oom_get_page (PAL_USER | PAL_ZERO);
 	if (kpage != NULL) {
 		success = install_page (((uint8_t *) USER_STACK) - PGSIZE, kpage, true);
 		if (success)
@@ -717,11 +831,22 @@ install_page (void *upage, void *kpage, bool writable) {
  * If you want to implement the function for only project 2, implement it on the
  * upper block. */
 
+/* Lazy initializer of a writable segment page.  AUX is a
+ * struct file_page that says which part of the executable to read;
+ * the page is private from then on, so AUX is released here. */
 static bool
 lazy_load_segment (struct page *page, void *aux) {
-	/* TODO: Load the segment from the file */
-	/* TODO: This called when the first page fault occurs on address VA. */
-	/* TODO: VA is available when calling this function. */
+	struct file_page *fp = aux;
+	uint8_t *kva = page->frame->kva;
+	bool success;
+
+	success = file_read_at (fp->file, kva, fp->read_bytes, fp->ofs)
+		== (off_t) fp->read_bytes;
+	memset (kva + fp->read_bytes, 0, PGSIZE - fp->read_bytes);
+
+	file_close (fp->file);
+	free (fp);
+	return success;
 }
 
 /* Loads a segment starting at offset OFS in FILE at address
@@ -752,15 +877,30 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 		size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
 		size_t page_zero_bytes = PGSIZE - page_read_bytes;
 
-		/* TODO: Set up aux to pass information to the lazy_load_segment. */
-		void *aux = NULL;
-		if (!vm_alloc_page_with_initializer (VM_ANON, upage,
-					writable, lazy_load_segment, aux))
+		struct file_page *aux = malloc (sizeof *aux);
+		if (aux == NULL)
+			return false;
+		aux->file = file_share (file);
+		aux->inumber = inode_get_inumber (file_get_inode (file));
+		aux->ofs = ofs;
+		aux->read_bytes = page_read_bytes;
+		aux->text = true;
+		aux->map_cnt = 0;
+
+		/* Read-only pages are file backed, so every process running
+		 * this executable shares one frame for each of them. */
+		if (!vm_alloc_page_with_initializer (writable ? VM_ANON : VM_FILE,
+					upage, writable,
+					writable ? lazy_load_segment : file_backed_load, aux)) {
+			file_close (aux->file);
+			free (aux);
 			return false;
+		}
 
 		/* Advance. */
 		read_bytes -= page_read_bytes;
 		zero_bytes -= page_zero_bytes;
+		ofs += PGSIZE;
 		upage += PGSIZE;
 	}
 	return true;
@@ -772,11 +912,11 @@ setup_stack (struct intr_frame *if_) {
 	bool success = false;
 	void *stack_bottom = (void *) (((uint8_t *) USER_STACK) - PGSIZE);
 
-	/* TODO: Map the stack on stack_bottom and claim the page immediately.
-	 * TODO: If success, set the rsp accordingly.
-	 * TODO: You should mark the page is stack. */
-	/* TODO: Your code goes here */
-
+	if (vm_alloc_page (VM_ANON | VM_MARKER_0, stack_bottom, true)
+			&& vm_claim_page (stack_bottom)) {
+		if_->rsp = USER_STACK;
+		success = true;
+	}
 	return success;
 }
 #endif /* VM */
@@ -1,18 +1,27 @@
 #include "userprog/syscall.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <syscall-nr.h>
+#include "threads/arena.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
 #include "threads/thread.h"
 #include "threads/loader.h"
 #include "userprog/gdt.h"
 #include "threads/flags.h"
 #include "intrinsic.h"
 #include "threads/init.h"
+#include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "threads/synch.h"
 #include "userprog/process.h"
 #include "threads/palloc.h"
+#include "threads/mmu.h"
+#include "threads/vaddr.h"
+#ifdef VM
+#include "vm/vm.h"
+#endif
 
 void syscall_entry (void);
 void syscall_handler (struct intr_frame *);
@@ -41,17 +50,130 @@ syscall_init (void) {
 	 * mode stack. Therefore, we masked the FLAG_FL. */
 	write_msr(MSR_SYSCALL_MASK,
 			FLAG_IF | FLAG_TF | FLAG_DF | FLAG_IOPL | FLAG_AC | FLAG_NT);
-
-	lock_init(&filesys_lock);
 }
 
 bool
-is_valid_address(void *addr) {
-	if (addr == NULL || is_kernel_vaddr(addr) || pml4_get_page(thread_current()->pml4, addr) == NULL) 
+is_valid_address(const void *addr) {
+	if (addr == NULL || is_kernel_vaddr(addr))
+		return false;
+#ifdef VM
+	/* Lazily loaded pages are valid before their first fault. */
+	if (spt_find_page(&thread_current()->spt, (void *) addr) == NULL)
+		return false;
+#else
+	if (pml4_get_page(thread_current()->pml4, addr) == NULL)
 		return false;
+#endif
 	return true;
 }
 
+/* Returns true if the user process may write to ADDR.  The kernel
+ * must not write anywhere else in user memory: a read-only page
+ * may be a frame that other processes share. */
+bool
+is_writable_address(void *addr) {
+#ifdef VM
+	struct thread *curr = thread_current();
+	struct page *page = spt_find_page(&curr->spt, addr);
+
+	/* The stack grows on the kernel's first touch, as in a fault. */
+	if (page == NULL)
+		return is_user_vaddr(addr) && is_stack_access(addr, curr->user_rsp);
+	return page->writable;
+#else
+	if (!is_valid_address(addr))
+		return false;
+	return is_writable(pml4e_walk(thread_current()->pml4, (uint64_t) addr, 0));
+#endif
+}
+
+/* Exits the process unless every page of the SIZE bytes at
+ * BUFFER is valid, and writable as well if WRITABLE is true. */
+static void
+check_buffer(const void *buffer, size_t size, bool writable) {
+	uintptr_t addr = (uintptr_t) buffer;
+	uintptr_t end = addr + size;
+
+	if (end < addr)
+		exit(-1);
+	do {
+		if (writable ? !is_writable_address((void *) addr)
+				: !is_valid_address((void *) addr))
+			exit(-1);
+		addr = (uintptr_t) pg_round_down((void *) addr) + PGSIZE;
+	} while (addr < end);
+}
+
+/* Size of the kernel buffer that file data passes through. */
+#define BOUNCE_SIZE PGSIZE
+
+/* Moves LENGTH bytes between the user's BUFFER and FILE, at
+ * OFFSET or, if OFFSET is negative, at the file position: into
+ * the file if WRITE is true, out of it otherwise.  The data goes
+ * through a kernel buffer, so that a fault on BUFFER never comes
+ * while the file system holds an inode lock; bringing the page
+ * in, or evicting another to make room, may need the same inode.
+ * Returns the number of bytes moved, or -1 if out of memory. */
+static int
+file_transfer(struct file *file, void *buffer, unsigned length,
+		off_t offset, bool write) {
+	size_t mark = arena_begin();
+	uint8_t *bounce = arena_alloc(BOUNCE_SIZE);
+	uint8_t *user = buffer;
+	unsigned done = 0;
+
+	if (bounce == NULL) {
+		arena_end(mark);
+		return -1;
+	}
+	while (done < length) {
+		unsigned chunk = length - done < BOUNCE_SIZE ? length - done : BOUNCE_SIZE;
+		off_t n;
+
+		if (write) {
+			memcpy(bounce, user + done, chunk);
+			n = offset < 0 ? file_write(file, bounce, chunk)
+				: file_write_at(file, bounce, chunk, offset + done);
+		} else {
+			n = offset < 0 ? file_read(file, bounce, chunk)
+				: file_read_at(file, bounce, chunk, offset + done);
+			memcpy(user + done, bounce, n);
+		}
+		done += n;
+		if ((unsigned) n < chunk)
+			break;
+	}
+	arena_end(mark);
+	return done;
+}
+
+/* Room for a kernel copy of a file name, terminator included.
+ * No file system name comes close; longer ones are refused. */
+#define NAME_COPY_SIZE 512
+
+/* Copies the user's file name NAME into the thread's arena and
+ * returns the copy, or a null pointer if NAME is too long or the
+ * arena is full.  The file system must only ever see the copy: a
+ * fault on NAME while it holds an inode lock or has a journal
+ * operation open might wait on a thread that waits for it. */
+static char *
+copy_in_name(const char *name) {
+	char *copy = arena_alloc(NAME_COPY_SIZE);
+	size_t i;
+
+	for (i = 0; i < NAME_COPY_SIZE; i++) {
+		if ((i == 0 || pg_ofs(name + i) == 0)
+				&& !is_valid_address(name + i))
+			exit(-1);
+		if (copy == NULL)
+			return NULL;
+		copy[i] = name[i];
+		if (copy[i] == '\0')
+			return copy;
+	}
+	return NULL;
+}
+
 /* The main system call interface */
 void
 syscall_handler (struct intr_frame *f) {
@@ -59,6 +181,12 @@ syscall_handler (struct intr_frame *f) {
 
 	if (!is_valid_address(f->rsp)) 
 		thread_exit();
+	if (curr->killed)
+		thread_exit();
+#ifdef VM
+	/* A page fault in the kernel may need to grow the user stack. */
+	curr->user_rsp = f->rsp;
+#endif
 
 	switch (f->R.rax) {
 		case SYS_HALT:
@@ -105,9 +233,36 @@ syscall_handler (struct intr_frame *f) {
 		case SYS_CLOSE:
 			close(f->R.rdi);
 			break;
+		case SYS_PREAD:
+			f->R.rax = pread(f->R.rdi, (void *) f->R.rsi, f->R.rdx, f->R.r10);
+			break;
+		case SYS_PWRITE:
+			f->R.rax = pwrite(f->R.rdi, (const void *) f->R.rsi, f->R.rdx, f->R.r10);
+			break;
+		case SYS_FSYNC:
+			f->R.rax = fsync(f->R.rdi);
+			break;
+#ifdef VM
+		case SYS_MMAP:
+			f->R.rax = (uint64_t) mmap((void *) f->R.rdi, f->R.rsi, f->R.rdx, f->R.r10, f->R.r8);
+			break;
+		case SYS_MUNMAP:
+			munmap((void *) f->R.rdi);
+			break;
+#endif
+		case SYS_MEMSTAT:
+			f->R.rax = memstat((struct memstat *) f->R.rdi);
+			break;
+		case SYS_MEMDUMP:
+			memdump();
+			break;
 		default:
 			thread_exit ();
 	}
+
+	/* Chosen by the OOM killer while in the kernel. */
+	if (curr->killed)
+		thread_exit();
 }
 
 void
@@ -131,13 +286,17 @@ int exec (const char *file) {
 	if (!is_valid_address(file))
 		exit(-1);
 		
-	char *file_name = palloc_get_page(PAL_ZERO);
+	size_t mark = arena_begin();
+	size_t size = strlen(file) + 1;
+	char *file_name = arena_alloc(size);
 	if (file_name == NULL)
 		exit(-1);
 
-	memcpy(file_name, file, strlen(file) + 1);
-	if (process_exec(file_name) == -1)
+	memcpy(file_name, file, size);
+	if (process_exec(file_name) == -1) {
+		arena_end(mark);
 		exit(-1);
+	}
 	return 0;
 }
 
@@ -147,50 +306,45 @@ int wait (pid_t child_tid) {
 
 bool
 create (const char *file, unsigned initial_size) {
-	if (!file || !is_valid_address(file))
-		exit(-1);
+	size_t mark = arena_begin();
+	char *name = copy_in_name(file);
+	bool success = name != NULL && filesys_create(name, initial_size);
 
-	if (filesys_create(file, initial_size)) 
-		return true;
-	return false;
+	arena_end(mark);
+	return success;
 }
 
 bool
 remove (const char *file) {
-	if (!file || !is_valid_address(file))
-		exit(-1);
+	size_t mark = arena_begin();
+	char *name = copy_in_name(file);
+	bool success = name != NULL && filesys_remove(name);
 
-	if (filesys_remove(file)) {
-		return true;
-	}
-	return false;
+	arena_end(mark);
+	return success;
 }
 
 int
 open (const char *file) {
-	if (!file || !is_valid_address(file))
-		exit(-1);
-
+	size_t mark = arena_begin();
+	char *name = copy_in_name(file);
 	struct thread *curr = thread_current();
-	struct file *open_file;
-
-	if (curr->fd_max >= FD_MAX)
-		return -1;
+	struct file *open_file = name != NULL ? filesys_open(name) : NULL;
 
-	lock_acquire(&filesys_lock);
-	if (open_file = filesys_open(file)) {
-		for (int idx = curr->fd_max; idx < FD_MAX; idx++) { // 디스크립터 테이블에 open_file 저장
+	arena_end(mark);
+	if (open_file) {
+		/* Lowest free descriptor, so that closed ones are reused.
+		 * fd_max is the highest one ever handed out. */
+		for (int idx = 3; idx < FD_MAX; idx++) { // 디스크립터 테이블에 open_file 저장
 			if (curr->fd_table[idx] == NULL) {
 				curr->fd_table[idx] = open_file;
-				curr->fd_max = idx;
-				lock_release(&filesys_lock);
-				return curr->fd_max;
+				if (idx > curr->fd_max)
+					curr->fd_max = idx;
+				return idx;
 			}
 		}
 		file_close(open_file);
-		curr->fd_max = FD_MAX;
 	}
-	lock_release(&filesys_lock);
 	return -1;
 }
 
@@ -205,10 +359,10 @@ int filesize (int fd) {
 }
 
 int read (int fd, void *buffer, unsigned length) {
-	if (!fd || fd > FD_MAX || !is_valid_address(buffer))
+	if (!fd || fd > FD_MAX)
 		exit(-1);
+	check_buffer(buffer, length, true);
 
-	lock_acquire(&filesys_lock);
 	if (fd == 0) {
 		int count = 0;
 		char *temp_buf = buffer;
@@ -219,39 +373,30 @@ int read (int fd, void *buffer, unsigned length) {
 				break;
 			temp_buf++;
 		}
-		lock_release(&filesys_lock);
 		return count;
 	}
 
+	/* The file system does its own locking. */
 	struct file *open_file = thread_current()->fd_table[fd];
-	if (open_file) {
-		off_t read_bytes = file_read(open_file, buffer, length);
-		lock_release(&filesys_lock);
-		return read_bytes;
-	}
-	lock_release(&filesys_lock);
+	if (open_file)
+		return file_transfer(open_file, buffer, length, -1, false);
 	return -1;
 }
 
 int
 write (int fd, const void *buffer, unsigned length) {
-	if (!fd || fd > FD_MAX || !is_valid_address(buffer))
+	if (!fd || fd > FD_MAX)
 		exit(-1);
+	check_buffer(buffer, length, false);
 
-	lock_acquire(&filesys_lock);
 	if (fd == 1) {
 		putbuf(buffer, length);
-		lock_release(&filesys_lock);
 		return length;
 	}
 
 	struct file *open_file = thread_current()->fd_table[fd];
-	if (open_file) {
-		off_t written_bytes = file_write(open_file, buffer, length);
-		lock_release(&filesys_lock);
-		return written_bytes;
-	}
-	lock_release(&filesys_lock);
+	if (open_file)
+		return file_transfer(open_file, (void *) buffer, length, -1, true);
 	return -1;
 }
 
@@ -282,4 +427,86 @@ close (int fd) {
 	curr_file = thread_current()->fd_table[fd];
 	thread_current()->fd_table[fd] = NULL;
 	file_close(curr_file);
-}
\ No newline at end of file
+}
+
+/* Like read(), but from OFFSET in the file.  The file position
+ * is neither used nor changed, so processes sharing an open file
+ * need no seek() first. */
+int pread (int fd, void *buffer, unsigned length, off_t offset) {
+	if (!fd || fd > FD_MAX)
+		exit(-1);
+	check_buffer(buffer, length, true);
+
+	struct file *open_file = thread_current()->fd_table[fd];
+	if (open_file == NULL || offset < 0)
+		return -1;
+	return file_transfer(open_file, buffer, length, offset, false);
+}
+
+/* Like write(), but at OFFSET in the file, leaving the file
+ * position alone. */
+int pwrite (int fd, const void *buffer, unsigned length, off_t offset) {
+	if (!fd || fd > FD_MAX)
+		exit(-1);
+	check_buffer(buffer, length, false);
+
+	struct file *open_file = thread_current()->fd_table[fd];
+	if (open_file == NULL || offset < 0)
+		return -1;
+	return file_transfer(open_file, (void *) buffer, length, offset, true);
+}
+
+/* Makes everything written to FD so far survive a crash.
+ * Returns 0 on success, -1 if FD is not open. */
+int fsync (int fd) {
+	if (!fd || fd > FD_MAX)
+		exit(-1);
+
+	struct file *open_file = thread_current()->fd_table[fd];
+	if (open_file == NULL)
+		return -1;
+	file_sync(open_file);
+	return 0;
+}
+#ifdef VM
+void *
+mmap (void *addr, size_t length, int writable, int fd, off_t offset) {
+	struct file *file;
+
+	if (fd < 2 || fd >= FD_MAX)
+		return MAP_FAILED;
+
+	file = thread_current()->fd_table[fd];
+	if (file == NULL)
+		return MAP_FAILED;
+	return do_mmap(addr, length, writable, file, offset);
+}
+
+void
+munmap (void *addr) {
+	do_munmap(addr);
+}
+#endif
+
+bool
+memstat (struct memstat *st) {
+	check_buffer(st, sizeof *st, true);
+
+	palloc_usage(0, &st->kernel_pages, &st->kernel_peak);
+	palloc_usage(PAL_USER, &st->user_pages, &st->user_peak);
+	malloc_usage(&st->malloc_bytes, &st->malloc_peak);
+#ifdef VM
+	vm_process_usage(thread_current(), &st->rss, &st->peak_rss, &st->wss);
+	st->faults = thread_current()->fault_cnt;
+	st->evictions = thread_current()->evict_cnt;
+#else
+	st->rss = st->peak_rss = st->wss = 0;
+	st->faults = st->evictions = 0;
+#endif
+	return true;
+}
+
+void
+memdump (void) {
+	malloc_dump();
+}
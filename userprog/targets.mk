@@ -4,3 +4,5 @@ userprog_SRC += userprog/syscall-entry.S # System call entry.
 userprog_SRC += userprog/syscall.c	# System call handler.
 userprog_SRC += userprog/gdt.c		# GDT initialization.
 userprog_SRC += userprog/tss.c		# TSS management.
+userprog_SRC += userprog/text-cache.c	# Shared read-only executable pages.
+userprog_SRC += userprog/oom.c		# Reclaim and OOM killer.
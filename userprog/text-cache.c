@@ -0,0 +1,281 @@
+#include "userprog/text-cache.h"
+#include <debug.h>
+#include <hash.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/disk.h"
+#include "filesys/file.h"
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "userprog/oom.h"
+
+/* Shared cache of read-only executable pages.
+
+   Every process that runs the same program maps the same code
+   pages, so there is no reason for each of them to hold a
+   private copy.  A read-only page of an ELF segment is fully
+   described by the executable's inode, the file offset it was
+   loaded from and the number of bytes read (the rest of the
+   page is zero), so we keep one frame per such key and map it
+   into every address space that asks for it.
+
+   Each frame carries a reference count, one per mapping.  The
+   PTEs that point at a cached frame are tagged with PTE_SHARED
+   so that process teardown hands them back here instead of
+   letting pml4_destroy() free the frame under the other
+   sharers.  The executable stays open with writes denied for as
+   long as a process runs it, so a cached page can never go
+   stale: by the time its inode can be written or its sectors
+   reused, the last mapping is gone and so is the frame. */
+
+/* A cached read-only page. */
+struct text_page {
+	struct hash_elem key_elem;      /* Element in text_pages. */
+	struct hash_elem kpage_elem;    /* Element in text_frames. */
+	disk_sector_t inumber;          /* Executable's inode number. */
+	off_t ofs;                      /* Offset of the page in the file. */
+	size_t read_bytes;              /* Bytes read from the file. */
+	void *kpage;                    /* Shared frame. */
+	int ref_cnt;                    /* Number of mappings of KPAGE. */
+};
+
+/* Cached pages keyed by file position, and the same pages
+   keyed by frame so that an unmapped PTE can find its owner. */
+static struct hash text_pages;
+static struct hash text_frames;
+static struct lock text_lock;
+
+/* Statistics. */
+static long long hit_cnt;       /* Mappings served from the cache. */
+static long long miss_cnt;      /* Pages read from disk. */
+
+static uint64_t text_page_hash (const struct hash_elem *, void *);
+static bool text_page_less (const struct hash_elem *,
+		const struct hash_elem *, void *);
+static uint64_t text_frame_hash (const struct hash_elem *, void *);
+static bool text_frame_less (const struct hash_elem *,
+		const struct hash_elem *, void *);
+static struct text_page *lookup_kpage (void *kpage);
+static bool map_shared (uint64_t *pml4, void *upage, void *kpage);
+static void put_page (struct text_page *);
+
+/* Initializes the text cache. */
+void
+text_cache_init (void) {
+	hash_init (&text_pages, text_page_hash, text_page_less, NULL);
+	hash_init (&text_frames, text_frame_hash, text_frame_less, NULL);
+	lock_init (&text_lock);
+}
+
+/* Maps UPAGE in PML4 read-only to the page that holds
+   READ_BYTES bytes of FILE starting at OFS, followed by zeros.
+   The page is read from FILE only if no other address space
+   already maps it.  Returns true if successful, false if a
+   memory allocation or disk read fails. */
+bool
+text_cache_install (uint64_t *pml4, void *upage, struct file *file,
+		off_t ofs, size_t read_bytes) {
+	struct text_page key, *tp;
+	struct hash_elem *e;
+	bool success = false;
+
+	ASSERT (pg_ofs (upage) == 0);
+	ASSERT (read_bytes <= PGSIZE);
+
+	key.inumber = inode_get_inumber (file_get_inode (file));
+	key.ofs = ofs;
+	key.read_bytes = read_bytes;
+
+	lock_acquire (&text_lock);
+	e = hash_find (&text_pages, &key.key_elem);
+	if (e != NULL) {
+		tp = hash_entry (e, struct text_page, key_elem);
+		hit_cnt++;
+	} else {
+		/* First mapping of this page: load it. */
+		tp = malloc (sizeof *tp);
+		if (tp == NULL)
+			goto done;
+		tp->kpage = oom_get_page (PAL_USER);
+		if (tp->kpage == NULL) {
+			free (tp);
+			goto done;
+		}
+		if (file_read_at (file, tp->kpage, read_bytes, ofs)
+				!= (off_t) read_bytes) {
+			palloc_free_page (tp->kpage);
+			free (tp);
+			goto done;
+		}
+		memset ((uint8_t *) tp->kpage + read_bytes, 0, PGSIZE - read_bytes);
+
+		tp->inumber = key.inumber;
+		tp->ofs = ofs;
+		tp->read_bytes = read_bytes;
+		tp->ref_cnt = 0;
+		hash_insert (&text_pages, &tp->key_elem);
+		hash_insert (&text_frames, &tp->kpage_elem);
+		miss_cnt++;
+	}
+
+	tp->ref_cnt++;
+	success = map_shared (pml4, upage, tp->kpage);
+	if (!success)
+		put_page (tp);
+
+done:
+	lock_release (&text_lock);
+	return success;
+}
+
+/* Adds another mapping of cached frame KPAGE at UPAGE in PML4,
+   e.g. for a child that inherits its parent's code on fork().
+   Returns true if successful, false if memory allocation
+   fails. */
+bool
+text_cache_share (uint64_t *pml4, void *upage, void *kpage) {
+	struct text_page *tp;
+	bool success;
+
+	lock_acquire (&text_lock);
+	tp = lookup_kpage (kpage);
+	ASSERT (tp != NULL);
+
+	tp->ref_cnt++;
+	success = map_shared (pml4, upage, kpage);
+	if (!success)
+		put_page (tp);
+	lock_release (&text_lock);
+
+	return success;
+}
+
+/* Drops every shared mapping in PML4 and clears its PTE, so that
+   a following pml4_destroy() frees only private pages.  A frame
+   whose last mapping goes away is returned to the user pool. */
+static bool
+release_pte (uint64_t *pte, void *va, void *aux UNUSED) {
+	if (is_user_vaddr (va) && is_shared_pte (pte)) {
+		struct text_page *tp = lookup_kpage (ptov (PTE_ADDR (*pte)));
+
+		ASSERT (tp != NULL);
+		*pte = 0;
+		put_page (tp);
+	}
+	return true;
+}
+
+void
+text_cache_release (uint64_t *pml4) {
+	if (pml4 == NULL)
+		return;
+
+	lock_acquire (&text_lock);
+	pml4_for_each (pml4, release_pte, NULL);
+	lock_release (&text_lock);
+}
+
+/* Prints text cache statistics. */
+void
+text_cache_print_stats (void) {
+	struct hash_iterator i;
+	long long mapped_cnt = 0;
+
+	lock_acquire (&text_lock);
+	hash_first (&i, &text_pages);
+	while (hash_next (&i))
+		mapped_cnt += hash_entry (hash_cur (&i), struct text_page,
+				key_elem)->ref_cnt;
+	printf ("Text cache: %zu resident pages, %lld mappings, "
+			"%lld hits, %lld misses\n",
+			hash_size (&text_pages), mapped_cnt, hit_cnt, miss_cnt);
+	lock_release (&text_lock);
+}
+
+/* Returns the cached page whose frame is KPAGE, or a null
+   pointer if there is none.  TEXT_LOCK must be held. */
+static struct text_page *
+lookup_kpage (void *kpage) {
+	struct text_page key;
+	struct hash_elem *e;
+
+	key.kpage = kpage;
+	e = hash_find (&text_frames, &key.kpage_elem);
+	return e != NULL ? hash_entry (e, struct text_page, kpage_elem) : NULL;
+}
+
+/* Maps UPAGE in PML4 read-only to shared frame KPAGE and tags
+   the PTE as shared.  UPAGE must not already be mapped. */
+static bool
+map_shared (uint64_t *pml4, void *upage, void *kpage) {
+	uint64_t *pte;
+
+	if (pml4_get_page (pml4, upage) != NULL
+			|| !pml4_set_page (pml4, upage, kpage, false))
+		return false;
+
+	pte = pml4e_walk (pml4, (uint64_t) upage, 0);
+	ASSERT (pte != NULL);
+	*pte |= PTE_SHARED;
+	return true;
+}
+
+/* Drops one reference to TP, freeing its frame along with it if
+   that was the last one.  TEXT_LOCK must be held. */
+static void
+put_page (struct text_page *tp) {
+	ASSERT (lock_held_by_current_thread (&text_lock));
+	ASSERT (tp->ref_cnt > 0);
+
+	if (--tp->ref_cnt == 0) {
+		hash_delete (&text_pages, &tp->key_elem);
+		hash_delete (&text_frames, &tp->kpage_elem);
+		palloc_free_page (tp->kpage);
+		free (tp);
+	}
+}
+
+/* Hashes a text page by its file position. */
+static uint64_t
+text_page_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct text_page *tp = hash_entry (e, struct text_page, key_elem);
+	uint64_t key[3] = { tp->inumber, tp->ofs, tp->read_bytes };
+
+	return hash_bytes (key, sizeof key);
+}
+
+/* Orders text pages by file position. */
+static bool
+text_page_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct text_page *a = hash_entry (a_, struct text_page, key_elem);
+	const struct text_page *b = hash_entry (b_, struct text_page, key_elem);
+
+	if (a->inumber != b->inumber)
+		return a->inumber < b->inumber;
+	if (a->ofs != b->ofs)
+		return a->ofs < b->ofs;
+	return a->read_bytes < b->read_bytes;
+}
+
+/* Hashes a text page by its frame. */
+static uint64_t
+text_frame_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct text_page *tp = hash_entry (e, struct text_page, kpage_elem);
+
+	return hash_bytes (&tp->kpage, sizeof tp->kpage);
+}
+
+/* Orders text pages by frame. */
+static bool
+text_frame_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct text_page *a = hash_entry (a_, struct text_page, kpage_elem);
+	const struct text_page *b = hash_entry (b_, struct text_page, kpage_elem);
+
+	return a->kpage < b->kpage;
+}
@@ -1,7 +1,15 @@
 /* anon.c: Implementation of page for non-disk image (a.k.a. anonymous page). */
 
+#include <bitmap.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
 #include "vm/vm.h"
 #include "devices/disk.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "intrinsic.h"
 
 /* DO NOT MODIFY BELOW LINE */
 static struct disk *swap_disk;
@@ -17,36 +25,406 @@ static const struct page_operations anon_ops = {
 	.type = VM_ANON,
 };
 
+/* Swapping.
+ *
+ * An evicted anonymous page goes to the first of these that takes
+ * it:
+ *
+ *   - If every 64-bit word of the page is the same, typically
+ *     zero, only that word is kept, in the page itself.
+ *
+ *   - Otherwise the page is compressed, and if it shrinks to no
+ *     more than ZPAGE_MAX bytes it is stored in the zpool, a
+ *     region of kernel memory carved into ZCHUNK_SIZE-byte chunks.
+ *     A compressed page takes a run of consecutive chunks.
+ *
+ *   - Otherwise, or if the zpool has no room, it is written to a
+ *     page-size slot of the swap disk, which costs eight sector
+ *     writes.
+ *
+ * Swapping a page back in releases whatever held it.  SWAP_LOCK
+ * protects the zpool and swap slot maps, the compressor's scratch
+ * memory and the statistics.
+ *
+ * The compressor is a small LZ77 variant that looks for earlier
+ * occurrences of the next four bytes through a hash table.  Its
+ * output is a sequence of items, each starting with a control
+ * byte C:
+ *
+ *   C < 0x80: C + 1 literal bytes follow.
+ *   C >= 0x80: copy (C & 0x7f) + LZ_MIN_MATCH bytes from an
+ *     earlier position, whose distance back follows as 2 bytes,
+ *     least significant first.
+ *
+ * It is meant to catch what our workloads actually produce, runs
+ * and repeated records, at a small fraction of the cost of a disk
+ * write, not to compress well in general. */
+
+/* Sectors in a swap slot. */
+#define SLOT_SECTORS (PGSIZE / DISK_SECTOR_SIZE)
+
+/* Zpool size in pages, and the size of its chunks. */
+#define ZPOOL_PAGES 256
+#define ZCHUNK_SIZE 64
+
+/* Pages that do not compress to this size go to disk. */
+#define ZPAGE_MAX (PGSIZE * 3 / 4)
+
+/* Compressor parameters. */
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_MATCH (0x7f + LZ_MIN_MATCH)
+#define LZ_MAX_LITERALS 0x80
+#define LZ_HASH_BITS 10
+
+bool swap_compress = true;
+
+static struct lock swap_lock;
+static struct bitmap *swap_map;     /* Used swap slots. */
+static uint8_t *zpool;              /* Compressed pages. */
+static struct bitmap *zpool_map;    /* Used zpool chunks. */
+
+/* Compressor scratch memory. */
+static uint8_t lz_buf[ZPAGE_MAX + 2 * LZ_MAX_LITERALS];
+static uint16_t lz_table[1 << LZ_HASH_BITS];
+
+/* Statistics. */
+static long long filled_out_cnt;    /* Same-filled pages swapped out. */
+static long long zpool_out_cnt;     /* Pages compressed into the zpool. */
+static long long disk_out_cnt;      /* Pages written to disk. */
+static long long zpool_in_bytes;    /* Uncompressed bytes in the zpool. */
+static long long zpool_out_bytes;   /* Compressed bytes in the zpool. */
+static long long ram_in_cnt;        /* Swap-ins from the filled or zpool. */
+static long long disk_in_cnt;       /* Swap-ins from disk. */
+static uint64_t ram_in_cycles;      /* Time spent on RAM swap-ins. */
+static uint64_t disk_in_cycles;     /* Time spent on disk swap-ins. */
+
+static bool same_filled (const void *, uint64_t *fill);
+static size_t lz_compress (const uint8_t *src, uint8_t *dst, size_t dst_max);
+static bool lz_decompress (const uint8_t *src, size_t size, uint8_t *dst);
+static void release_store (struct anon_page *);
+
 /* Initialize the data for anonymous pages */
 void
 vm_anon_init (void) {
-	/* TODO: Set up the swap_disk. */
-	swap_disk = NULL;
+	/* Set up the swap_disk. */
+	swap_disk = disk_get (1, 1);
+	lock_init (&swap_lock);
+	if (swap_disk != NULL) {
+		swap_map = bitmap_create (disk_size (swap_disk) / SLOT_SECTORS);
+		if (swap_map == NULL)
+			swap_disk = NULL;
+	}
+
+	if (swap_compress) {
+		zpool = palloc_get_multiple (0, ZPOOL_PAGES);
+		zpool_map = bitmap_create (ZPOOL_PAGES * PGSIZE / ZCHUNK_SIZE);
+		if (zpool == NULL || zpool_map == NULL) {
+			palloc_free_multiple (zpool, ZPOOL_PAGES);
+			bitmap_destroy (zpool_map);
+			zpool = NULL;
+			zpool_map = NULL;
+		}
+	}
+}
+
+/* Prints swap statistics. */
+void
+anon_print_stats (void) {
+	long long out_cnt, in_cnt;
+
+	lock_acquire (&swap_lock);
+	out_cnt = filled_out_cnt + zpool_out_cnt + disk_out_cnt;
+	in_cnt = ram_in_cnt + disk_in_cnt;
+	printf ("Swap: %lld out (%lld same-filled, %lld compressed, %lld to disk), "
+			"compression %lld%%, %lld in (%lld%% from RAM), "
+			"%llu cycles per RAM swap-in, %llu per disk swap-in\n",
+			out_cnt, filled_out_cnt, zpool_out_cnt, disk_out_cnt,
+			zpool_in_bytes ? zpool_out_bytes * 100 / zpool_in_bytes : 0,
+			in_cnt, in_cnt ? ram_in_cnt * 100 / in_cnt : 0,
+			ram_in_cnt ? ram_in_cycles / ram_in_cnt : 0,
+			disk_in_cnt ? disk_in_cycles / disk_in_cnt : 0);
+	lock_release (&swap_lock);
 }
 
 /* Initialize the file mapping */
 bool
-anon_initializer (struct page *page, enum vm_type type, void *kva) {
+anon_initializer (struct page *page, enum vm_type type UNUSED, void *kva UNUSED) {
 	/* Set up the handler */
 	page->operations = &anon_ops;
 
 	struct anon_page *anon_page = &page->anon;
+
+	/* KVA is fresh anonymous memory, which vm_claim_pinned()
+	 * already got zeroed. */
+	anon_page->store = ANON_NONE;
+	return true;
 }
 
 /* Swap in the page by read contents from the swap disk. */
 static bool
 anon_swap_in (struct page *page, void *kva) {
 	struct anon_page *anon_page = &page->anon;
+	uint64_t start = rdtsc ();
+	bool success = true;
+
+	switch (anon_page->store) {
+		case ANON_NONE:
+			NOT_REACHED ();
+
+		case ANON_FILLED:
+			{
+				uint64_t *word = kva;
+				size_t i;
+
+				for (i = 0; i < PGSIZE / sizeof *word; i++)
+					word[i] = anon_page->fill;
+			}
+			break;
+
+		case ANON_COMPRESSED:
+			success = lz_decompress (zpool + anon_page->slot * ZCHUNK_SIZE,
+					anon_page->size, kva);
+			break;
+
+		case ANON_SWAPPED:
+			{
+				disk_sector_t sector = anon_page->slot * SLOT_SECTORS;
+				size_t i;
+
+				for (i = 0; i < SLOT_SECTORS; i++)
+					disk_read (swap_disk, sector + i,
+							(uint8_t *) kva + i * DISK_SECTOR_SIZE);
+			}
+			break;
+	}
+	if (!success)
+		return false;
+
+	lock_acquire (&swap_lock);
+	if (anon_page->store == ANON_SWAPPED) {
+		disk_in_cnt++;
+		disk_in_cycles += rdtsc () - start;
+	} else {
+		ram_in_cnt++;
+		ram_in_cycles += rdtsc () - start;
+	}
+	release_store (anon_page);
+	lock_release (&swap_lock);
+	return true;
 }
 
 /* Swap out the page by writing contents to the swap disk. */
 static bool
 anon_swap_out (struct page *page) {
 	struct anon_page *anon_page = &page->anon;
+	const void *kva = page->frame->kva;
+	size_t slot, size, chunk_cnt;
+	disk_sector_t sector;
+	size_t i;
+
+	ASSERT (anon_page->store == ANON_NONE);
+
+	if (same_filled (kva, &anon_page->fill)) {
+		lock_acquire (&swap_lock);
+		filled_out_cnt++;
+		lock_release (&swap_lock);
+		anon_page->store = ANON_FILLED;
+		return true;
+	}
+
+	lock_acquire (&swap_lock);
+	if (zpool != NULL) {
+		size = lz_compress (kva, lz_buf, ZPAGE_MAX);
+		if (size > 0) {
+			chunk_cnt = DIV_ROUND_UP (size, ZCHUNK_SIZE);
+			slot = bitmap_scan_and_flip (zpool_map, 0, chunk_cnt, false);
+			if (slot != BITMAP_ERROR) {
+				memcpy (zpool + slot * ZCHUNK_SIZE, lz_buf, size);
+				zpool_out_cnt++;
+				zpool_in_bytes += PGSIZE;
+				zpool_out_bytes += size;
+				lock_release (&swap_lock);
+
+				anon_page->store = ANON_COMPRESSED;
+				anon_page->slot = slot;
+				anon_page->size = size;
+				return true;
+			}
+		}
+	}
+
+	/* Spill to disk. */
+	slot = swap_map != NULL ? bitmap_scan_and_flip (swap_map, 0, 1, false)
+		: BITMAP_ERROR;
+	if (slot != BITMAP_ERROR)
+		disk_out_cnt++;
+	lock_release (&swap_lock);
+	if (slot == BITMAP_ERROR)
+		return false;
+
+	sector = slot * SLOT_SECTORS;
+	for (i = 0; i < SLOT_SECTORS; i++)
+		disk_write (swap_disk, sector + i,
+				(const uint8_t *) kva + i * DISK_SECTOR_SIZE);
+	anon_page->store = ANON_SWAPPED;
+	anon_page->slot = slot;
+	return true;
 }
 
 /* Destroy the anonymous page. PAGE will be freed by the caller. */
 static void
 anon_destroy (struct page *page) {
 	struct anon_page *anon_page = &page->anon;
+
+	if (anon_page->store != ANON_NONE) {
+		lock_acquire (&swap_lock);
+		release_store (anon_page);
+		lock_release (&swap_lock);
+	}
+	vm_unmap_page (page);
+}
+
+/* Frees the zpool chunks or swap slot holding ANON_PAGE's
+ * contents, if any, and marks it resident.  SWAP_LOCK must be
+ * held. */
+static void
+release_store (struct anon_page *anon_page) {
+	ASSERT (lock_held_by_current_thread (&swap_lock));
+
+	switch (anon_page->store) {
+		case ANON_COMPRESSED:
+			bitmap_set_multiple (zpool_map, anon_page->slot,
+					DIV_ROUND_UP (anon_page->size, ZCHUNK_SIZE), false);
+			zpool_in_bytes -= PGSIZE;
+			zpool_out_bytes -= anon_page->size;
+			break;
+		case ANON_SWAPPED:
+			bitmap_reset (swap_map, anon_page->slot);
+			break;
+		default:
+			break;
+	}
+	anon_page->store = ANON_NONE;
+}
+
+/* Returns true if the page at KVA consists of one 64-bit value
+ * repeated, and stores that value in *FILL. */
+static bool
+same_filled (const void *kva, uint64_t *fill) {
+	const uint64_t *word = kva;
+	size_t i;
+
+	for (i = 1; i < PGSIZE / sizeof *word; i++)
+		if (word[i] != word[0])
+			return false;
+	*fill = word[0];
+	return true;
+}
+
+/* Returns a hash of the 4 bytes at P. */
+static inline unsigned
+lz_hash (const uint8_t *p) {
+	uint32_t v;
+
+	memcpy (&v, p, sizeof v);
+	return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/* Compresses the page at SRC into DST.  Returns the compressed
+ * size, or 0 if it would exceed DST_MAX bytes.  DST must have
+ * room for DST_MAX + 2 * LZ_MAX_LITERALS bytes, since the check
+ * is made after each item. */
+static size_t
+lz_compress (const uint8_t *src, uint8_t *dst, size_t dst_max) {
+	size_t pos = 0, lit_start = 0, out = 0;
+
+	memset (lz_table, 0, sizeof lz_table);
+	while (pos + LZ_MIN_MATCH <= PGSIZE) {
+		unsigned h = lz_hash (src + pos);
+		size_t cand = lz_table[h];
+		size_t len = 0;
+
+		/* LZ_TABLE holds positions plus 1, so that 0 is empty. */
+		lz_table[h] = pos + 1;
+		if (cand != 0) {
+			cand--;
+			while (pos + len < PGSIZE && len < LZ_MAX_MATCH
+					&& src[cand + len] == src[pos + len])
+				len++;
+		}
+
+		if (len < LZ_MIN_MATCH) {
+			pos++;
+			if (pos - lit_start < LZ_MAX_LITERALS)
+				continue;
+			len = 0;
+		}
+
+		/* Flush pending literals. */
+		if (pos > lit_start) {
+			size_t cnt = pos - lit_start;
+			dst[out++] = cnt - 1;
+			memcpy (dst + out, src + lit_start, cnt);
+			out += cnt;
+		}
+		if (len > 0) {
+			size_t dist = pos - cand;
+			dst[out++] = 0x80 | (len - LZ_MIN_MATCH);
+			dst[out++] = dist & 0xff;
+			dst[out++] = dist >> 8;
+			pos += len;
+		}
+		lit_start = pos;
+		if (out > dst_max)
+			return 0;
+	}
+
+	/* Trailing literals. */
+	while (lit_start < PGSIZE) {
+		size_t cnt = PGSIZE - lit_start;
+
+		if (cnt > LZ_MAX_LITERALS)
+			cnt = LZ_MAX_LITERALS;
+		dst[out++] = cnt - 1;
+		memcpy (dst + out, src + lit_start, cnt);
+		out += cnt;
+		lit_start += cnt;
+	}
+	return out <= dst_max ? out : 0;
+}
+
+/* Decompresses SIZE bytes at SRC into the page at DST.  Returns
+ * false if SRC is corrupt. */
+static bool
+lz_decompress (const uint8_t *src, size_t size, uint8_t *dst) {
+	size_t in = 0, out = 0;
+
+	while (in < size) {
+		uint8_t c = src[in++];
+
+		if (c < 0x80) {
+			size_t cnt = (size_t) c + 1;
+
+			if (out + cnt > PGSIZE || in + cnt > size)
+				return false;
+			memcpy (dst + out, src + in, cnt);
+			in += cnt;
+			out += cnt;
+		} else {
+			size_t len = (c & 0x7f) + LZ_MIN_MATCH;
+			size_t dist;
+
+			if (in + 2 > size)
+				return false;
+			dist = src[in] | (src[in + 1] << 8);
+			in += 2;
+			if (dist == 0 || dist > out || out + len > PGSIZE)
+				return false;
+
+			/* Byte by byte, since the source may overlap. */
+			for (; len > 0; len--, out++)
+				dst[out] = dst[out - dist];
+		}
+	}
+	return out == PGSIZE;
 }
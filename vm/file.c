@@ -1,5 +1,12 @@
 /* file.c: Implementation of memory backed file object (mmaped object). */
 
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/vaddr.h"
 #include "vm/vm.h"
 
 static bool file_backed_swap_in (struct page *page, void *kva);
@@ -14,45 +21,306 @@ static const struct page_operations file_ops = {
 	.type = VM_FILE,
 };
 
+/* Resident file pages, keyed by inode and offset.
+ *
+ * All mappings of the same page of a file share the frame found
+ * here, so a write through one of them is immediately visible
+ * through the others, and the page is read from disk once no
+ * matter how many processes map it.  Executable text is kept
+ * apart: it shares frames only with the same page of the same
+ * segment, and never with a mapping, which may be writable.
+ * Protected by the frame table lock in vm.c, which the callers of
+ * the functions below hold. */
+static struct hash file_frames;
+
+/* Statistics. */
+static long long read_cnt;      /* Pages read from files. */
+static long long write_cnt;     /* Dirty pages written back. */
+static long long clean_cnt;     /* Clean pages dropped without I/O. */
+
+static uint64_t frame_hash (const struct hash_elem *, void *);
+static bool frame_less (const struct hash_elem *, const struct hash_elem *,
+		void *);
+
 /* The initializer of file vm */
 void
 vm_file_init (void) {
+	hash_init (&file_frames, frame_hash, frame_less, NULL);
 }
 
-/* Initialize the file backed page */
+/* Prints file-backed page statistics. */
+void
+file_print_stats (void) {
+	printf ("File pages: %zu resident, %lld read, %lld written back, "
+			"%lld clean\n", hash_size (&file_frames), read_cnt, write_cnt,
+			clean_cnt);
+}
+
+/* Initialize the file backed page.  Its file_page is filled in by
+ * file_backed_load(), the page's lazy initializer. */
 bool
-file_backed_initializer (struct page *page, enum vm_type type, void *kva) {
+file_backed_initializer (struct page *page, enum vm_type type UNUSED,
+		void *kva UNUSED) {
 	/* Set up the handler */
 	page->operations = &file_ops;
 
-	struct file_page *file_page = &page->file;
+	return true;
+}
+
+/* Lazy initializer of file backed pages.  AUX is the page's
+ * struct file_page, which the page takes over. */
+bool
+file_backed_load (struct page *page, void *aux) {
+	page->file = *(struct file_page *) aux;
+	free (aux);
+
+	return file_backed_swap_in (page, page->frame->kva);
+}
+
+/* Returns a copy of FP, with a reference of its own to FP's file,
+ * or a null pointer if memory is short. */
+struct file_page *
+file_page_copy (const struct file_page *fp) {
+	struct file_page *copy = malloc (sizeof *copy);
+
+	if (copy != NULL) {
+		*copy = *fp;
+		copy->file = file_share (fp->file);
+	}
+	return copy;
 }
 
-/* Swap in the page by read contents from the file. */
+/* Returns PAGE's file_page, whether or not the page has been
+ * loaded yet. */
+static const struct file_page *
+file_page_of (const struct page *page) {
+	if (VM_TYPE (page->operations->type) == VM_UNINIT)
+		return page->uninit.aux;
+	return &page->file;
+}
+
+/* Returns the resident frame holding the same file page as PAGE,
+ * or a null pointer if there is none.  If one is found and PAGE
+ * has not been loaded yet, PAGE becomes a file backed page without
+ * reading anything. */
+struct frame *
+file_backed_lookup (struct page *page) {
+	struct frame key, *frame;
+	struct hash_elem *e;
+
+	ASSERT (page_get_type (page) == VM_FILE);
+
+	key.page = page;
+	e = hash_find (&file_frames, &key.file_elem);
+	if (e == NULL)
+		return NULL;
+	frame = hash_entry (e, struct frame, file_elem);
+
+	if (VM_TYPE (page->operations->type) == VM_UNINIT) {
+		struct file_page *aux = page->uninit.aux;
+
+		ASSERT (page->uninit.init == file_backed_load);
+		file_backed_initializer (page, VM_FILE, frame->kva);
+		page->file = *aux;
+		free (aux);
+	}
+
+	/* The frame holds as much of the file as there was when it
+	 * was read, whatever the file held when PAGE was mapped. */
+	page->file.read_bytes = frame->page->file.read_bytes;
+	return frame;
+}
+
+/* Makes FRAME, which holds a freshly read file page, available to
+ * other mappings of that page.  If another frame already holds it,
+ * returns that frame instead and the caller should use it. */
+struct frame *
+file_backed_publish (struct frame *frame) {
+	struct hash_elem *old = hash_insert (&file_frames, &frame->file_elem);
+	struct frame *shared;
+
+	if (old == NULL)
+		return frame;
+	shared = hash_entry (old, struct frame, file_elem);
+	frame->page->file.read_bytes = shared->page->file.read_bytes;
+	return shared;
+}
+
+/* Removes FRAME from the file frame cache, if it is there. */
+void
+file_backed_forget (struct frame *frame) {
+	if (hash_find (&file_frames, &frame->file_elem) == &frame->file_elem)
+		hash_delete (&file_frames, &frame->file_elem);
+}
+
+/* Swap in the page by read contents from the file.  A mapped
+ * page is read up to the current end of the file. */
 static bool
 file_backed_swap_in (struct page *page, void *kva) {
-	struct file_page *file_page UNUSED = &page->file;
+	struct file_page *file_page = &page->file;
+
+	if (!file_page->text) {
+		off_t length = file_length (file_page->file);
+
+		file_page->read_bytes = file_page->ofs >= length ? 0
+			: length - file_page->ofs < PGSIZE ? length - file_page->ofs
+			: PGSIZE;
+	}
+	if (file_read_at (file_page->file, kva, file_page->read_bytes,
+				file_page->ofs) != (off_t) file_page->read_bytes)
+		return false;
+	memset ((uint8_t *) kva + file_page->read_bytes, 0,
+			PGSIZE - file_page->read_bytes);
+	read_cnt++;
+	return true;
 }
 
-/* Swap out the page by writeback contents to the file. */
+/* Swap out the page by writeback contents to the file.  Only a
+ * page that was written through one of its mappings goes to disk;
+ * the part past the end of the file never does.  The frame table
+ * lock must be held, and is released during the write. */
 static bool
 file_backed_swap_out (struct page *page) {
-	struct file_page *file_page UNUSED = &page->file;
+	struct file_page *file_page = &page->file;
+	struct frame *frame = page->frame;
+	bool success;
+
+	if (!vm_frame_clear_dirty (frame)) {
+		clean_cnt++;
+		return true;
+	}
+	vm_frame_io_begin (frame);
+	success = file_write_at (file_page->file, frame->kva,
+			file_page->read_bytes, file_page->ofs)
+		== (off_t) file_page->read_bytes;
+	vm_frame_io_end (frame);
+	if (!success) {
+		pml4_set_dirty (page->owner->pml4, page->va, true);
+		return false;
+	}
+	write_cnt++;
+	return true;
 }
 
 /* Destory the file backed page. PAGE will be freed by the caller. */
 static void
 file_backed_destroy (struct page *page) {
-	struct file_page *file_page UNUSED = &page->file;
+	struct file_page *file_page = &page->file;
+
+	vm_unmap_page (page);
+	file_close (file_page->file);
 }
 
 /* Do the mmap */
 void *
 do_mmap (void *addr, size_t length, int writable,
 		struct file *file, off_t offset) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	uintptr_t start = (uintptr_t) addr;
+	struct file *map_file;
+	size_t page_cnt, i;
+
+	if (addr == NULL || pg_ofs (addr) != 0 || length == 0
+			|| offset < 0 || offset % PGSIZE != 0)
+		return NULL;
+	if (start + length < start || !is_user_vaddr (addr)
+			|| !is_user_vaddr ((void *) (start + length - 1)))
+		return NULL;
+	if (file_length (file) == 0)
+		return NULL;
+
+	page_cnt = DIV_ROUND_UP (length, PGSIZE);
+	for (i = 0; i < page_cnt; i++)
+		if (spt_find_page (spt, (void *) (start + i * PGSIZE)) != NULL)
+			return NULL;
+
+	/* Map every page lazily.  The mapping gets a file of its own,
+	 * so that it outlives the descriptor the user passed us, and
+	 * each page holds a reference to it.  How much of a page the
+	 * file backs is settled when the page is read. */
+	map_file = file_reopen (file);
+	if (map_file == NULL)
+		return NULL;
+	for (i = 0; i < page_cnt; i++) {
+		struct file_page *aux = malloc (sizeof *aux);
+
+		if (aux == NULL)
+			goto fail;
+		aux->file = file_share (map_file);
+		aux->inumber = inode_get_inumber (file_get_inode (file));
+		aux->ofs = offset + i * PGSIZE;
+		aux->read_bytes = 0;
+		aux->text = false;
+		aux->map_cnt = i == 0 ? page_cnt : 0;
+
+		if (!vm_alloc_page_with_initializer (VM_FILE,
+					(void *) (start + i * PGSIZE), writable,
+					file_backed_load, aux)) {
+			file_close (aux->file);
+			free (aux);
+			goto fail;
+		}
+	}
+	file_close (map_file);
+	return addr;
+
+fail:
+	while (i-- > 0)
+		spt_remove_page (spt, spt_find_page (spt, (void *) (start + i * PGSIZE)));
+	file_close (map_file);
+	return NULL;
 }
 
 /* Do the munmap */
 void
 do_munmap (void *addr) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct page *page = spt_find_page (spt, addr);
+	size_t map_cnt, i;
+
+	if (page == NULL || pg_ofs (addr) != 0 || page_get_type (page) != VM_FILE)
+		return;
+
+	map_cnt = file_page_of (page)->map_cnt;
+	for (i = 0; i < map_cnt; i++) {
+		page = spt_find_page (spt, (uint8_t *) addr + i * PGSIZE);
+		if (page != NULL)
+			spt_remove_page (spt, page);
+	}
+}
+
+/* Returns the length that counts toward the frame key of FP.
+ * Segments of an executable may share a page of the file but
+ * zero different parts of it; mappings all read the same. */
+static size_t
+key_bytes (const struct file_page *fp) {
+	return fp->text ? fp->read_bytes : 0;
+}
+
+/* Hashes a resident file frame by the file page it holds. */
+static uint64_t
+frame_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct frame *frame = hash_entry (e, struct frame, file_elem);
+	const struct file_page *fp = file_page_of (frame->page);
+	uint64_t key[4] = { fp->text, fp->inumber, fp->ofs, key_bytes (fp) };
+
+	return hash_bytes (key, sizeof key);
+}
+
+/* Orders resident file frames by the file page they hold. */
+static bool
+frame_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct file_page *a = file_page_of (
+			hash_entry (a_, struct frame, file_elem)->page);
+	const struct file_page *b = file_page_of (
+			hash_entry (b_, struct frame, file_elem)->page);
+
+	if (a->text != b->text)
+		return a->text < b->text;
+	if (a->inumber != b->inumber)
+		return a->inumber < b->inumber;
+	if (a->ofs != b->ofs)
+		return a->ofs < b->ofs;
+	return key_bytes (a) < key_bytes (b);
 }
@@ -6,8 +6,13 @@
  * object (anon, file, page_cache), by initializing the page object,and calls
  * initialization callback that passed from vm_alloc_page_with_initializer
  * function.
+ *
+ * By convention the AUX of every lazily loaded page is either null or
+ * a malloc()'d struct file_page that holds a reference to its
+ * file.  The initialization callback takes ownership of it.
  * */
 
+#include "threads/malloc.h"
 #include "vm/vm.h"
 #include "vm/uninit.h"
 
@@ -62,7 +67,11 @@ uninit_initialize (struct page *page, void *kva) {
  * PAGE will be freed by the caller. */
 static void
 uninit_destroy (struct page *page) {
-	struct uninit_page *uninit UNUSED = &page->uninit;
-	/* TODO: Fill this function.
-	 * TODO: If you don't have anything to do, just return. */
+	struct uninit_page *uninit = &page->uninit;
+	struct file_page *aux = uninit->aux;
+
+	if (aux != NULL) {
+		file_close (aux->file);
+		free (aux);
+	}
 }
@@ -1,9 +1,125 @@
 /* vm.c: Generic interface for virtual memory objects. */
 
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
 #include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/oom.h"
 #include "vm/vm.h"
 #include "vm/inspect.h"
 
+/* Frame table.
+ *
+ * Every frame that backs a user page is on FRAME_TABLE, which the
+ * clock hand sweeps to pick eviction victims.  A frame holding a
+ * file page may be mapped by several pages at once (every mapping
+ * of the same part of the same file shares it, see file.c), so it
+ * keeps a list of all of its pages; FRAME->PAGE is just one of
+ * them.  FRAME_LOCK protects the table, the page lists, the
+ * PAGE->FRAME links and the file frame cache.
+ *
+ * Writing a file page back takes inode locks and may start a
+ * journal operation, which can wait for a thread that is itself
+ * waiting for FRAME_LOCK, so it happens with FRAME_LOCK released
+ * (see vm_frame_io_begin()).  Meanwhile the frame is marked IO,
+ * and anyone who would map, unmap or free it waits on
+ * FRAME_IO_DONE. */
+static struct list frame_table;
+static struct list_elem *clock_hand;
+static size_t frame_cnt;
+static struct lock frame_lock;
+static struct condition frame_io_done;
+
+/* Caches of page and frame descriptors.  vm_dealloc_page() frees
+ * pages with free(), which hands slab objects back to their
+ * cache. */
+static struct kmem_cache *page_cache;
+static struct kmem_cache *frame_cache;
+
+/* Statistics. */
+static long long fault_cnt;     /* Faults that brought in a page. */
+static long long share_cnt;     /* ...of which found the page resident. */
+static long long evict_cnt;     /* Frames evicted. */
+
+/* Same-page merging.
+ *
+ * Processes often hold anonymous pages with the same contents,
+ * above all zeros, and a forked child starts out with a copy of
+ * every page of its parent.  The "merged" kernel thread walks the
+ * frame table a batch of MERGE_BATCH frames every MERGE_INTERVAL
+ * milliseconds, hashes each anonymous frame with hash_bytes() and
+ * looks the hash up in MERGE_FRAMES.  When it finds a frame with
+ * the same contents, it maps the page into that frame read-only,
+ * marks the frame merged and frees the duplicate.  A write to a
+ * merged page faults, and vm_handle_wp() gives the page a private
+ * copy again.
+ *
+ * While a frame is hashed and compared, its page is mapped
+ * read-only, so that a write in the meantime (the scanner may be
+ * preempted) faults and waits for FRAME_LOCK instead of slipping
+ * past the comparison.  Merged frames are never evicted, since
+ * anonymous swap keeps one copy per page. */
+size_t merge_batch = 100;
+unsigned merge_interval = 50;
+static struct hash merge_frames;
+static struct list_elem *merge_hand;
+
+/* Merging statistics. */
+static size_t saved_cnt;        /* Frames saved by merging right now. */
+static size_t peak_saved_cnt;   /* Most frames ever saved at once. */
+static long long saved_sum;     /* Sum of SAVED_CNT after each pass. */
+static long long pass_cnt;      /* Scanner passes. */
+static long long scan_cnt;      /* Frames scanned. */
+static long long merge_cnt;     /* Pages merged into another's frame. */
+static long long unmerge_cnt;   /* Pages given a private copy again. */
+
+/* Per-process resident memory.
+ *
+ * Every mapping of a frame counts once toward the RSS of the
+ * process that owns the page, so a frame shared by N processes
+ * shows up in all N.  A process whose RSS has reached RSS_LIMIT
+ * pages (0 means no limit) evicts one of its own frames for each
+ * new one it needs, and only takes from the shared pool when it
+ * has nothing of its own to give up.
+ *
+ * The "wsampler" thread estimates working sets: every WS_INTERVAL
+ * milliseconds it collects the accessed bits of all mapped pages
+ * and counts, per process, the pages touched since its previous
+ * pass.  The bits it clears are kept in the frame, so that the
+ * clock algorithm still sees them. */
+size_t rss_limit;
+unsigned ws_interval = 100;
+bool rss_report;
+static unsigned ws_pass_cnt;    /* Completed sampling passes. */
+static long long limit_cnt;     /* Evictions forced by RSS_LIMIT. */
+
+/* Stack growth.
+ *
+ * The stack may grow down to STACK_MAX bytes below USER_STACK.
+ * The lowest page of that region is a guard page that is never
+ * mapped, so running off the end of the stack faults and kills
+ * the process instead of running into whatever lies below.
+ *
+ * A fault below the bottom of the stack grows it by every missing
+ * page up to the current bottom, and brings them all in at once:
+ * a function with a large frame touches the whole frame soon, and
+ * would otherwise take one fault per page. */
+size_t stack_max = 1024 * 1024;
+static long long stack_fault_cnt;   /* Faults that grew the stack. */
+static long long stack_page_cnt;    /* Pages the stack grew by. */
+
+static void merge_scanner (void *);
+static void ws_sampler (void *);
+static void merge_forget (struct frame *);
+static uint64_t merge_hash (const struct hash_elem *, void *);
+static bool merge_less (const struct hash_elem *, const struct hash_elem *,
+		void *);
+
 /* Initializes the virtual memory subsystem by invoking each subsystem's
  * intialize codes. */
 void
@@ -15,7 +131,64 @@ vm_init (void) {
 #endif
 	register_inspect_intr ();
 	/* DO NOT MODIFY UPPER LINES. */
-	/* TODO: Your code goes here. */
+	list_init (&frame_table);
+	lock_init (&frame_lock);
+	cond_init (&frame_io_done);
+	page_cache = kmem_cache_create ("page", sizeof (struct page));
+	frame_cache = kmem_cache_create ("frame", sizeof (struct frame));
+	hash_init (&merge_frames, merge_hash, merge_less, NULL);
+	if (merge_batch > 0)
+		thread_create ("merged", PRI_MIN, merge_scanner, NULL);
+	if (ws_interval > 0)
+		thread_create ("wsampler", PRI_MIN, ws_sampler, NULL);
+}
+
+/* Prints virtual memory statistics. */
+void
+vm_print_stats (void) {
+	printf ("VM: %zu frames, %lld faults (%lld shared), %lld evictions "
+			"(%lld at RSS limits)\n",
+			frame_cnt, fault_cnt, share_cnt, evict_cnt, limit_cnt);
+	printf ("Stack: %lld pages grown in %lld faults (%lld faults per MB)\n",
+			stack_page_cnt, stack_fault_cnt,
+			stack_page_cnt ? stack_fault_cnt * (1024 * 1024 / PGSIZE)
+			/ stack_page_cnt : 0);
+	printf ("Merging: %zu frames saved (peak %zu, average %lld over %lld "
+			"passes), %lld frames scanned, %lld merges, %lld unmerges\n",
+			saved_cnt, peak_saved_cnt, pass_cnt ? saved_sum / pass_cnt : 0,
+			pass_cnt, scan_cnt, merge_cnt, unmerge_cnt);
+	anon_print_stats ();
+	file_print_stats ();
+}
+
+/* Returns the number of pages of T accessed during the last
+ * completed sampling pass.  FRAME_LOCK must be held. */
+static size_t
+working_set (const struct thread *t) {
+	return t->ws_pass == ws_pass_cnt ? t->ws_cnt : 0;
+}
+
+/* Stores the current and peak resident set sizes of process T,
+ * and its working set size, in pages. */
+void
+vm_process_usage (struct thread *t, size_t *rss, size_t *peak_rss,
+		size_t *wss) {
+	lock_acquire (&frame_lock);
+	*rss = t->rss;
+	*peak_rss = t->peak_rss;
+	*wss = working_set (t);
+	lock_release (&frame_lock);
+}
+
+/* Prints the resident memory statistics of process T. */
+void
+vm_print_process (struct thread *t) {
+	size_t rss, peak_rss, wss;
+
+	vm_process_usage (t, &rss, &peak_rss, &wss);
+	printf ("%s: %zu resident pages (peak %zu), working set %zu, "
+			"%lld faults, %lld evictions\n",
+			t->name, rss, peak_rss, wss, t->fault_cnt, t->evict_cnt);
 }
 
 /* Get the type of the page. This function is useful if you want to know the
@@ -33,13 +206,22 @@ page_get_type (struct page *page) {
 }
 
 /* Helpers */
-static struct frame *vm_get_victim (void);
+static struct frame *vm_get_victim (struct thread *owner);
 static bool vm_do_claim_page (struct page *page);
-static struct frame *vm_evict_frame (void);
+static bool vm_claim_pinned (struct page *page);
+static struct frame *vm_evict_frame (struct thread *owner);
+static struct frame *vm_get_frame (bool zero);
+static void frame_free (struct frame *);
+static void frame_link (struct frame *, struct page *);
+static void frame_unlink (struct frame *, struct page *);
+static uint64_t page_hash (const struct hash_elem *, void *);
+static bool page_less (const struct hash_elem *, const struct hash_elem *,
+		void *);
+static void page_destructor (struct hash_elem *, void *);
 
 /* Create the pending page object with initializer. If you want to create a
  * page, do not create it directly and make it through this function or
- * `vm_alloc_page`. */
+ * `vm_alloc_page`.  On failure the caller keeps ownership of AUX. */
 bool
 vm_alloc_page_with_initializer (enum vm_type type, void *upage, bool writable,
 		vm_initializer *init, void *aux) {
@@ -47,14 +229,34 @@ vm_alloc_page_with_initializer (enum vm_type type, void *upage, bool writable,
 	ASSERT (VM_TYPE(type) != VM_UNINIT)
 
 	struct supplemental_page_table *spt = &thread_current ()->spt;
+	bool (*initializer) (struct page *, enum vm_type, void *);
+	struct page *page;
 
 	/* Check wheter the upage is already occupied or not. */
 	if (spt_find_page (spt, upage) == NULL) {
-		/* TODO: Create the page, fetch the initialier according to the VM type,
-		 * TODO: and then create "uninit" page struct by calling uninit_new. You
-		 * TODO: should modify the field after calling the uninit_new. */
+		switch (VM_TYPE (type)) {
+			case VM_ANON:
+				initializer = anon_initializer;
+				break;
+			case VM_FILE:
+				initializer = file_backed_initializer;
+				break;
+			default:
+				goto err;
+		}
+
+		page = kmem_cache_alloc (page_cache);
+		if (page == NULL)
+			goto err;
+		uninit_new (page, pg_round_down (upage), init, type, aux, initializer);
+		page->owner = thread_current ();
+		page->writable = writable;
 
-		/* TODO: Insert the page into the spt. */
+		if (!spt_insert_page (spt, page)) {
+			kmem_cache_free (page_cache, page);
+			goto err;
+		}
+		return true;
 	}
 err:
 	return false;
@@ -62,80 +264,480 @@ err:
 
 /* Find VA from spt and return page. On error, return NULL. */
 struct page *
-spt_find_page (struct supplemental_page_table *spt UNUSED, void *va UNUSED) {
-	struct page *page = NULL;
-	/* TODO: Fill this function. */
+spt_find_page (struct supplemental_page_table *spt, void *va) {
+	struct page key;
+	struct hash_elem *e;
 
-	return page;
+	key.va = pg_round_down (va);
+	e = hash_find (&spt->pages, &key.spt_elem);
+	return e != NULL ? hash_entry (e, struct page, spt_elem) : NULL;
 }
 
 /* Insert PAGE into spt with validation. */
 bool
-spt_insert_page (struct supplemental_page_table *spt UNUSED,
-		struct page *page UNUSED) {
-	int succ = false;
-	/* TODO: Fill this function. */
-
-	return succ;
+spt_insert_page (struct supplemental_page_table *spt,
+		struct page *page) {
+	return hash_insert (&spt->pages, &page->spt_elem) == NULL;
 }
 
 void
 spt_remove_page (struct supplemental_page_table *spt, struct page *page) {
+	hash_delete (&spt->pages, &page->spt_elem);
 	vm_dealloc_page (page);
-	return true;
 }
 
-/* Get the struct frame, that will be evicted. */
+/* Returns true if any mapping of FRAME was accessed since the last
+ * call, clearing the accessed bits.  FRAME_LOCK must be held. */
+static bool
+frame_test_and_clear_accessed (struct frame *frame) {
+	struct list_elem *e;
+	bool accessed = frame->accessed;
+
+	frame->accessed = false;
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+
+		if (pml4_is_accessed (page->owner->pml4, page->va)) {
+			pml4_set_accessed (page->owner->pml4, page->va, false);
+			accessed = true;
+		}
+	}
+	return accessed;
+}
+
+/* Returns true if any mapping of FRAME was written since the last
+ * call, clearing the dirty bits.  Clearing comes first so that a
+ * write racing with the caller's write-back marks the page dirty
+ * again.  FRAME_LOCK must be held. */
+bool
+vm_frame_clear_dirty (struct frame *frame) {
+	struct list_elem *e;
+	bool dirty = false;
+
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+
+		if (pml4_is_dirty (page->owner->pml4, page->va)) {
+			pml4_set_dirty (page->owner->pml4, page->va, false);
+			dirty = true;
+		}
+	}
+	return dirty;
+}
+
+/* Get the struct frame, that will be evicted.  This is the clock
+ * algorithm: a frame accessed through any of its mappings since
+ * the hand last passed gets a second chance.  If OWNER is
+ * nonnull, only frames mapped by OWNER alone are considered.
+ * FRAME_LOCK must be held. */
+static struct frame *
+vm_get_victim (struct thread *owner) {
+	size_t i;
+
+	for (i = 0; i < 2 * frame_cnt; i++) {
+		struct frame *frame;
+
+		if (clock_hand == NULL || clock_hand == list_end (&frame_table))
+			clock_hand = list_begin (&frame_table);
+		frame = list_entry (clock_hand, struct frame, elem);
+		clock_hand = list_next (clock_hand);
+
+		if (frame->pin_cnt > 0 || list_empty (&frame->pages) || frame->merged)
+			continue;
+		if (owner != NULL && (frame->page->owner != owner
+					|| list_size (&frame->pages) > 1))
+			continue;
+		if (!frame_test_and_clear_accessed (frame))
+			return frame;
+	}
+	return NULL;
+}
+
+/* Evict one page and return the corresponding frame, pinned and
+ * with no pages.  Only OWNER's own frames are evicted if OWNER is
+ * nonnull.  Return NULL if no frame can be evicted.  A file page
+ * is written back with FRAME_LOCK released, see file.c. */
 static struct frame *
-vm_get_victim (void) {
+vm_evict_frame (struct thread *owner) {
 	struct frame *victim = NULL;
-	 /* TODO: The policy for eviction is up to you. */
+	size_t tries;
+
+	lock_acquire (&frame_lock);
+	for (tries = 0; tries < frame_cnt; tries++) {
+		struct list_elem *e;
+
+		victim = vm_get_victim (owner);
+		if (victim == NULL)
+			break;
+
+		/* Unmap the frame everywhere before writing it out, so
+		 * that nobody can modify it behind our back.  The dirty
+		 * bits survive in the not-present PTEs. */
+		for (e = list_begin (&victim->pages); e != list_end (&victim->pages);
+				e = list_next (e)) {
+			struct page *page = list_entry (e, struct page, frame_elem);
+			pml4_clear_page (page->owner->pml4, page->va);
+		}
+
+		if (swap_out (victim->page)) {
+			if (page_get_type (victim->page) == VM_FILE)
+				file_backed_forget (victim);
+			merge_forget (victim);
+			while (!list_empty (&victim->pages)) {
+				struct page *page = list_entry (list_pop_front (&victim->pages),
+						struct page, frame_elem);
+				page->frame = NULL;
+				page->owner->rss--;
+				page->owner->evict_cnt++;
+			}
+			victim->page = NULL;
+			victim->pin_cnt = 1;
+			evict_cnt++;
+			break;
+		}
+
+		/* Could not write it out: put the mappings back. */
+		for (e = list_begin (&victim->pages); e != list_end (&victim->pages);
+				e = list_next (e)) {
+			struct page *page = list_entry (e, struct page, frame_elem);
+			bool dirty = pml4_is_dirty (page->owner->pml4, page->va);
+
+			pml4_set_page (page->owner->pml4, page->va, victim->kva,
+					page->writable);
+			pml4_set_dirty (page->owner->pml4, page->va, dirty);
+		}
+		victim = NULL;
+	}
+	lock_release (&frame_lock);
 
 	return victim;
 }
 
-/* Evict one page and return the corresponding frame.
- * Return NULL on error.*/
-static struct frame *
-vm_evict_frame (void) {
-	struct frame *victim UNUSED = vm_get_victim ();
-	/* TODO: swap out the victim and return the evicted frame. */
+/* Evicts a frame and gives its page back to the user pool.
+ * Returns false if nothing can be evicted. */
+bool
+vm_reclaim (void) {
+	struct frame *frame = vm_evict_frame (NULL);
 
-	return NULL;
+	if (frame == NULL)
+		return false;
+	lock_acquire (&frame_lock);
+	frame_free (frame);
+	lock_release (&frame_lock);
+	return true;
 }
 
 /* palloc() and get frame. If there is no available page, evict the page
- * and return it. This always return valid address. That is, if the user pool
- * memory is full, this function evicts the frame to get the available memory
- * space.*/
+ * and return it.  The frame is returned pinned and without pages, and
+ * zeroed if ZERO is true.  A process at its RSS limit gets one of
+ * its own frames back instead.
+ * Returns NULL if user memory is exhausted and nothing can be
+ * evicted. */
 static struct frame *
-vm_get_frame (void) {
-	struct frame *frame = NULL;
-	/* TODO: Fill this function. */
+vm_get_frame (bool zero) {
+	struct thread *curr = thread_current ();
+	struct frame *frame;
+	void *kva;
+
+	if (rss_limit > 0 && curr->rss >= rss_limit) {
+		frame = vm_evict_frame (curr);
+		if (frame != NULL) {
+			limit_cnt++;
+			goto evicted;
+		}
+	}
+
+	kva = palloc_get_page (PAL_USER | (zero ? PAL_ZERO : 0));
+	if (kva == NULL) {
+		frame = vm_evict_frame (NULL);
+		if (frame != NULL)
+			goto evicted;
+
+		/* Nothing can be evicted.  Shrink caches or kill a
+		 * process. */
+		kva = oom_get_page (PAL_USER | (zero ? PAL_ZERO : 0));
+		if (kva == NULL)
+			return NULL;
+	}
+
+	frame = kmem_cache_alloc (frame_cache);
+	if (frame == NULL) {
+		palloc_free_page (kva);
+		return NULL;
+	}
+	frame->kva = kva;
+	frame->page = NULL;
+	list_init (&frame->pages);
+	frame->pin_cnt = 1;
+	frame->accessed = false;
+	frame->io = false;
+	frame->merged = false;
+	frame->merge_listed = false;
+
+	lock_acquire (&frame_lock);
+	list_push_back (&frame_table, &frame->elem);
+	frame_cnt++;
+	lock_release (&frame_lock);
 
-	ASSERT (frame != NULL);
 	ASSERT (frame->page == NULL);
 	return frame;
+
+evicted:
+	if (frame != NULL && zero)
+		memset (frame->kva, 0, PGSIZE);
+	return frame;
 }
 
-/* Growing the stack. */
+/* Removes FRAME from the frame table and frees it.  FRAME_LOCK
+ * must be held. */
 static void
-vm_stack_growth (void *addr UNUSED) {
+frame_free (struct frame *frame) {
+	ASSERT (list_empty (&frame->pages));
+
+	if (clock_hand == &frame->elem)
+		clock_hand = list_next (clock_hand);
+	if (merge_hand == &frame->elem)
+		merge_hand = list_next (merge_hand);
+	merge_forget (frame);
+	list_remove (&frame->elem);
+	frame_cnt--;
+	palloc_free_page (frame->kva);
+	kmem_cache_free (frame_cache, frame);
+}
+
+/* Adds PAGE to the mappings of FRAME.  FRAME_LOCK must be held. */
+static void
+frame_link (struct frame *frame, struct page *page) {
+	ASSERT (page->frame == NULL);
+
+	if (frame->merged && !list_empty (&frame->pages)) {
+		saved_cnt++;
+		if (saved_cnt > peak_saved_cnt)
+			peak_saved_cnt = saved_cnt;
+	}
+	list_push_back (&frame->pages, &page->frame_elem);
+	page->frame = frame;
+	if (++page->owner->rss > page->owner->peak_rss)
+		page->owner->peak_rss = page->owner->rss;
+	if (frame->page == NULL)
+		frame->page = page;
+}
+
+/* Removes PAGE from the mappings of FRAME.  A merged frame left
+ * with a single page goes back to being that page's own.
+ * FRAME_LOCK must be held. */
+static void
+frame_unlink (struct frame *frame, struct page *page) {
+	ASSERT (page->frame == frame);
+
+	list_remove (&page->frame_elem);
+	page->frame = NULL;
+	page->owner->rss--;
+	if (frame->merged && !list_empty (&frame->pages))
+		saved_cnt--;
+	if (frame->page == page)
+		frame->page = list_empty (&frame->pages) ? NULL
+			: list_entry (list_front (&frame->pages), struct page, frame_elem);
+	if (frame->merged && list_size (&frame->pages) == 1) {
+		struct page *last = frame->page;
+
+		frame->merged = false;
+		merge_forget (frame);
+		if (last->writable && last->owner->pml4 != NULL)
+			pml4_set_writable (last->owner->pml4, last->va, true);
+	}
+}
+
+/* Maps PAGE to its frame in its owner's page table, read-only if
+ * the frame is merged.  FRAME_LOCK must be held. */
+static bool
+map_page (struct page *page) {
+	return pml4_set_page (page->owner->pml4, page->va, page->frame->kva,
+			page->writable && !page->frame->merged);
+}
+
+/* Marks FRAME as being written back, pinning it, and releases
+ * FRAME_LOCK, which must be held, so that the write may take file
+ * system locks.  Until vm_frame_io_end(), nobody maps, unmaps or
+ * frees FRAME. */
+void
+vm_frame_io_begin (struct frame *frame) {
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+	ASSERT (!frame->io);
+
+	frame->io = true;
+	frame->pin_cnt++;
+	lock_release (&frame_lock);
+}
+
+/* Ends the write-back that vm_frame_io_begin() started on FRAME,
+ * reacquiring FRAME_LOCK. */
+void
+vm_frame_io_end (struct frame *frame) {
+	lock_acquire (&frame_lock);
+	frame->io = false;
+	frame->pin_cnt--;
+	cond_broadcast (&frame_io_done, &frame_lock);
+}
+
+/* Waits until FRAME, if nonnull, is not being written back.
+ * FRAME_LOCK must be held; it is released while waiting.  Returns
+ * true if it had to wait, in which case whatever the caller
+ * looked up under FRAME_LOCK may have changed. */
+static bool
+frame_wait_io (struct frame *frame) {
+	if (frame == NULL || !frame->io)
+		return false;
+	while (frame->io)
+		cond_wait (&frame_io_done, &frame_lock);
+	return true;
+}
+
+/* Removes PAGE's mapping of its frame, if it has one.  A file page
+ * is written back first if it was modified.  The frame is freed
+ * once its last mapping is gone.  Destroy handlers call this. */
+void
+vm_unmap_page (struct page *page) {
+	struct frame *frame;
+
+	lock_acquire (&frame_lock);
+	while (frame_wait_io (page->frame))
+		continue;
+	frame = page->frame;
+	if (frame != NULL) {
+		bool is_file = page_get_type (page) == VM_FILE;
+
+		if (is_file)
+			swap_out (page);
+		if (page->owner->pml4 != NULL)
+			pml4_clear_page (page->owner->pml4, page->va);
+
+		if (list_size (&frame->pages) == 1) {
+			if (is_file)
+				file_backed_forget (frame);
+			frame_unlink (frame, page);
+			frame_free (frame);
+		} else
+			frame_unlink (frame, page);
+	}
+	lock_release (&frame_lock);
+}
+
+/* Returns true if a fault at ADDR, with the user stack pointer at
+ * RSP, is an access to the stack that growing it would satisfy.
+ * PUSH faults 8 bytes below RSP; anything further down is a bad
+ * access, and so is one that lands in the guard page. */
+bool
+is_stack_access (void *addr, uintptr_t rsp) {
+	uint8_t *limit = (uint8_t *) USER_STACK - stack_max + PGSIZE;
+
+	return (uint8_t *) addr >= limit && (uint8_t *) addr < (uint8_t *) USER_STACK
+		&& (uintptr_t) addr >= rsp - 8;
+}
+
+/* Growing the stack.  Allocates and brings in every page from the
+ * one holding ADDR up to the current bottom of the stack.  Returns
+ * true if successful. */
+static bool
+vm_stack_growth (void *addr) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	uint8_t *bottom = pg_round_down (addr);
+	uint8_t *top, *va;
+
+	for (top = bottom; top < (uint8_t *) USER_STACK
+			&& spt_find_page (spt, top) == NULL; top += PGSIZE)
+		if (!vm_alloc_page (VM_ANON | VM_MARKER_0, top, true))
+			return false;
+
+	for (va = bottom; va < top; va += PGSIZE)
+		if (!vm_claim_page (va))
+			return false;
+
+	stack_fault_cnt++;
+	stack_page_cnt += (top - bottom) / PGSIZE;
+	return true;
 }
 
-/* Handle the fault on write_protected page */
+/* Handle the fault on write_protected page.  A write to a page
+ * that the merging scanner write-protected succeeds once the page
+ * has a frame to itself again. */
 static bool
-vm_handle_wp (struct page *page UNUSED) {
+vm_handle_wp (struct page *page) {
+	struct frame *frame, *copy;
+
+	if (!page->writable)
+		return false;
+
+	lock_acquire (&frame_lock);
+	frame = page->frame;
+	if (frame != NULL && frame->merged && list_size (&frame->pages) > 1) {
+		/* Shared with other pages: copy it.  Pin the merged frame
+		 * meanwhile, in case its other pages go away. */
+		frame->pin_cnt++;
+		lock_release (&frame_lock);
+		copy = vm_get_frame (false);
+		lock_acquire (&frame_lock);
+		frame->pin_cnt--;
+		if (copy == NULL) {
+			lock_release (&frame_lock);
+			return false;
+		}
+
+		if (list_size (&frame->pages) > 1) {
+			memcpy (copy->kva, frame->kva, PGSIZE);
+			pml4_clear_page (page->owner->pml4, page->va);
+			frame_unlink (frame, page);
+			frame_link (copy, page);
+			copy->pin_cnt--;
+			map_page (page);
+			unmerge_cnt++;
+			lock_release (&frame_lock);
+			return true;
+		}
+
+		/* The other pages went away while we waited. */
+		frame_free (copy);
+	}
+
+	/* The page has the frame to itself, or it was evicted and
+	 * the next access will fault it back in. */
+	if (frame != NULL) {
+		if (frame->merged) {
+			frame->merged = false;
+			merge_forget (frame);
+		}
+		pml4_set_writable (page->owner->pml4, page->va, true);
+	}
+	lock_release (&frame_lock);
+	return true;
 }
 
 /* Return true on success */
 bool
-vm_try_handle_fault (struct intr_frame *f UNUSED, void *addr UNUSED,
-		bool user UNUSED, bool write UNUSED, bool not_present UNUSED) {
-	struct supplemental_page_table *spt UNUSED = &thread_current ()->spt;
-	struct page *page = NULL;
-	/* TODO: Validate the fault */
-	/* TODO: Your code goes here */
+vm_try_handle_fault (struct intr_frame *f, void *addr,
+		bool user UNUSED, bool write, bool not_present) {
+	struct thread *curr = thread_current ();
+	struct page *page;
+
+	/* Only user addresses of a process are backed by pages. */
+	if (addr == NULL || !is_user_vaddr (addr) || curr->pml4 == NULL)
+		return false;
+
+	page = spt_find_page (&curr->spt, addr);
+	if (page == NULL) {
+		if (!not_present
+				|| !is_stack_access (addr, user ? f->rsp : curr->user_rsp))
+			return false;
+		return vm_stack_growth (addr);
+	}
+	if (!not_present)
+		return vm_handle_wp (page);
+	if (write && !page->writable)
+		return false;
 
 	return vm_do_claim_page (page);
 }
@@ -150,41 +752,403 @@ vm_dealloc_page (struct page *page) {
 
 /* Claim the page that allocate on VA. */
 bool
-vm_claim_page (void *va UNUSED) {
-	struct page *page = NULL;
-	/* TODO: Fill this function */
+vm_claim_page (void *va) {
+	struct page *page = spt_find_page (&thread_current ()->spt, va);
 
+	if (page == NULL)
+		return false;
 	return vm_do_claim_page (page);
 }
 
 /* Claim the PAGE and set up the mmu. */
 static bool
 vm_do_claim_page (struct page *page) {
-	struct frame *frame = vm_get_frame ();
+	if (!vm_claim_pinned (page))
+		return false;
+
+	lock_acquire (&frame_lock);
+	page->frame->pin_cnt--;
+	lock_release (&frame_lock);
+	return true;
+}
+
+/* Brings PAGE into a frame and maps it in its owner's page table,
+ * leaving the frame pinned.  A file page that is already resident
+ * through another mapping shares that frame instead of reading
+ * its own copy. */
+static bool
+vm_claim_pinned (struct page *page) {
+	struct frame *frame, *shared;
+	bool success;
+
+	lock_acquire (&frame_lock);
+	fault_cnt++;
+	page->owner->fault_cnt++;
+	do {
+		frame = page->frame;
+		if (frame == NULL && page_get_type (page) == VM_FILE)
+			frame = file_backed_lookup (page);
+	} while (frame_wait_io (frame));
+	if (frame != NULL && frame != page->frame) {
+		frame_link (frame, page);
+		share_cnt++;
+	}
+	if (frame != NULL) {
+		frame->pin_cnt++;
+		success = map_page (page);
+		if (!success)
+			frame->pin_cnt--;
+		lock_release (&frame_lock);
+		return success;
+	}
+	lock_release (&frame_lock);
+
+	/* Fresh anonymous memory reads as zeros.  Ask for a zeroed
+	 * frame, which is usually pre-zeroed by the idle thread. */
+	frame = vm_get_frame (VM_TYPE (page->operations->type) == VM_UNINIT
+			&& page_get_type (page) == VM_ANON);
+	if (frame == NULL)
+		return false;
 
 	/* Set links */
-	frame->page = page;
-	page->frame = frame;
+	lock_acquire (&frame_lock);
+	frame_link (frame, page);
+	lock_release (&frame_lock);
 
-	/* TODO: Insert page table entry to map page's VA to frame's PA. */
+	if (!swap_in (page, frame->kva)) {
+		lock_acquire (&frame_lock);
+		frame_unlink (frame, page);
+		frame_free (frame);
+		lock_release (&frame_lock);
+		return false;
+	}
 
-	return swap_in (page, frame->kva);
+	lock_acquire (&frame_lock);
+	if (page_get_type (page) == VM_FILE) {
+		do
+			shared = file_backed_publish (frame);
+		while (frame_wait_io (shared));
+		if (shared != frame) {
+			/* Somebody else read the same file page meanwhile.
+			 * Use theirs, so that all mappings stay coherent. */
+			frame_unlink (frame, page);
+			frame_free (frame);
+			frame = shared;
+			frame_link (frame, page);
+			frame->pin_cnt++;
+		}
+	}
+	success = map_page (page);
+	if (!success)
+		frame->pin_cnt--;
+	lock_release (&frame_lock);
+
+	return success;
+}
+
+/* Returns the frame holding PAGE, bringing it in first if
+ * necessary, pinned so that it stays put until the caller drops
+ * PIN_CNT again.  Returns NULL on failure. */
+static struct frame *
+vm_pin_page (struct page *page) {
+	struct frame *frame;
+
+	lock_acquire (&frame_lock);
+	while (frame_wait_io (page->frame))
+		continue;
+	frame = page->frame;
+	if (frame != NULL)
+		frame->pin_cnt++;
+	lock_release (&frame_lock);
+
+	if (frame == NULL && vm_claim_pinned (page))
+		frame = page->frame;
+	return frame;
+}
+
+/* Drops a pin taken on FRAME. */
+static void
+vm_unpin_frame (struct frame *frame) {
+	lock_acquire (&frame_lock);
+	ASSERT (frame->pin_cnt > 0);
+	frame->pin_cnt--;
+	lock_release (&frame_lock);
 }
 
 /* Initialize new supplemental page table */
 void
-supplemental_page_table_init (struct supplemental_page_table *spt UNUSED) {
+supplemental_page_table_init (struct supplemental_page_table *spt) {
+	hash_init (&spt->pages, page_hash, page_less, NULL);
+}
+
+/* Copies SRC, a page of the parent, into the current process. */
+static bool
+copy_page (struct page *src) {
+	enum vm_type type = VM_TYPE (src->operations->type);
+
+	if (type == VM_UNINIT || type == VM_FILE) {
+		/* Not loaded yet, or backed by a file: the child brings it
+		 * in on its own first fault.  File pages end up sharing
+		 * the parent's frame. */
+		vm_initializer *init = file_backed_load;
+		struct file_page *aux = NULL;
+		const struct file_page *src_aux = &src->file;
+
+		if (type == VM_UNINIT) {
+			init = src->uninit.init;
+			type = src->uninit.type;
+			src_aux = src->uninit.aux;
+		}
+		if (src_aux != NULL) {
+			aux = file_page_copy (src_aux);
+			if (aux == NULL)
+				return false;
+		}
+		if (!vm_alloc_page_with_initializer (type, src->va, src->writable,
+					init, aux)) {
+			if (aux != NULL) {
+				file_close (aux->file);
+				free (aux);
+			}
+			return false;
+		}
+		return true;
+	} else {
+		/* Private memory: copy it now. */
+		struct page *dst;
+		struct frame *frame;
+		bool success = false;
+
+		if (!vm_alloc_page (page_get_type (src), src->va, src->writable))
+			return false;
+		dst = spt_find_page (&thread_current ()->spt, src->va);
+
+		frame = vm_pin_page (src);
+		if (frame == NULL)
+			return false;
+		if (vm_claim_pinned (dst)) {
+			memcpy (dst->frame->kva, frame->kva, PGSIZE);
+			vm_unpin_frame (dst->frame);
+			success = true;
+		}
+		vm_unpin_frame (frame);
+		return success;
+	}
 }
 
 /* Copy supplemental page table from src to dst */
 bool
-supplemental_page_table_copy (struct supplemental_page_table *dst UNUSED,
-		struct supplemental_page_table *src UNUSED) {
+supplemental_page_table_copy (struct supplemental_page_table *dst,
+		struct supplemental_page_table *src) {
+	struct hash_iterator i;
+
+	ASSERT (dst == &thread_current ()->spt);
+
+	hash_first (&i, &src->pages);
+	while (hash_next (&i))
+		if (!copy_page (hash_entry (hash_cur (&i), struct page, spt_elem)))
+			return false;
+	return true;
 }
 
 /* Free the resource hold by the supplemental page table */
 void
-supplemental_page_table_kill (struct supplemental_page_table *spt UNUSED) {
-	/* TODO: Destroy all the supplemental_page_table hold by thread and
-	 * TODO: writeback all the modified contents to the storage. */
+supplemental_page_table_kill (struct supplemental_page_table *spt) {
+	/* Destroying a page writes it back if needed, see the destroy
+	 * handlers. */
+	hash_destroy (&spt->pages, page_destructor);
+}
+
+/* Hashes a page by its virtual address. */
+static uint64_t
+page_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct page *page = hash_entry (e, struct page, spt_elem);
+
+	return hash_bytes (&page->va, sizeof page->va);
+}
+
+/* Orders pages by virtual address. */
+static bool
+page_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct page *a = hash_entry (a_, struct page, spt_elem);
+	const struct page *b = hash_entry (b_, struct page, spt_elem);
+
+	return a->va < b->va;
+}
+
+static void
+page_destructor (struct hash_elem *e, void *aux UNUSED) {
+	vm_dealloc_page (hash_entry (e, struct page, spt_elem));
+}
+
+/* Returns true if FRAME holds a single anonymous page that the
+ * scanner may write-protect and merge.  FRAME_LOCK must be held. */
+static bool
+merge_candidate (struct frame *frame) {
+	struct page *page = frame->page;
+
+	return !frame->merged && frame->pin_cnt == 0 && page != NULL
+		&& list_size (&frame->pages) == 1
+		&& VM_TYPE (page->operations->type) == VM_ANON
+		&& page->owner->pml4 != NULL;
+}
+
+/* Write-protects the mapping of FRAME's page, if PROTECT is true,
+ * or gives back the write access the page is entitled to. */
+static void
+merge_protect (struct frame *frame, bool protect) {
+	struct page *page = frame->page;
+
+	if (page->writable)
+		pml4_set_writable (page->owner->pml4, page->va, !protect);
+}
+
+/* Moves the page of candidate frame DUP into merged frame FRAME,
+ * which has the same contents, and frees DUP.  FRAME_LOCK must be
+ * held. */
+static void
+merge_into (struct frame *frame, struct frame *dup) {
+	struct page *page = dup->page;
+
+	ASSERT (frame->merged);
+
+	pml4_clear_page (page->owner->pml4, page->va);
+	frame_unlink (dup, page);
+	frame_free (dup);
+	frame_link (frame, page);
+	map_page (page);
+	merge_cnt++;
+}
+
+/* Scans candidate frame FRAME, merging it with an identical frame
+ * in the merge table if there is one, and putting it in the table
+ * otherwise.  FRAME_LOCK must be held. */
+static void
+merge_scan_frame (struct frame *frame) {
+	struct frame *other = NULL;
+	struct hash_elem *e;
+
+	merge_forget (frame);
+	merge_protect (frame, true);
+	frame->merge_hash = hash_bytes (frame->kva, PGSIZE);
+	scan_cnt++;
+
+	e = hash_find (&merge_frames, &frame->merge_elem);
+	if (e != NULL) {
+		other = hash_entry (e, struct frame, merge_elem);
+		if (other->merged) {
+			if (!memcmp (other->kva, frame->kva, PGSIZE)) {
+				merge_into (other, frame);
+				return;
+			}
+		} else if (merge_candidate (other)) {
+			merge_protect (other, true);
+			if (!memcmp (other->kva, frame->kva, PGSIZE)) {
+				other->merged = true;
+				merge_into (other, frame);
+				return;
+			}
+			merge_protect (other, false);
+		}
+	}
+
+	/* No match.  Merged frames cannot change, so they stay in the
+	 * table; a candidate whose contents changed, or which is no
+	 * longer a candidate, gives way to FRAME. */
+	merge_protect (frame, false);
+	if (other == NULL || !other->merged) {
+		if (other != NULL)
+			merge_forget (other);
+		hash_insert (&merge_frames, &frame->merge_elem);
+		frame->merge_listed = true;
+	}
+}
+
+/* The merging thread. */
+static void
+merge_scanner (void *aux UNUSED) {
+	for (;;) {
+		size_t i;
+
+		timer_msleep (merge_interval);
+
+		lock_acquire (&frame_lock);
+		for (i = 0; i < merge_batch && i < frame_cnt; i++) {
+			struct frame *frame;
+
+			if (merge_hand == NULL || merge_hand == list_end (&frame_table))
+				merge_hand = list_begin (&frame_table);
+			frame = list_entry (merge_hand, struct frame, elem);
+			merge_hand = list_next (merge_hand);
+
+			if (merge_candidate (frame))
+				merge_scan_frame (frame);
+		}
+		pass_cnt++;
+		saved_sum += saved_cnt;
+		lock_release (&frame_lock);
+	}
+}
+
+/* The working-set sampling thread. */
+static void
+ws_sampler (void *aux UNUSED) {
+	for (;;) {
+		struct list_elem *e, *p;
+		unsigned pass;
+
+		timer_msleep (ws_interval);
+
+		lock_acquire (&frame_lock);
+		pass = ws_pass_cnt + 1;
+		for (e = list_begin (&frame_table); e != list_end (&frame_table);
+				e = list_next (e)) {
+			struct frame *frame = list_entry (e, struct frame, elem);
+
+			for (p = list_begin (&frame->pages); p != list_end (&frame->pages);
+					p = list_next (p)) {
+				struct page *page = list_entry (p, struct page, frame_elem);
+				struct thread *t = page->owner;
+
+				if (t->pml4 == NULL || !pml4_is_accessed (t->pml4, page->va))
+					continue;
+				pml4_set_accessed (t->pml4, page->va, false);
+				frame->accessed = true;
+				if (t->ws_pass != pass) {
+					t->ws_pass = pass;
+					t->ws_cnt = 0;
+				}
+				t->ws_cnt++;
+			}
+		}
+		ws_pass_cnt = pass;
+		lock_release (&frame_lock);
+	}
+}
+
+/* Removes FRAME from the merge table, if it is there.  FRAME_LOCK
+ * must be held. */
+static void
+merge_forget (struct frame *frame) {
+	if (frame->merge_listed) {
+		hash_delete (&merge_frames, &frame->merge_elem);
+		frame->merge_listed = false;
+	}
+}
+
+/* Hashes a frame by its contents, as of its last scan. */
+static uint64_t
+merge_hash (const struct hash_elem *e, void *aux UNUSED) {
+	return hash_entry (e, struct frame, merge_elem)->merge_hash;
+}
+
+/* Orders frames by content hash. */
+static bool
+merge_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct frame *a = hash_entry (a_, struct frame, merge_elem);
+	const struct frame *b = hash_entry (b_, struct frame, merge_elem);
+
+	return a->merge_hash < b->merge_hash;
 }